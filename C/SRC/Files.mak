@@ -100,6 +100,7 @@ ZIPSOURCES =		 \
   dict.h                 \
   dirc.c                 \
   dirc.mak               \
+  dircbench              \
   dirsize.c              \
   driver.c               \
   driver.mak             \
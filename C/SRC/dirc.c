@@ -215,13 +215,50 @@
 *    2018-04-30 JFL Check errors for all calls to chdir() and getcwd().	      *
 *		    Rewrote finis() so that it displays errors internally.    *
 *		    Version 3.1.    					      *
+*    2026-10-16 JFL Added option -J to scan subdirectories in parallel in     *
+*		    Unix, using worker threads sharing a work-stealing queue. *
+*		    Version 3.2.    					      *
+*    2026-10-16 JFL Filter directory entries on their name and type first,    *
+*		    and only call stat() for the remaining ones.	      *
+*		    Option -v reports the number of stat() calls avoided.     *
+*		    Version 3.3.    					      *
+*    2026-10-16 JFL Option -c: In Unix, files of different sizes are now      *
+*		    reported as different without reading them, and the       *
+*		    others are compared in memory-mapped views, using AVX2 or *
+*		    SSE2 comparison loops if the processor supports them.     *
+*		    Version 3.4.    					      *
+*    2026-10-16 JFL Added option --cache FILE to remember the SHA-256 digests *
+*		    of large files compared with -c, and compare the cached   *
+*		    digests instead of the data when the files are unchanged. *
+*		    Version 3.5.    					      *
+*    2026-10-16 JFL Store the fif records in a contiguous array, and their    *
+*		    names in large blocks, in per-directory arenas that are   *
+*		    reused. Sort the records in place.			      *
+*		    Version 3.6.    					      *
+*    2026-10-16 JFL trie() now sorts precomputed folded-case keys with a      *
+*		    merge sort, and only calls cmpfif() for ties.	      *
+*		    affiche() only compares left files with right files.      *
+*		    Version 3.7.    					      *
+*    2026-10-16 JFL lis() now also collects the subdirectories for descend(), *
+*		    so that each directory is read only once.		      *
+*		    Version 3.8.    					      *
+*    2026-10-16 JFL Added option -m SIZE to limit the memory used for one     *
+*		    file list. Larger lists are sorted in runs saved in a     *
+*		    temporary file, then affiche() merges the runs.	      *
+*		    Version 3.9.    					      *
+*    2026-10-16 JFL Added option --format=ndjson|binary, for machine-         *
+*		    readable records written through one large buffer.	      *
+*		    Version 3.10.   					      *
+*    2026-10-16 JFL Added option --bench, to display the time spent in each   *
+*		    phase, and the number of system calls. See dircbench.     *
+*		    Version 3.11.   					      *
 *		    							      *
 *       © Copyright 2016-2018 Hewlett Packard Enterprise Development LP       *
 * Licensed under the Apache 2.0 license - www.apache.org/licenses/LICENSE-2.0 *
 \*****************************************************************************/
 
-#define PROGRAM_VERSION "3.1"
-#define PROGRAM_DATE    "2018-04-30"
+#define PROGRAM_VERSION "3.11"
+#define PROGRAM_DATE    "2026-10-16"
 
 #define _CRT_SECURE_NO_WARNINGS 1 /* Avoid Visual C++ 2005 security warnings */
 
@@ -242,6 +279,7 @@
 #endif
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <memory.h>
@@ -321,6 +359,15 @@ static char *strupr(char *pString)
 
 #define SetMasterEnv(string, value) setenv(string, value, 1)
 
+#define HAS_THREADS TRUE	/* Scan subdirectories in parallel with option -J */
+#include <pthread.h>
+#include <fcntl.h>
+
+#define HAS_MMAP TRUE		/* Compare files data in memory-mapped views */
+#include <sys/mman.h>
+#include <signal.h>
+#include <setjmp.h>
+
 /* DOS File attribute constants */
 
 #define _A_NORMAL   0x00    /* Normal file - No read/write restrictions */
@@ -349,6 +396,8 @@ static char *strupr(char *pString)
 #pragma warning(disable:4996)	/* Ignore the deprecated name warning */
 
 #include <conio.h>		/* For getch() */
+#include <io.h>			/* For _setmode() */
+#include <fcntl.h>		/* For _O_BINARY */
 
 #define DIRSEPARATOR '\\'
 #define PATTERN_ALL "*"     		/* Pattern matching all files */
@@ -415,6 +464,21 @@ int SetMasterEnv(char *pszName, char *pszValue);
 #error "Unidentified OS. Please define OS-specific settings for it."
 #endif
 
+#ifndef HAS_THREADS
+#define HAS_THREADS FALSE
+#endif
+#ifndef HAS_MMAP
+#define HAS_MMAP FALSE
+#endif
+
+/* Use vectorized memory comparisons if the CPU supports them */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_SIMD TRUE
+#include <immintrin.h>
+#else
+#define HAS_SIMD FALSE
+#endif
+
 /********************** End of OS-specific definitions ***********************/
 
 /* Local definitions */
@@ -452,6 +516,24 @@ typedef enum {
 
 #define MISMATCH (-32767)
 
+#define FORMAT_TEXT   0	    /* Side by side columns (Default) */
+#define FORMAT_NDJSON 1	    /* One JSON object per line */
+#define FORMAT_BINARY 2	    /* Length-prefixed binary records */
+
+#define BENCH_SCAN    0	    /* Reading directories, in lis() */
+#define BENCH_SORT    1	    /* Sorting file lists, in trie() */
+#define BENCH_COMPARE 2	    /* Comparing files data, in filecompare() */
+#define BENCH_PHASES  3
+
+typedef struct {	    /* Performance counters for option --bench */
+  double dTime[BENCH_PHASES];	/* Time spent in each phase, in seconds */
+  long nCalls[BENCH_PHASES];	/* Number of directories, lists, file pairs */
+  long nOpens;			/* Compare: Number of open() calls */
+  long nStats;			/* Compare: Number of stat() calls */
+  long nMaps;			/* Compare: Number of mmap() calls */
+  long nReads;			/* Compare: Number of read() calls */
+} benchstats;
+
 #define RETCODE_SUCCESS 0	    /* Return codes processed by finis() */
 #define RETCODE_NO_FILE 1	    // Note: Value 1 required by HP Preload -env option
 #define RETCODE_TOO_MANY_FILES 2    // Note: Value 2 required by HP Preload -env option
@@ -471,14 +553,61 @@ typedef int (*PSTATFUNC)(const char *path, struct stat *buf);
 
 typedef struct fif {	    /* OS-independant FInd File structure */
   char *name; 			/* File node name, ending with a NUL */
-  struct stat st;		/* File size, time, etc */
 #ifndef _MSDOS
   char *target; 		/* Link target name, for links */
 #endif
-  int column;
-  struct fif *next;
+  uintmax_t size;		/* File size */
+  time_t mtime;			/* File modification time */
+  unsigned int mode;		/* File type and permissions */
+  int column;			/* 1 = left column; 2 = right column */
+#if _MSVCLIBX_STAT_DEFINED
+  unsigned long win32attrs;	/* Windows file attributes */
+  unsigned long reparsetag;	/* Windows reparse point tag */
+#endif
 } fif;
 
+typedef struct fifchunk {   /* A block of memory in a fif arena */
+  struct fifchunk *next;	/* Next block, or NULL */
+  size_t size;			/* Number of bytes available in data[] */
+  char data[1];			/* The strings stored in the block */
+} fifchunk;
+
+typedef struct fifarena {   /* Bump-pointer arena for a fif array and its names */
+  fif *pFifs;			/* Contiguous array of fif records */
+  int nFifs;			/* Number of records used in the above array */
+  int nAlloc;			/* Number of records allocated */
+  fifchunk *pFirst;		/* First block of strings memory */
+  fifchunk *pCur;		/* Block strings are currently allocated from */
+  size_t nUsed;			/* Number of bytes used in the current block */
+  char **ppNames;		/* Hash table of interned names */
+  size_t nSlots;		/* Size of the above table. A power of 2 */
+  size_t nNames;		/* Number of names in the above table */
+  size_t nStrUsed;		/* Number of bytes used in all blocks */
+  FILE *pfRuns;			/* Temporary file with sorted runs, or NULL */
+  struct fifrun *pRuns;		/* Array of runs saved in the above file */
+  int nRuns;			/* Number of runs in the above array */
+} fifarena;
+
+typedef struct fifrun {	    /* A sorted run of fif records in a temporary file */
+  fpos_t pos;			/* File position of the first unbuffered byte */
+  long nLeft;			/* Number of records not read yet */
+  char *pBuf;			/* Read buffer */
+  size_t nBufSize;		/* Size of the read buffer */
+  size_t nBuf;			/* Number of bytes in the read buffer */
+  size_t iBuf;			/* Index of the first unread byte in the buffer */
+  fif f;			/* Current record */
+} fifrun;
+
+typedef struct fifreader {  /* Read a fif arena in sorted order */
+  fifarena *pfa;		/* The arena */
+  int iNext;			/* Index of the next in-memory record */
+  int *piHeap;			/* Min-heap of run indexes, or NULL if no runs */
+  int nHeap;			/* Number of runs in the heap */
+  fif aSlots[2];		/* Copies of the last two records returned */
+  char *pSlotBufs;		/* Strings buffers for the above copies */
+  int iSlot;			/* Index of the slot to use next */
+} fifreader;
+
 /* Global variables */
 
 #if HAS_DRIVES
@@ -492,7 +621,7 @@ int ignorecase = IGNORECASE;        /* If TRUE, ignore case in file names */
 int iPause = 0;			    /* If > 0, number of lines between pauses */
 char path1[PATHNAME_SIZE] = {0};    /* First path scanned */
 char path2[PATHNAME_SIZE] = {0};    /* Second path scanned */
-fif *firstfif = NULL;		    /* Pointer to the first allocated fif structure */
+fifarena faFiles = {0};		    /* Arena for the files listed. Reused for each dir. */
 long lNFileFound = 0;		    /* Total number of distinct files found */
 long lLFileFound = 0;		    /* Total number of left files found */
 long lRFileFound = 0;		    /* Total number of right files found */
@@ -500,8 +629,14 @@ long lEFileFound = 0;		    /* Total number of equal files found */
 uintmax_t llLTotalSize = 0;	    /* Total size of left files found */
 uintmax_t llRTotalSize = 0;	    /* Total size of right files found */
 uintmax_t llETotalSize = 0;	    /* Total size of equal files found */
+long lNEntries = 0;		    /* Number of directory entries read, but . and .. */
+long lNStatCalls = 0;		    /* Number of stat() calls done for them */
+size_t nMemLimit = 0;		    /* Memory limit for a file list. 0=None */
+int iBench = FALSE;		    /* If TRUE, measure the time of each phase */
+benchstats bs = {{0}};		    /* The phases times and system calls counts */
 int iUpperCase = FALSE; 	    /* If TRUE, display names in upper case */
 int iVerbose = FALSE;		    /* If TRUE, display verbose information */
+int iFormat = FORMAT_TEXT;	    /* Output format */
 int iRows = 0;                      /* Number of rows of the display */
 int iCols = 0;                      /* Number of columns of the display */
 int iYearWidth = 2;		    /* Width of the year field displayed */
@@ -509,6 +644,9 @@ int iNameWidth = 12;		    /* Width of the file name field displayed */
 int iSizeWidth = 8;		    /* Width of the file size field displayed */
 int iContinue = TRUE;		    /* 1=Continue after errors; 0=Abort */
 PSTATFUNC pStat = lstat;	    /* Function to use for getting file infos */
+#if HAS_THREADS
+int iJobs = 0;			    /* If > 1, number of threads scanning subdirs */
+#endif
 #ifdef _WIN32
 // UINT cp = 0;			    /* Initial console code page */
 #define cp codePage		    /* Initial console code page in iconv.c */
@@ -522,26 +660,57 @@ void usage(void);                   /* Display a brief help and exit */
 void finis(int retcode, ...);       /* Return to the initial drive & exit */
 int IsSwitch(char *pszArg);	    /* Is this a command-line switch? */
 
-int lis(char *, char *, int, int, int, time_t, time_t); /* Scan a directory */
-int CDECL cmpfif(const fif **fif1, const fif **fif2);
-void trie(fif **ppfif, int nfif);
-int affiche(fif **, int, int, BOOL, BOOL, BOOL); /* Display sorted list on two columns */
+int lis(fifarena *, fifarena *, char *, char *, int, int, time_t, time_t); /* Scan a directory */
+int GetDirentStat(char *pathname, struct dirent *pDirent, struct stat *pst);
+int CDECL cmpfif(const fif *fif1, const fif *fif2);
+void trie(fif *pfif, int nfif);
+int affiche(fifarena *, int, BOOL, BOOL, BOOL); /* Display sorted list on two columns */
 void affichePaths(void);
 int affiche1(fif *pfif, int col);
-int descend(char *from, char *to,
+int descend(fifarena *pDirs, char *from, char *to,
             char *pattern, int attrib,
             BOOL both, BOOL diff, BOOL zero,
 	    time_t datemin, time_t datemax);
-fif **AllocFifArray(size_t nfif);   /* Allocate an array of fif pointers */
-void FreeFifArray(fif **fiflist);
+#if HAS_THREADS
+int pdescend(char *from, char *to,  /* Like descend, using iJobs threads */
+             char *pattern, int attrib,
+             BOOL both, BOOL diff, BOOL zero,
+	     time_t datemin, time_t datemax);
+#endif
+void InitFifArena(fifarena *pfa);   /* Initialize an empty fif arena */
+fif *NewFif(fifarena *pfa, char *name, struct stat *pst, int col); /* Append a fif */
+char *FifArenaStrDup(fifarena *pfa, char *string); /* Copy a string into the arena */
+void ResetFifArena(fifarena *pfa);  /* Empty the arena, keeping its memory */
+void FreeFifArena(fifarena *pfa);   /* Empty the arena, and free its memory */
+void CheckFifArena(fifarena *pfa);  /* Move records to a temp file if over limit */
+void OpenFifReader(fifreader *pfr, fifarena *pfa); /* Sort the arena records */
+fif *NextFif(fifreader *pfr);	    /* Get the next record in sorted order */
+void CloseFifReader(fifreader *pfr);
 
 int makepathname(char *, char *, char *);
 int filecompare(char *, char *);    /* Compare two files */
-int CompareToNext(fif **);	    /* Compare dates w. next entry in fiflist */
+#if HAS_MMAP
+int CompareFdData(int fd1, int fd2, off_t size, char *pbuf1, char *pbuf2);
+int CompareFileDigests(char *name1, int fd1, struct stat *pst1,
+		       char *name2, int fd2, struct stat *pst2, char *pbuf1, char *pbuf2);
+void OpenCache(void);		    /* Load the content hash cache */
+void CloseCache(void);		    /* Save the content hash cache */
+extern char *pszCacheFile;	    /* Content hash cache file name */
+extern long lNCacheHits;	    /* Number of digests found in the cache */
+extern long lNCacheMisses;	    /* Number of digests computed */
+#endif
+int CompareToNext(fif *, fif *);    /* Compare dates w. next entry in fiflist */
 
 int GetScreenRows(void);	    /* Get the number of rows of a text screen */
 int GetScreenColumns(void);	    /* Get the number of columns of a text screen */
 void printflf(void);		    /* Print a line feed, and possibly pause */
+void OutWrite(const void *pData, size_t n); /* Write to the output buffer */
+void OutFlush(void);		    /* Write the output buffer to stdout */
+void OutDirRecord(void);	    /* Output a record with path1 and path2 */
+void OutFileRecord(fif *pLeft, fif *pRight, int difference);
+double BenchTime(void);		    /* Get a monotonic time in seconds */
+void BenchAdd(int iPhase, double dStart); /* Count one call of a phase */
+void BenchReport(double dStart);    /* Display the --bench results table */
 
 int parse_date(char *token, time_t *pdate);
 
@@ -576,8 +745,9 @@ int main(int argc, char *argv[]) {
   BOOL both = FALSE;		/* If true, list only files present in both paths */
   BOOL diff = FALSE;		/* If true, list only files that don't match */
   int i;
-  int nfif = 0;
   BOOL recur = FALSE;         /* If true, list subdirectories recursively */
+  fifarena faDirs;	      /* Subdirectories found, for descend() */
+  fifarena *pDirs = NULL;
   /* File attributes to search, ie. all but disk labels. */
 #if defined(__unix__)
   int attrib = (_A_SUBDIR | _A_SYSTEM | _A_HIDDEN | _A_LINK | _A_DEVICE);
@@ -592,12 +762,13 @@ int main(int argc, char *argv[]) {
   time_t datemax = TIME_T_MAX;/* Maximum date stamp */
   char *dateminarg = NULL;    /* Minimum date argument */
   char *datemaxarg = NULL;    /* Maximum date argument */
-  fif **fiflist;		/* Array of fif pointers for sorting */
   int iStats = FALSE;
+  FILE *pfInfo = stdout;      /* Where to report the -v and -t information */
 #ifdef _MSDOS
   char *pszOneToEnv = NULL;	/* Copy one file name to environment variable */
 #endif
   int iBudget;
+  double dStart = 0;		/* Start time for --bench */
 
 #if HAS_DRIVES
   init_drive = (char)_getdrive();
@@ -627,10 +798,24 @@ int main(int argc, char *argv[]) {
 	diff = TRUE;
 	continue;
       }
+      if (streq(opt, "-bench")) { /* Measure each phase duration */
+	iBench = TRUE;
+	continue;
+      }
       if (streq(opt, "c")) {
 	filecomp = TRUE;
 	continue;
       }
+#if HAS_MMAP
+      if (streq(opt, "cache") || streq(opt, "-cache")) { /* Content hash cache */
+	if ((i+1) < argc) {
+	  pszCacheFile = argv[++i];
+	} else {
+	  usage();
+	}
+	continue;
+      }
+#endif
 				  /* Don't forget to add switches to...
 				      ... the Recurse list below,
 				      ... the Usage display further down.
@@ -702,6 +887,22 @@ int main(int argc, char *argv[]) {
 	ignoretime = TRUE;	/* Ignore file date and time completely */
 	continue;
       }
+#if HAS_THREADS
+      if (streq(opt, "J")) {	/* Number of threads for scanning subdirs */
+	iJobs = 0;		/* Default: One per processor */
+	if (((i+1) < argc) && !IsSwitch(argv[i+1])) {
+	  char *pc;
+	  long l = strtol(argv[i+1], &pc, 10);
+	  if (!*pc) { /* It's a valid number */
+	    iJobs = (int)l;
+	    i += 1;
+	  }
+	}
+	if (iJobs <= 0) iJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (iJobs <= 0) iJobs = 1;
+	continue;
+      }
+#endif
       if (streq(opt, "K")) {
 	ignorecase = TRUE;	/* Ignore case completely in file names */
 	continue;
@@ -714,6 +915,25 @@ int main(int argc, char *argv[]) {
 	pStat = stat;		/* Compare link targets */
 	continue;
       }
+      if (streq(opt, "m") || streq(opt, "-max-mem")) { /* File list memory limit */
+	char *pszEnd;
+	double dLimit;
+	if ((i+1) >= argc) usage();
+	dLimit = strtod(argv[++i], &pszEnd);
+	if (pszEnd == argv[i]) dLimit = 0; /* No number */
+	switch (toupper(*pszEnd)) {
+	  case 'G': dLimit *= 1024;	/* Fall through */
+	  case 'M': dLimit *= 1024;	/* Fall through */
+	  case 'K': dLimit *= 1024; pszEnd++; /* Fall through */
+	  default: break;
+	}
+	if (*pszEnd || !(dLimit >= 1)) { /* Also rejects NaN */
+	  finis(RETCODE_INACCESSIBLE, "Invalid memory size: %s", argv[i]);
+	}
+	if (dLimit >= (double)(size_t)-1) dLimit = (double)(size_t)-1;
+	nMemLimit = (size_t)dLimit;
+	continue;
+      }
       if (streq(opt, "nologo")) { /* Kept for compatibility with old scripts using it. */
 	continue;		  /* Do nothing */
       }
@@ -727,6 +947,25 @@ int main(int argc, char *argv[]) {
 	continue;
       }
 #endif
+      if (!strncmp(opt, "-format", 7) && ((opt[7] == '=') || !opt[7])) {
+	char *pszFormat = opt + 8;	/* --format=FMT or --format FMT */
+	if (!opt[7]) {
+	  if ((i+1) >= argc) usage();
+	  pszFormat = argv[++i];
+	}
+	if (streq(pszFormat, "text")) {
+	  iFormat = FORMAT_TEXT;
+	} else if (streq(pszFormat, "ndjson")) {
+	  iFormat = FORMAT_NDJSON;
+#ifndef _MSDOS
+	} else if (streq(pszFormat, "binary")) {
+	  iFormat = FORMAT_BINARY;
+#endif
+	} else {
+	  finis(RETCODE_INACCESSIBLE, "Unsupported output format: %s", pszFormat);
+	}
+	continue;
+      }
       if (streq(opt, "p")) {
 	iPause = GetScreenRows() - 1; /* Pause once per screen */
 	continue;
@@ -824,6 +1063,12 @@ int main(int argc, char *argv[]) {
   DEBUG_PRINTF(("// Outputing using code page %d\n", cp));
 #endif
 
+  if (iBench) dStart = BenchTime();
+
+#if HAS_MMAP
+  if (pszCacheFile && filecomp) OpenCache();
+#endif
+
   /* Dynamically size columns based on screen width */
   iRows = GetScreenRows();
   if (!iCols) iCols = GetScreenColumns(); // If not forced by the -w option
@@ -870,18 +1115,26 @@ int main(int argc, char *argv[]) {
   if (to) FixNameCase(to);
 #endif // !defined(__unix__)
 
-  nfif = lis(from, pattern, 0, ndir=1, attrib, datemin, datemax);
-  if (to) nfif = lis(to, pattern, nfif, ++ndir, attrib, datemin, datemax);
-  DEBUG_PRINTF(("nfif = %d;\n", nfif));
+  InitFifArena(&faDirs);
+  if (recur) pDirs = &faDirs; /* Get the subdirectories in the same pass */
+#if HAS_THREADS
+  if (iJobs > 1) pDirs = NULL; /* pdescend() scans them in parallel */
+#endif
+  lis(&faFiles, pDirs, from, pattern, ndir=1, attrib, datemin, datemax);
+  if (to) lis(&faFiles, pDirs, to, pattern, ++ndir, attrib, datemin, datemax);
+  DEBUG_PRINTF(("nfif = %d;\n", faFiles.nFifs));
 
-  fiflist = AllocFifArray(nfif);
-  trie(fiflist, nfif);
-  affiche(fiflist, nfif, ndir, both, diff, zero);
-  FreeFifArray(fiflist);
+  affiche(&faFiles, ndir, both, diff, zero);
 
   if (recur) {
-    descend(from, to, pattern, attrib, both, diff, zero, datemin, datemax);
-    if (lNFileFound) { /* Only list the total if it's not null */
+#if HAS_THREADS
+    if (iJobs > 1) {
+      pdescend(from, to, pattern, attrib, both, diff, zero, datemin, datemax);
+    } else
+#endif
+    descend(&faDirs, from, to, pattern, attrib, both, diff, zero, datemin, datemax);
+    FreeFifArena(&faDirs);
+    if (lNFileFound && (iFormat == FORMAT_TEXT)) { /* Only list the total if it's not null */
       printflf();
       printf("Total: %ld files or directories listed.", lNFileFound);
       printflf();
@@ -895,7 +1148,7 @@ int main(int argc, char *argv[]) {
       case 0:
 	finis(RETCODE_NO_FILE, NULL);
       case 1:
-	i = SetMasterEnv(pszOneToEnv, fiflist[0]->name);
+	i = SetMasterEnv(pszOneToEnv, faFiles.pFifs[0].name);
 	if (i) printf("Out of environment space.\n");
 	finis(RETCODE_SUCCESS);
       default:
@@ -904,21 +1157,47 @@ int main(int argc, char *argv[]) {
   }
 #endif
 
+#if HAS_MMAP
+  if (pszCacheFile && filecomp) CloseCache();
+#endif
+
+  if (iFormat != FORMAT_TEXT) { /* Keep stdout for the records */
+    OutFlush();
+    pfInfo = stderr;
+  }
+#define INFOLF() do { if (pfInfo == stdout) printflf(); else fputc('\n', pfInfo); } while (0)
+
+  if (iVerbose) {
+    INFOLF();
+    fprintf(pfInfo, "Read %ld directory entries. Avoided %ld stat() calls.",
+		lNEntries, lNEntries - lNStatCalls);
+    INFOLF();
+#if HAS_MMAP
+    if (pszCacheFile && filecomp) {
+      fprintf(pfInfo, "Found %ld file digests in the cache. Computed %ld.",
+		  lNCacheHits, lNCacheMisses);
+      INFOLF();
+    }
+#endif
+  }
+
   if (iStats) {
-    printflf();
-    printf("Listed %ld files in %s. Total size %"PRIuMAX" bytes.",
+    INFOLF();
+    fprintf(pfInfo, "Listed %ld files in %s. Total size %"PRIuMAX" bytes.",
 		lLFileFound, from, llLTotalSize);
-    printflf();
+    INFOLF();
   }
   if (iStats && to) {
-    printf("Listed %ld files in %s. Total size %"PRIuMAX" bytes.",
+    fprintf(pfInfo, "Listed %ld files in %s. Total size %"PRIuMAX" bytes.",
 		lRFileFound, to, llRTotalSize);
-    printflf();
-    printf("%ld files were equal. Total size %"PRIuMAX" bytes.",
+    INFOLF();
+    fprintf(pfInfo, "%ld files were equal. Total size %"PRIuMAX" bytes.",
 		lEFileFound, llETotalSize);
-    printflf();
+    INFOLF();
   }
 
+  if (iBench) BenchReport(dStart);
+
   finis(RETCODE_SUCCESS);
   return 0; // Satisfy the compiler.
 }
@@ -992,7 +1271,12 @@ Switches:\n\
   -b          Display only the files present in both directories.\n\
   -d          Display only files which are different.\n\
   -bd         Both.\n\
+  --bench     Display the time spent scanning, sorting, and comparing files.\n\
   -c          Compare the actual data of the files. May take a long time!\n"
+#if HAS_MMAP
+"\
+  --cache F   With -c, remember file digests in file F, to speed up later runs.\n"
+#endif
 #ifdef _DEBUG
 "\
   -D          Output debug information.\n"
@@ -1006,11 +1290,23 @@ Switches:\n\
 #endif
 "\
   -f          List files only, but not subdirectories.\n\
+  --format=FMT  Output format: text (default), ndjson"
+#ifndef _MSDOS
+", binary"
+#endif
+". See below.\n\
   -i          Ignore integer number of hours differences, up to +/- 23 hours.\n\
-  -j          Ignore date/time completely.\n\
+  -j          Ignore date/time completely.\n"
+#if HAS_THREADS
+"\
+  -J [N]      Scan subdirectories with N threads. Default: 1 per processor.\n"
+#endif
+"\
   -k          Consider case in file name comparisons." MATCHCASEDEFAULT "\n\
   -K          Ignore case in file name comparisons." IGNORECASEDEFAULT "\n\
-  -L          Compare link targets, instead of the links themselves\n"
+  -L          Compare link targets, instead of the links themselves\n\
+  -m SIZE     Limit the memory used for one file list. Suffixes K, M, G.\n\
+              Larger lists are sorted in temporary files. Default: No limit\n"
 #ifdef _WIN32
 "\
   -O          Force encoding the output using the OEM character set.\n"
@@ -1026,7 +1322,7 @@ Switches:\n\
   -U          Force encoding the output using the UTF-8 character encoding.\n"
 #endif
 "\
-  -v          Verbose mode\n\
+  -v          Verbose mode. Also report directory scan statistics.\n\
   -V          Display this program version and exit.\n\
   -w COLS     Set the output width. Default: The display width.\n"
 #ifdef _WIN32
@@ -1038,6 +1334,15 @@ Switches:\n\
   -z          Don't list a directory if no file is to appear in it.\n\
   -from Y/M/D List only files starting from that date. Also -from -D days.\n\
   -to Y/M/D   List only files up to that date. Also -to -D days.\n\
+\n\
+Format ndjson: Each directory pair starts with a {\"type\":\"dir\"} object, followed\n\
+by one {\"type\":\"file\"} object per file, or per pair of matching files.\n\
+Their cmp field contains the same comparison symbol as the text output.\n"
+#ifndef _MSDOS
+"\
+Format binary: The same information, in length-prefixed binary records.\n"
+#endif
+"\
 \n"
 #ifdef _MSDOS
 "Author: Jean-Francois Larvoire"
@@ -1088,6 +1393,8 @@ void finis(int retcode, ...) {
     va_end(vl);
   }
 
+  if (iFormat != FORMAT_TEXT) OutFlush(); /* Output the records still buffered */
+
 #if HAS_DRIVES
   _chdrive(init_drive);
 #endif
@@ -1120,6 +1427,53 @@ int IsSwitch(char *pszArg) {
 	 ); /* It's a switch */
 }
 
+/******************************************************************************
+*                                                                             *
+*       Function:       GetDirentStat                                         *
+*                                                                             *
+*       Description:    Get the file information for a directory entry        *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         char *pathname	The entry full pathname                       *
+*         struct dirent *pDirent	The entry found by readdir()          *
+*         struct stat *pst	Where to store the information                *
+*                                                                             *
+*       Return value:   0=Success; -1=Failure. In this case *pst is cleared.  *
+*                                                                             *
+*       Notes:          With option -L, dead links are described by lstat(). *
+*                       Counts the stat() system calls done, so that option   *
+*                       -v can report how many were avoided.                  *
+*                                                                             *
+*       Updates:                                                              *
+*        2026-10-16 JFL Split off of lis().                                   *
+*                                                                             *
+******************************************************************************/
+
+int GetDirentStat(char *pathname, struct dirent *pDirent, struct stat *pst) {
+  int err;
+
+#if !_DIRENT2STAT_DEFINED
+  err = pStat(pathname, pst);
+  lNStatCalls += 1;
+#else
+  if (pStat == lstat) {
+    err = dirent2stat(pDirent, pst);
+  } else {
+    err = stat(pathname, pst);
+    lNStatCalls += 1;
+  }
+#endif
+#if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
+  if (err && (pStat != lstat)) { /* Dead link with option -L. Describe the link itself. */
+    err = lstat(pathname, pst);
+    lNStatCalls += 1;
+  }
+#endif
+  if (err) memset(pst, 0, sizeof(struct stat));
+  return err;
+}
+
 /******************************************************************************
 *                                                                             *
 *       Function:       lis                                                   *
@@ -1128,18 +1482,22 @@ int IsSwitch(char *pszArg) {
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
+*         fifarena *pfa		Arena to append the fif records to.           *
+*         fifarena *pDirs	Arena to append subdirectories to, or NULL.   *
 *         char *startdir	Directory to scan. If "NUL", don't scan.      *
 *         char *pattern		Wildcard pattern.                             *
-*         int nfif		Number of files/directories found so far.     *
 *         int col		1 = left column; 2 = right column.            *
 *         int attrib		Bit 15: List directories exclusively.         *
 *                       	Bits 7-0: File/directory attribute.           *
 *         time_t datemin	Minimal date, or 0 if no minimum.             *
 *         time_t datemax	Maximal date, or 0 if no maximum.             *
 *                                                                             *
-*       Return value:   Total number of files/directories in fif array.       *
+*       Return value:   Total number of files/directories in the arena.       *
 *                                                                             *
-*       Notes:                                                                *
+*       Notes:          The subdirectories are collected in the same pass,    *
+*                       for descend(), independently of the pattern, attrib,  *
+*                       and dates. Their fif records only have a valid type,  *
+*                       unless stat() had to be called anyway.                *
 *                                                                             *
 *       Updates:                                                              *
 *                                                                             *
@@ -1148,30 +1506,35 @@ int IsSwitch(char *pszArg) {
 #ifdef _MSC_VER
 #pragma warning(disable:4706) /* Ignore the "assignment within conditional expression" warning */
 #endif
-int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
-	    time_t datemin, time_t datemax) {
+int lis(fifarena *pfa, fifarena *pDirs, char *startdir, char *pattern, int col,
+	    int attrib, time_t datemin, time_t datemax) {
 #if HAS_DRIVES
   char initdrive;                 /* Initial drive. Restored when done. */
 #endif
   NEW_PATHNAME_BUF(initdir);	    /* Initial directory. Restored when done. */
   NEW_PATHNAME_BUF(path);	    /* Temporary pathname */
   NEW_PATHNAME_BUF(pathname);
+#ifndef _MSDOS
+  NEW_PATHNAME_BUF(target);	    /* Link target */
+#endif
   int err;
   char pattern2[NODENAME_SIZE];
-  char *pname;
+  int bSplit = FALSE;		    /* TRUE if the pattern came from startdir */
   DIR *pDir;
   struct dirent *pDirent;
   char *pcd;
+  double dStart = iBench ? BenchTime() : 0;
 
   DEBUG_ENTER(("lis(\"%s\", \"%s\", %d, %d, 0x%X, 0x%lX, 0x%lX);\n", startdir, pattern,
-	       nfif, col, attrib, (unsigned long)datemin, (unsigned long)datemax));
+	       pfa->nFifs, col, attrib, (unsigned long)datemin, (unsigned long)datemax));
 
 #if PATHNAME_BUFS_IN_HEAP
-  if ((!initdir) || (!path)) {
-    FREE_PATHNAME_BUF(initdir);
-    FREE_PATHNAME_BUF(path);
-    FREE_PATHNAME_BUF(pathname);
-    RETURN_INT_COMMENT(nfif, ("Out of memory\n"));
+  if ((!initdir) || (!path) || (!pathname)
+#ifndef _MSDOS
+      || (!target)
+#endif
+     ) {
+    finis(RETCODE_NO_MEMORY, "Out of memory");
   }
 #endif
 
@@ -1179,11 +1542,12 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
     FREE_PATHNAME_BUF(initdir);
     FREE_PATHNAME_BUF(path);
     FREE_PATHNAME_BUF(pathname);
-    RETURN_INT_COMMENT(nfif, ("NUL\n"));
+#ifndef _MSDOS
+    FREE_PATHNAME_BUF(target);
+#endif
+    RETURN_INT_COMMENT(pfa->nFifs, ("NUL\n"));
   }
 
-  if (nfif == 0) firstfif = NULL; /* Make sure the linked list ends there */
-
   if (!pattern) pattern = PATTERN_ALL;
   strncpyz(pattern2, pattern, NODENAME_SIZE);
 
@@ -1230,6 +1594,7 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
     if (pc) {
       /* If found, assume a pattern follows */
       strncpyz(pattern2, pc+1, NODENAME_SIZE);
+      bSplit = TRUE;		/* Then it applies to subdirectories too */
 
       if (pc > path) {		/* Remove the pattern. General case */
 	  *pc = '\0';		/* Remove the backslash and wildcards */
@@ -1252,7 +1617,10 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
 	FREE_PATHNAME_BUF(initdir);
 	FREE_PATHNAME_BUF(path);
 	FREE_PATHNAME_BUF(pathname);
-	RETURN_INT_COMMENT(nfif, ("Cannot access directory %s\n", path));
+#ifndef _MSDOS
+	FREE_PATHNAME_BUF(target);
+#endif
+	RETURN_INT_COMMENT(pfa->nFifs, ("Cannot access directory %s\n", path));
       }
       finis(RETCODE_INACCESSIBLE, NULL);
     }
@@ -1270,19 +1638,47 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
   /* start looking for all files */
   pDir = opendir(path);
   if (pDir) {
+    int bDateFilter = (datemin > 0) || (datemax < TIME_T_MAX);
     while ((pDirent = readdir(pDir))) {
       struct stat st;
+      int bStatDone = FALSE;
+      int bMatch;
       DEBUG_CODE(
 	char *reason;
 	char szType[16];
 	sprintf(szType, "d_type=%u", (unsigned)(pDirent->d_type));
       )
 
+      DEBUG_PRINTF(("// Found %10s %12s\n",
+	    (pDirent->d_type == DT_DIR) ? "Directory" :
+	    (pDirent->d_type == DT_LNK) ? "Link" :
+	    (pDirent->d_type == DT_REG) ? "File" :
+	    szType,
+	    pDirent->d_name));
+
+      /* First filter on the name, which costs no system call */
+      DEBUG_CODE(reason = "it's .";)
+      if (!(    !streq(pDirent->d_name, ".")  /* skip . and .. */
+	      DEBUG_CODE(&& (reason = "it's .."))
+	   && !streq(pDirent->d_name, "..")
+	 )) {
+	DEBUG_PRINTF(("// Ignored because %s\n", reason));
+	continue;
+      }
+      lNEntries += 1;
+      bMatch = (fnmatch(pattern2, pDirent->d_name, FNM_CASEFOLD) == FNM_MATCH);
+      DEBUG_CODE(reason = "the pattern does not match";)
+      if (!bMatch && !(   pDirs && !bSplit /* Unless it may be a subdirectory */
+		       && (!pDirent->d_type || (pDirent->d_type == DT_DIR)))) {
+	DEBUG_PRINTF(("// Ignored because %s\n", reason));
+	continue;
+      }
+
       makepathname(pathname, path, pDirent->d_name);
-#if !_DIRENT2STAT_DEFINED
-      pStat(pathname, &st);
       if (!pDirent->d_type) { /* Some filesystems don't set this field */
-	/* Since we've called stat anyway, copy the type from there */
+	/* Then we must call stat to get the type */
+	GetDirentStat(pathname, pDirent, &st);
+	bStatDone = TRUE;
 	if (S_ISREG(st.st_mode)) pDirent->d_type = DT_REG;
 	if (S_ISDIR(st.st_mode)) pDirent->d_type = DT_DIR;
 #if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
@@ -1301,75 +1697,69 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
 	if (S_ISSOCK(st.st_mode)) pDirent->d_type = DT_SOCK;
 #endif
       }
-#else
-      if (pStat == lstat) {
-	dirent2stat(pDirent, &st);
-      } else {
-	stat(pathname, &st);
+
+      /* Collect subdirectories for descend(), in the same pass */
+      if (pDirs && (pDirent->d_type == DT_DIR) && (bMatch || !bSplit)) {
+	struct stat stDir;
+	if (!bStatDone) { /* Only the type is used by descend() */
+	  memset(&stDir, 0, sizeof(stDir));
+	  stDir.st_mode = S_IFDIR;
+	} else {
+	  stDir = st;
+	}
+	NewFif(pDirs, pDirent->d_name, &stDir, col);
       }
-#endif
-      DEBUG_PRINTF(("// Found %10s %12s %lx\n",
-	    (pDirent->d_type == DT_DIR) ? "Directory" :
-	    (pDirent->d_type == DT_LNK) ? "Link" :
-	    (pDirent->d_type == DT_REG) ? "File" :
-	    szType,
-	    pDirent->d_name,
-	    (unsigned long)(st.st_mtime)));
-      DEBUG_CODE(reason = "it's .";)
-      if (    !streq(pDirent->d_name, ".")  /* skip . and .. */
-	      DEBUG_CODE(&& (reason = "it's .."))
-	   && !streq(pDirent->d_name, "..")
-	      DEBUG_CODE(&& (reason = "it's not a directory"))
-	   && (   !(attrib & 0x8000)	  /* Skip files if dirs only */
+      DEBUG_CODE(reason = "the pattern does not match";)
+      if (!bMatch) {
+	DEBUG_PRINTF(("// Ignored because %s\n", reason));
+	continue;
+      }
+
+      /* Then filter on the type, which is now known */
+      DEBUG_CODE(reason = "it's not a directory";)
+      if (!(   (   !(attrib & 0x8000)	  /* Skip files if dirs only */
 		|| (pDirent->d_type == DT_DIR))
 	      DEBUG_CODE(&& (reason = "it's a directory"))
 	   && (   (attrib & _A_SUBDIR)	  /* Skip dirs if files only */
 		|| (pDirent->d_type != DT_DIR))
-	      DEBUG_CODE(&& (reason = "the date is out of range"))
-	   && (st.st_mtime >= datemin) /* Skip files outside date range */
-	   && (st.st_mtime <= datemax)
-	      DEBUG_CODE(&& (reason = "the pattern does not match"))
-	   && (fnmatch(pattern2, pDirent->d_name, FNM_CASEFOLD) == FNM_MATCH)
+	 )) {
+	DEBUG_PRINTF(("// Ignored because %s\n", reason));
+	continue;
+      }
+
+      /* Get the file information for the date filter and for the display.
+         When listing subdirectories for descend(), only their type is used. */
+      if (!bStatDone) {
+	if ((attrib & 0x8000) && !bDateFilter) {
+	  memset(&st, 0, sizeof(st));
+	  st.st_mode = S_IFDIR;
+	} else {
+	  GetDirentStat(pathname, pDirent, &st);
+	}
+      }
+
+      DEBUG_CODE(reason = "the date is out of range";)
+      if (   (st.st_mtime >= datemin) /* Skip files outside date range */
+	  && (st.st_mtime <= datemax)
 	 ) {
 	fif *pfif;
 
 	DEBUG_PRINTF(("// OK\n"));
-	pfif = (fif *)malloc(sizeof(fif));
-	pname = strdup(pDirent->d_name);
-	if (!pfif || !pname) {
-	  closedir(pDir);
-	  finis(RETCODE_NO_MEMORY, "Out of memory for directory access");
-	}
-	pfif->name = pname;
-	pfif->st = st;
+	pfif = NewFif(pfa, pDirent->d_name, &st, col);
 #if _MSVCLIBX_STAT_DEFINED
-	DEBUG_PRINTF(("st.st_Win32Attrs = 0x%08X\n", pfif->st.st_Win32Attrs));
-	DEBUG_PRINTF(("st.st_ReparseTag = 0x%08X\n", pfif->st.st_ReparseTag));
+	DEBUG_PRINTF(("st.st_Win32Attrs = 0x%08X\n", pfif->win32attrs));
+	DEBUG_PRINTF(("st.st_ReparseTag = 0x%08X\n", pfif->reparsetag));
 #endif /* _MSVCLIBX_STAT_DEFINED */
 #ifndef _MSDOS
-	pfif->target = NULL;
 	if (pDirent->d_type == DT_LNK) {
-	  char *pTarget = malloc(PATHNAME_SIZE);
-	  int lTarget;
-	  if (!pTarget) {
-	    closedir(pDir);
-	    finis(RETCODE_NO_MEMORY, "Out of memory");
-	  }
-	  lTarget = (int)readlink(pathname, pTarget, PATHNAME_SIZE);
+	  int lTarget = (int)readlink(pathname, target, PATHNAME_SIZE-1);
 	  if (lTarget != -1) {
-	    pTarget[lTarget] = '\0';
-	    pTarget = realloc(pTarget, lTarget+1);
-	    pfif->target = pTarget;
-	  } else {
-	    free(pTarget);
+	    target[lTarget] = '\0';
+	    pfif->target = FifArenaStrDup(pfa, target);
 	  }
 	}
 #endif
-	// Note: The pointer to the name is copied as well.
-	pfif->column = col;
-	pfif->next = firstfif;
-	firstfif = pfif;
-	nfif += 1;
+	CheckFifArena(pfa);	/* Enforce the -m memory limit */
       } else {
 	DEBUG_PRINTF(("// Ignored because %s\n", reason));
       }
@@ -1377,6 +1767,7 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
 
     closedir(pDir);
   }
+  if (iBench) BenchAdd(BENCH_SCAN, dStart);
 #if !HAS_MSVCLIBX
   DEBUG_PRINTF(("chdir(\"%s\");\n", initdir));
 #endif
@@ -1393,7 +1784,10 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
   FREE_PATHNAME_BUF(initdir);
   FREE_PATHNAME_BUF(path);
   FREE_PATHNAME_BUF(pathname);
-  RETURN_INT(nfif);
+#ifndef _MSDOS
+  FREE_PATHNAME_BUF(target);
+#endif
+  RETURN_INT(pfa->nFifs);
 }
 
 #ifdef _MSC_VER
@@ -1408,8 +1802,8 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
-*         fif **fif1    First file structure                                  *
-*         fif **fif2    Second file structure                                 *
+*         fif *fif1     First file structure                                  *
+*         fif *fif2     Second file structure                                 *
 *                                                                             *
 *       Return value:    0 : Equal                                            *
 *                       <0 : file1<file2                                      *
@@ -1421,39 +1815,155 @@ int lis(char *startdir, char *pattern, int nfif, int col, int attrib,
 *                                                                             *
 ******************************************************************************/
 
-int CDECL cmpfif(const fif **fif1, const fif **fif2) {
+int CDECL cmpfif(const fif *fif1, const fif *fif2) {
   int ret;
   int bIsDir1, bIsDir2;
 
   /* List directories before files */
 #if _MSVCLIBX_STAT_DEFINED
-  bIsDir1 = (((*fif1)->st.st_Win32Attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY);
-  bIsDir2 = (((*fif2)->st.st_Win32Attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY);
+  bIsDir1 = ((fif1->win32attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY);
+  bIsDir2 = ((fif2->win32attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY);
 #else
-  bIsDir1 = S_ISDIR((*fif1)->st.st_mode);
-  bIsDir2 = S_ISDIR((*fif2)->st.st_mode);
+  bIsDir1 = S_ISDIR(fif1->mode);
+  bIsDir2 = S_ISDIR(fif2->mode);
 #endif
   ret = bIsDir2 - bIsDir1;
   if (ret) return ret;
 
   /* If both files, or both directories, sort case-independantly */
-  ret = strnicmp((*fif1)->name, (*fif2)->name, NODENAME_SIZE);
+  ret = strnicmp(fif1->name, fif2->name, NODENAME_SIZE);
   if (ret) return ret;
 
   /* If same name except for the case, sort upper case first */
   if (!ignorecase) {  /* But do it only if requested */
-    ret = strncmp((*fif1)->name, (*fif2)->name, NODENAME_SIZE);
+    ret = strncmp(fif1->name, fif2->name, NODENAME_SIZE);
     if (ret) return ret;
   }
 
   /* If same names, list column 1 before column 2 */
-  return (*fif1)->column - (*fif2)->column;
+  return fif1->column - fif2->column;
 }
 
 typedef int (* CDECL CMPFUNC)(const void *p1, const void *p2); // Strict type for C++
 
-void trie(fif **ppfif, int nfif) {
-  qsort(ppfif, nfif, sizeof(fif *), (CMPFUNC)cmpfif);
+/******************************************************************************
+*                                                                             *
+*       Function:       trie                                                  *
+*                                                                             *
+*       Description:    Sort a fif array in place, in the cmpfif() order      *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         fif *pfif     Array of file info structures                         *
+*         int nfif      Number of structures in the array                     *
+*                                                                             *
+*       Return value:   None                                                  *
+*                                                                             *
+*       Notes:          Each record gets an integer key made of the directory *
+*                       flag, followed by the first characters of the name    *
+*                       converted to lower case, like strnicmp() does. Most   *
+*                       comparisons are then decided by comparing two keys,   *
+*                       and cmpfif() is only called for ties.                 *
+*                       The keys are sorted with a stable merge sort, then    *
+*                       the records are moved in place to their final         *
+*                       position, following the cycles of the permutation.    *
+*                       So the extra memory is only two arrays of keys.       *
+*                                                                             *
+*       Updates:                                                              *
+*                                                                             *
+******************************************************************************/
+
+typedef struct fifkey {	    /* Sort key for a fif record */
+  uintmax_t key;		/* Directory flag, then the folded name prefix */
+  int index;			/* The record index in the array */
+} fifkey;
+
+#define FIFKEY_CHARS ((int)sizeof(uintmax_t) - 1) /* # of name chars in the key */
+#define FIFSORT_RUN 16		/* Size of the runs sorted by insertion */
+
+static uintmax_t FifSortKey(const fif *pfif) {
+  const unsigned char *pc = (const unsigned char *)(pfif->name);
+  uintmax_t key;
+  int i;
+
+  /* List directories before files */
+#if _MSVCLIBX_STAT_DEFINED
+  key = ((pfif->win32attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) ? 0 : 1;
+#else
+  key = S_ISDIR(pfif->mode) ? 0 : 1;
+#endif
+  /* Then sort case-independantly. Short names end with NULs, so they come first. */
+  for (i=0; i<FIFKEY_CHARS; i++) {
+    key <<= 8;
+    if (*pc) key |= (unsigned char)tolower(*(pc++));
+  }
+  return key;
+}
+
+static int CmpFifKeys(const fif *pfif, const fifkey *pk1, const fifkey *pk2) {
+  if (pk1->key != pk2->key) return (pk1->key < pk2->key) ? -1 : 1;
+  return cmpfif(pfif + pk1->index, pfif + pk2->index);
+}
+
+void trie(fif *pfif, int nfif) {
+  fifkey *pKeys, *pSrc, *pDst, *pSwap;
+  fif fifTemp;
+  int i, j, iNext, width;
+  double dStart;
+
+  if (nfif < 2) return;
+  dStart = iBench ? BenchTime() : 0;
+  pKeys = (fifkey *)malloc(nfif * 2 * sizeof(fifkey));
+  if (!pKeys) { /* Fall back to sorting without keys */
+    qsort(pfif, nfif, sizeof(fif), (CMPFUNC)cmpfif);
+    if (iBench) BenchAdd(BENCH_SORT, dStart);
+    return;
+  }
+  pSrc = pKeys;
+  pDst = pKeys + nfif;
+
+  /* Compute the keys, and sort short runs by insertion */
+  for (i=0; i<nfif; i++) {
+    fifkey k;
+    k.key = FifSortKey(pfif+i);
+    k.index = i;
+    for (j=i; (j % FIFSORT_RUN) && (CmpFifKeys(pfif, &k, pSrc+j-1) < 0); j--) pSrc[j] = pSrc[j-1];
+    pSrc[j] = k;
+  }
+
+  /* Merge the runs, twice as long at each pass */
+  for (width=FIFSORT_RUN; width<nfif; width*=2) {
+    for (i=0; i<nfif; i+=2*width) {
+      int iLeft = i;
+      int iMid = ((i + width) < nfif) ? (i + width) : nfif;
+      int iEnd = ((i + 2*width) < nfif) ? (i + 2*width) : nfif;
+      int iRight = iMid;
+      for (j=i; j<iEnd; j++) {
+	if ((iLeft < iMid) && ((iRight == iEnd) || (CmpFifKeys(pfif, pSrc+iRight, pSrc+iLeft) >= 0))) {
+	  pDst[j] = pSrc[iLeft++];
+	} else {
+	  pDst[j] = pSrc[iRight++];
+	}
+      }
+    }
+    pSwap = pSrc;
+    pSrc = pDst;
+    pDst = pSwap;
+  }
+
+  /* Move the records to their sorted position. pSrc[i].index goes to i. */
+  for (i=0; i<nfif; i++) {
+    if (pSrc[i].index == i) continue; /* Already in place, or cycle done */
+    fifTemp = pfif[i];
+    for (j=i; (iNext = pSrc[j].index) != i; j=iNext) {
+      pfif[j] = pfif[iNext];
+      pSrc[j].index = j; /* Mark it done */
+    }
+    pfif[j] = fifTemp;
+    pSrc[j].index = j;
+  }
+  free(pKeys);
+  if (iBench) BenchAdd(BENCH_SORT, dStart);
 }
 
 /******************************************************************************
@@ -1464,8 +1974,7 @@ void trie(fif **ppfif, int nfif) {
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
-*         fif **ppfif   Sorted array of file info structure pointers          *
-*         int nfif      Number of files found (Total of both sides)           *
+*         fifarena *pfa Files found (Both sides). Sorted by this routine.     *
 *         int ndirs     Number of directories  1 or 2                         *
 *         BOOL both     If TRUE, display only files if present in both columns*
 *         BOOL diff     If TRUE, don't display equal files.                   *
@@ -1479,8 +1988,10 @@ void trie(fif **ppfif, int nfif) {
 *                                                                             *
 ******************************************************************************/
 
-int affiche(fif **ppfif, int nfif, int ndirs, BOOL both, BOOL diff, BOOL zero) {
-  int i;
+int affiche(fifarena *pfa, int ndirs, BOOL both, BOOL diff, BOOL zero) {
+  fifreader fr;
+  fif *pfif;
+  fif *pNext;
   int col = 1;                      /* Current column */
   int difference;
   int nfiles = 0;
@@ -1488,14 +1999,58 @@ int affiche(fif **ppfif, int nfif, int ndirs, BOOL both, BOOL diff, BOOL zero) {
 
   DEBUG_ENTER(("affiche(...);\n"));
 
-  for (i=0; i<nfif; i++) {
-    difference = CompareToNext(ppfif+i); /* Compare ith file date with (i+1)th */
+  OpenFifReader(&fr, pfa);
+  for (pfif = NextFif(&fr); pfif; pfif = pNext) {
+    pNext = NextFif(&fr);
+    /* Compare the file date with the next one's, if it's the same file on the right side */
+    if ((pfif->column == 1) && pNext && (pNext->column == 2)) {
+      difference = CompareToNext(pfif, pNext);
+    } else {
+      difference = MISMATCH;
+    }
 
     if (diff && (difference == 0)) {
-      i += 1;
+      pNext = NextFif(&fr);
       continue;                   /* skip both if files match */
     }
 
+    if (iFormat != FORMAT_TEXT) { /* One record per file, or per pair of matching files */
+      fif *pLeft = NULL;
+      fif *pRight = NULL;
+      if (difference != MISMATCH) {
+	pLeft = pfif;
+	pRight = pNext;
+      } else if (both) {
+	continue;                  /* If both and no matching file, skip */
+      } else if (pfif->column == 1) {
+	pLeft = pfif;
+      } else {
+	pRight = pfif;
+      }
+      if (!paths_done) {
+	OutDirRecord();
+	paths_done = TRUE;
+      }
+      OutFileRecord(pLeft, pRight, difference);
+      if (pLeft) {
+	lLFileFound += 1;
+	llLTotalSize += pLeft->size;
+	if (!difference) {
+	  lEFileFound += 1;
+	  llETotalSize += pLeft->size;
+	}
+      }
+      if (pRight) {
+	lRFileFound += 1;
+	llRTotalSize += pRight->size;
+      }
+      nfiles += 1;
+      /* The right file is done too. Don't read past it before it's output,
+         as NextFif() only keeps the last two records of sorted runs. */
+      if (difference != MISMATCH) pNext = NextFif(&fr);
+      continue;
+    }
+
     if (both && (col == 1) && (difference == MISMATCH)) {
       continue;                    /* If both and no matching file, skip */
     }
@@ -1507,27 +2062,27 @@ int affiche(fif **ppfif, int nfif, int ndirs, BOOL both, BOOL diff, BOOL zero) {
       paths_done = TRUE;
     }
 
-    if ((col == 1) && (ppfif[i]->column == 2)) {
+    if ((col == 1) && (pfif->column == 2)) {
       if (both) continue;          /* If both and no matching file, skip */
       affiche1(NULL, 1);
       printf(" < ");
       col = 2;
     }
 
-    affiche1(ppfif[i], col);       /* Display file characteristics */
+    affiche1(pfif, col);           /* Display file characteristics */
 
     /* Compute statistics about files displayed */
 
     if (col == 1) {
       lLFileFound += 1;
-      llLTotalSize += ppfif[i]->st.st_size;
+      llLTotalSize += pfif->size;
       if (!difference) {
 	lEFileFound += 1;
-	llETotalSize += ppfif[i]->st.st_size;
+	llETotalSize += pfif->size;
       }
     } else {
       lRFileFound += 1;
-      llRTotalSize += ppfif[i]->st.st_size;
+      llRTotalSize += pfif->size;
     }
 
     /* Display the comparison results */
@@ -1579,6 +2134,8 @@ int affiche(fif **ppfif, int nfif, int ndirs, BOOL both, BOOL diff, BOOL zero) {
     }
   }
 
+  CloseFifReader(&fr);
+
   if (col == 2) {
     nfiles += 1;
     printflf();
@@ -1586,6 +2143,11 @@ int affiche(fif **ppfif, int nfif, int ndirs, BOOL both, BOOL diff, BOOL zero) {
 
   if (zero && !nfiles) RETURN_CONST(0);
 
+  if (iFormat != FORMAT_TEXT) { /* The records formats have no titles nor counts */
+    lNFileFound += nfiles;
+    RETURN_CONST(0);
+  }
+
   if (!paths_done) affichePaths();
   printflf();
   printf("%d files or directories listed.", nfiles);
@@ -1651,7 +2213,7 @@ int affiche1(fif *pfif, int col) {
     RETURN_CONST(0);
   }
 
-  pTime = LocalFileTime(&(pfif->st.st_mtime)); // Time of last data modification
+  pTime = LocalFileTime(&(pfif->mtime)); // Time of last data modification
   seconde = pTime->tm_sec;
   minute = pTime->tm_min;
   heure = pTime->tm_hour;
@@ -1667,7 +2229,7 @@ int affiche1(fif *pfif, int col) {
   if (iUpperCase) strupr(pNicename);	/* Do just the opposite if requested */
 
   /* Output the name */
-  if (S_ISDIR(pfif->st.st_mode)) {
+  if (S_ISDIR(pfif->mode)) {
 #if 1
 #if defined(__unix__)
     { /* Append an OS-dependant directory separator */
@@ -1686,18 +2248,18 @@ int affiche1(fif *pfif, int col) {
 #endif /* 1 */
     iShowSize = 0;
   }
-  if (   S_ISCHR(pfif->st.st_mode)
+  if (   S_ISCHR(pfif->mode)
 #if defined(S_ISBLK) && S_ISBLK(S_IFBLK) /* In DOS it's defined, but always returns 0 */
-      || S_ISBLK(pfif->st.st_mode)
+      || S_ISBLK(pfif->mode)
 #endif // defined(S_ISBLK)
      ) {
     // strcat(pNicename, " !");
     iShowSize = 0;
   }
 #if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
-  if (S_ISLNK(pfif->st.st_mode)) {
+  if (S_ISLNK(pfif->mode)) {
 #if 0 && defined(_WIN32) && _MSVCLIBX_STAT_DEFINED
-    if ((pfif->st.st_Win32Attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) {
+    if ((pfif->win32attrs & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) {
       strcat(pNicename, "\\"); /* Junctions and symlinkds behave like directories in Windows */
     }
 #endif
@@ -1707,13 +2269,13 @@ int affiche1(fif *pfif, int col) {
   }
 #endif // defined(S_ISLNK)
 #if defined(S_ISFIFO) && S_ISFIFO(S_IFIFO) /* In DOS it's defined, but always returns 0 */
-  if (S_ISFIFO(pfif->st.st_mode)) {
+  if (S_ISFIFO(pfif->mode)) {
     strcat(pNicename, "|");
     iShowSize = 0;
   }
 #endif // defined(S_ISFIFO)
 #if defined(S_ISSOCK) && S_ISSOCK(S_IFSOCK) /* In DOS it's defined, but always returns 0 */
-  if (S_ISSOCK(pfif->st.st_mode)) {
+  if (S_ISSOCK(pfif->mode)) {
     strcat(pNicename, "=");
     iShowSize = 0;
   }
@@ -1725,12 +2287,12 @@ int affiche1(fif *pfif, int col) {
 
   /* Output the size */
   if (iShowSize) { /* This is a normal file, and we need to display the size */
-    int nBytes = sizeof(pfif->st.st_size); /* Could this be made a compile-time constant? */
+    int nBytes = sizeof(pfif->size); /* Could this be made a compile-time constant? */
     char *pszFormat = (nBytes == 4) ? "%"PRIu32 : "%"PRIu64;
-    nSize = sprintf(szSize, pszFormat, pfif->st.st_size);
+    nSize = sprintf(szSize, pszFormat, pfif->size);
   } else {         /* This is a special file, do not display a size */
 #if !defined(__unix__)
-    if (S_ISDIR(pfif->st.st_mode)) { // This is a directory
+    if (S_ISDIR(pfif->mode)) { // This is a directory
 #if defined(_WIN32)
       nSize = sprintf(szSize, "<DIR>     "); // Add 5 spaces to align with <JUNCTION> and <SYMLINKD>
 #elif defined(_MSDOS)
@@ -1739,32 +2301,32 @@ int affiche1(fif *pfif, int col) {
     }
 #endif
 
-    if (S_ISCHR(pfif->st.st_mode)) {
+    if (S_ISCHR(pfif->mode)) {
       nSize = sprintf(szSize, "<CHARDEV>"); // This is a character device
     }
 #if defined(S_ISBLK) && S_ISBLK(S_IFBLK) /* In DOS it's defined, but always returns 0 */
-    if (S_ISBLK(pfif->st.st_mode)) {
+    if (S_ISBLK(pfif->mode)) {
       nSize = sprintf(szSize, "<BLCKDEV>"); // This is a block device
     }
 #endif // defined(S_ISBLK)
 
 #if defined(_WIN32) && _MSVCLIBX_STAT_DEFINED
-    if (S_ISLNK(pfif->st.st_mode)) {
-      if (pfif->st.st_ReparseTag == IO_REPARSE_TAG_MOUNT_POINT) {
+    if (S_ISLNK(pfif->mode)) {
+      if (pfif->reparsetag == IO_REPARSE_TAG_MOUNT_POINT) {
 	nSize = sprintf(szSize, "<JUNCTION>"); // This is a junction
-      } else if (pfif->st.st_Win32Attrs & FILE_ATTRIBUTE_DIRECTORY) {
+      } else if (pfif->win32attrs & FILE_ATTRIBUTE_DIRECTORY) {
 	nSize = sprintf(szSize, "<SYMLINKD>"); // This is a symlinkd
       }
     }
 #endif
 
 #if defined(S_ISFIFO) && S_ISFIFO(S_IFIFO) /* In DOS it's defined, but always returns 0 */
-    if (S_ISFIFO(pfif->st.st_mode)) {
+    if (S_ISFIFO(pfif->mode)) {
       nSize = sprintf(szSize, "<FIFO>   "); // This is a fifo
     }
 #endif // defined(S_ISFIFO)
 #if defined(S_ISSOCK) && S_ISSOCK(S_IFSOCK) /* In DOS it's defined, but always returns 0 */
-    if (S_ISSOCK(pfif->st.st_mode)) {
+    if (S_ISSOCK(pfif->mode)) {
       nSize = sprintf(szSize, "<SOCKET> "); // This is a network socket
     }
 #endif // defined(S_ISSOCK)
@@ -1796,7 +2358,8 @@ int affiche1(fif *pfif, int col) {
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
-*         fif **ppfif   Sorted array of file info structure pointers          *
+*         fif *pfif1    File info structure                                   *
+*         fif *pfif2    Next file info structure in the sorted array, or NULL *
 *                                                                             *
 *       Return value:   0=Same file; <0 Older than next; >0 Newer than next.  *
 *                                                                             *
@@ -1806,50 +2369,54 @@ int affiche1(fif *pfif, int col) {
 *                                                                             *
 ******************************************************************************/
 
-int CompareToNext(fif **ppfif) { /* Compare file date with next entry in fiflist */
+int CompareToNext(fif *pfif1, fif *pfif2) { /* Compare file date with next entry in fiflist */
   long deltatime;                 /* Date and Time difference, in seconds */
   int deltasize;                  /* Sign of the difference, or 0 if equal */
-  fif *pfif1;
-  fif *pfif2;
   int dif;
 
-  pfif1 = ppfif[0];
-  pfif2 = ppfif[1];
-  DEBUG_ENTER(("CompareToNext(%p); // \"%s\" / \"%s\"\n", ppfif, pfif1->name, pfif2?pfif2->name:""));
+  DEBUG_ENTER(("CompareToNext(%p, %p); // \"%s\" / \"%s\"\n", pfif1, pfif2, pfif1->name, pfif2?pfif2->name:""));
   if (!pfif2) DEBUG_RETURN_INT(MISMATCH, "No next entry");	/* No next entry */
 
   /* ~~jfl 95/06/12 Can't compare a file to a directory */
-  dif = S_ISDIR(pfif1->st.st_mode);
-  dif ^= S_ISDIR(pfif2->st.st_mode);
+  dif = S_ISDIR(pfif1->mode);
+  dif ^= S_ISDIR(pfif2->mode);
   if (dif) DEBUG_RETURN_INT(MISMATCH, "Types differ");
 
   /* Compare names, with or without case depending on command */
-  if (ignorecase) {
+  if (pfif1->name == pfif2->name) { /* Identical names are stored only once */
+    dif = 0;
+  } else if (ignorecase) {
     dif = stricmp(pfif1->name, pfif2->name);
   } else {
     dif = strcmp(pfif1->name, pfif2->name);
   }
   if (dif) DEBUG_RETURN_INT(MISMATCH, "Names differ");	/* Names don't match */
 
-  deltatime = (long)pfif1->st.st_mtime;
-  deltatime -= (long)pfif2->st.st_mtime;
+  deltatime = (long)pfif1->mtime;
+  deltatime -= (long)pfif2->mtime;
 
-  if (pfif1->st.st_size < pfif2->st.st_size) {
+  if (pfif1->size < pfif2->size) {
     deltasize = -1;
-  } else if (pfif1->st.st_size > pfif2->st.st_size) {
+  } else if (pfif1->size > pfif2->size) {
     deltasize = 1;
   } else {
     deltasize = 0;
   }
 
   /* If in filecomp mode, check if same data files with different dates */
-  if (filecomp && !deltasize && !S_ISDIR(pfif1->st.st_mode)) { /* Let the actual data decide */
+  if (filecomp && !deltasize && !S_ISDIR(pfif1->mode)) { /* Let the actual data decide */
     NEW_PATHNAME_BUF(name1);
     NEW_PATHNAME_BUF(name2);
 
     makepathname(name1, path1, pfif1->name);
     makepathname(name2, path2, pfif2->name);
-    dif = filecompare(name1, name2);
+    if (iBench) {
+      double dStart = BenchTime();
+      dif = filecompare(name1, name2);
+      BenchAdd(BENCH_COMPARE, dStart);
+    } else {
+      dif = filecompare(name1, name2);
+    }
     FREE_PATHNAME_BUF(name1);
     FREE_PATHNAME_BUF(name2);
     if (!dif) DEBUG_RETURN_INT(0, "Contents are identical"); /* They are actually identical */
@@ -1892,36 +2459,596 @@ int CompareToNext(fif **ppfif) { /* Compare file date with next entry in fiflist
   DEBUG_RETURN_INT(0, "Same files");
 }
 
+#ifdef _MSDOS		/* If it's a 16-bits app, use a 4K buffer. */
+#define FBUFSIZE 4096
+#else			/* Else for 32-bits or 64-bits apps, use a 4M buffer */
+#define FBUFSIZE (4096 * 1024)
+#endif
+
+/* Memory comparison routines. Same interface and results as memcmp(). */
+
+typedef int (*PMEMCMPFUNC)(const void *p1, const void *p2, size_t n);
+
+#if HAS_SIMD
+
+/* Compare 128 bytes per loop, then let memcmp() find the first difference */
+__attribute__((target("avx2")))
+static int memcmp_avx2(const void *p1, const void *p2, size_t n) {
+  const char *pc1 = (const char *)p1;
+  const char *pc2 = (const char *)p2;
+  size_t i;
+
+  for (i = 0; (i + 128) <= n; i += 128) {
+    __m256i v0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pc1+i)),
+				   _mm256_loadu_si256((const __m256i *)(pc2+i)));
+    __m256i v1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pc1+i+32)),
+				   _mm256_loadu_si256((const __m256i *)(pc2+i+32)));
+    __m256i v2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pc1+i+64)),
+				   _mm256_loadu_si256((const __m256i *)(pc2+i+64)));
+    __m256i v3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pc1+i+96)),
+				   _mm256_loadu_si256((const __m256i *)(pc2+i+96)));
+    v0 = _mm256_and_si256(_mm256_and_si256(v0, v1), _mm256_and_si256(v2, v3));
+    if (_mm256_movemask_epi8(v0) != -1) break;
+  }
+  return memcmp(pc1+i, pc2+i, n-i);
+}
+
+/* Compare 64 bytes per loop, then let memcmp() find the first difference */
+__attribute__((target("sse2")))
+static int memcmp_sse2(const void *p1, const void *p2, size_t n) {
+  const char *pc1 = (const char *)p1;
+  const char *pc2 = (const char *)p2;
+  size_t i;
+
+  for (i = 0; (i + 64) <= n; i += 64) {
+    __m128i v0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pc1+i)),
+				_mm_loadu_si128((const __m128i *)(pc2+i)));
+    __m128i v1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pc1+i+16)),
+				_mm_loadu_si128((const __m128i *)(pc2+i+16)));
+    __m128i v2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pc1+i+32)),
+				_mm_loadu_si128((const __m128i *)(pc2+i+32)));
+    __m128i v3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pc1+i+48)),
+				_mm_loadu_si128((const __m128i *)(pc2+i+48)));
+    v0 = _mm_and_si128(_mm_and_si128(v0, v1), _mm_and_si128(v2, v3));
+    if (_mm_movemask_epi8(v0) != 0xFFFF) break;
+  }
+  return memcmp(pc1+i, pc2+i, n-i);
+}
+
+/* Select the best routine for this CPU on the first call */
+static int memcmp_dispatch(const void *p1, const void *p2, size_t n);
+PMEMCMPFUNC pMemCmp = memcmp_dispatch;
+
+static int memcmp_dispatch(const void *p1, const void *p2, size_t n) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    pMemCmp = memcmp_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    pMemCmp = memcmp_sse2;
+  } else {
+    pMemCmp = memcmp;
+  }
+  DEBUG_PRINTF(("// Comparing data using %s\n", (pMemCmp == memcmp_avx2) ? "AVX2" :
+					       (pMemCmp == memcmp_sse2) ? "SSE2" : "memcmp"));
+  return pMemCmp(p1, p2, n);
+}
+
+#else /* !HAS_SIMD */
+
+PMEMCMPFUNC pMemCmp = memcmp;
+
+#endif /* HAS_SIMD */
+
 /******************************************************************************
 *                                                                             *
-*       Function:       filecompare                                           *
+*       Function:       CompareFdData                                         *
 *                                                                             *
-*       Description:    Compare the contents of two files                     *
+*       Description:    Compare the data of two open files of the same size   *
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
-*         char *name1   Pathname of first file                                *
-*         char *name2   Pathname of second file                               *
+*         int fd1       Descriptor of the first file                          *
+*         int fd2       Descriptor of the second file                         *
+*         off_t size    Their common size                                     *
+*         char *pbuf1   FBUFSIZE buffer for reading the first file            *
+*         char *pbuf2   FBUFSIZE buffer for reading the second file           *
 *                                                                             *
 *       Return value:   0=Same contents                                       *
-*                       1/-1=Length difference                                *
+*                       1/-1=Length difference (The files changed meanwhile)  *
 *                       2/-2=Data difference                                  *
-*                       3/-3=One of the files is missing                      *
 *                                                                             *
-*       Notes:                                                                *
+*       Notes:          Files up to MMAP_MAX_SIZE are compared in memory-     *
+*                       mapped views, read ahead sequentially by the kernel.  *
+*                       Larger ones, or if mmap() fails, are read in FBUFSIZE *
+*                       blocks by pread().                                    *
+*                                                                             *
+*                       If another process truncates a file while it's mapped,*
+*                       reading past its new end raises SIGBUS. This is       *
+*                       caught, and the files are read again by pread(),      *
+*                       which sees the shorter length.                        *
 *                                                                             *
 *       Updates:                                                              *
-*        1995-06-12 JFL Made this routine generic (Independant of DIRC)       *
-*        2014-01-21 JFL Use a much larger buffer for 32-bits apps, to improve *
-*                       performance.                                          *
+*        2026-10-16 JFL Initial implementation.                               *
+*        2026-10-16 JFL Recover from files truncated while they're mapped.    *
 *                                                                             *
 ******************************************************************************/
 
-#ifdef _MSDOS		/* If it's a 16-bits app, use a 4K buffer. */
-#define FBUFSIZE 4096
-#else			/* Else for 32-bits or 64-bits apps, use a 4M buffer */
-#define FBUFSIZE (4096 * 1024)
+#if HAS_MMAP
+
+#define MMAP_MAX_SIZE ((off_t)0x7FFFFFFF) /* Above 2 GB, use pread() instead */
+
+/* Files are only mapped by the main thread, so one jump buffer is enough */
+static sigjmp_buf jbMapFault;	    /* Where to go back if a mapped file shrinks */
+static volatile sig_atomic_t bMapGuard = FALSE; /* TRUE while reading mappings */
+
+static void OnMapFault(int iSig) {
+  if (bMapGuard) siglongjmp(jbMapFault, 1);
+  signal(iSig, SIG_DFL);	    /* Not in a mapping. Crash as usual. */
+  raise(iSig);
+}
+
+/* Install the SIGBUS handler the first time a file is mapped */
+static void InitMapGuard(void) {
+  static int bDone = FALSE;
+  struct sigaction sa;
+
+  if (bDone) return;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = OnMapFault;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGBUS, &sa, NULL);
+  bDone = TRUE;
+}
+
+int CompareFdData(int fd1, int fd2, off_t size, char *pbuf1, char *pbuf2) {
+  off_t offset;
+  int dif;
+
+  if (!size) return 0;
+
+  if ((size <= MMAP_MAX_SIZE) && ((uintmax_t)size <= (uintmax_t)SIZE_MAX)) {
+    void *p1 = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd1, 0);
+    void *p2 = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd2, 0);
+    bs.nMaps += 2;
+    if ((p1 != MAP_FAILED) && (p2 != MAP_FAILED)) {
+      madvise(p1, (size_t)size, MADV_SEQUENTIAL);
+      madvise(p2, (size_t)size, MADV_SEQUENTIAL);
+      InitMapGuard();
+      if (!sigsetjmp(jbMapFault, 1)) {
+	bMapGuard = TRUE;
+	dif = pMemCmp(p1, p2, (size_t)size);
+	bMapGuard = FALSE;
+	munmap(p1, (size_t)size);
+	munmap(p2, (size_t)size);
+	return dif ? ((dif > 0) ? 2 : -2) : 0;
+      }
+      bMapGuard = FALSE;	/* We got a SIGBUS. A file is now shorter. */
+      fprintf(stderr, "dirc: Warning: A file was truncated while comparing it.\n");
+    }
+    DEBUG_PRINTF(("// mmap() failed. Using pread().\n"));
+    if (p1 != MAP_FAILED) munmap(p1, (size_t)size);
+    if (p2 != MAP_FAILED) munmap(p2, (size_t)size);
+  }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd1, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fd2, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
+  for (offset = 0; ; ) {
+    ssize_t l1 = pread(fd1, pbuf1, FBUFSIZE, offset);
+    ssize_t l2 = pread(fd2, pbuf2, FBUFSIZE, offset);
+    bs.nReads += 2;
+    if (l1 < 0) l1 = 0; /* Handle read errors like an early end of file */
+    if (l2 < 0) l2 = 0;
+    if (l1 > l2) return 1;
+    if (l1 < l2) return -1;
+    if (!l1) return 0;
+    dif = pMemCmp(pbuf1, pbuf2, (size_t)l1);
+    if (dif) return (dif > 0) ? 2 : -2;
+    offset += l1;
+  }
+}
+
+#endif /* HAS_MMAP */
+
+/******************************************************************************
+*                                                                             *
+*       Function:       Content hash cache routines                           *
+*                                                                             *
+*       Description:    Remember the SHA-256 digest of files compared with -c *
+*                                                                             *
+*       Notes:          Enabled by option --cache FILE.                       *
+*                                                                             *
+*                       The cache file contains a cacheheader, followed by    *
+*                       fixed-size cacherec records sorted by path hash, in   *
+*                       the native byte order. It is memory-mapped, and       *
+*                       records are found by binary search.                   *
+*                                                                             *
+*                       Records are keyed by the canonical absolute pathname. *
+*                       A record is valid only if the file size, mtime, and   *
+*                       device and inode numbers all match. The ctime must    *
+*                       match too, as tools like touch or rsync can restore   *
+*                       an old mtime. Else the file is hashed again, and the  *
+*                       record is replaced when the cache is saved.           *
+*                       Records not used for CACHE_MAX_AGE days are dropped.  *
+*                                                                             *
+*                       The digests only tell if two files are identical.     *
+*                       If they differ, the data is compared to get the same  *
+*                       result as without the cache.                          *
+*                                                                             *
+*                       Files smaller than CACHE_MIN_SIZE are compared        *
+*                       directly, as this is as fast as hashing them.         *
+*                                                                             *
+*       Updates:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
+*        2026-10-16 JFL Hash the canonical pathname, and check the device.    *
+*                       Compare the data of different files.                  *
+*                                                                             *
+******************************************************************************/
+
+#if HAS_MMAP
+
+#define CACHE_MAGIC "DircHsh2"	/* 8 bytes identifying the file format */
+#define CACHE_MIN_SIZE 65536	/* Don't cache digests of smaller files */
+#define CACHE_MAX_AGE 30	/* Drop records unused for that many days */
+
+typedef struct {	    /* Cache file header */
+  char magic[8];		/* CACHE_MAGIC */
+  uint32_t dwRecSize;		/* sizeof(cacherec) */
+  uint32_t dwRecords;		/* Number of records following */
+} cacheheader;
+
+typedef struct {	    /* Cache file record */
+  uint64_t qwPathHash;		/* FNV-1a hash of the absolute pathname */
+  uint64_t qwSize;		/* File size */
+  int64_t qwMTime;		/* File modification time, in seconds */
+  int64_t qwCTime;		/* File status change time, in seconds */
+  uint64_t qwDevice;		/* File system device number */
+  uint64_t qwInode;		/* File inode number */
+  uint32_t dwMTimeNs;		/* File modification time nanoseconds */
+  uint32_t dwCTimeNs;		/* File status change time nanoseconds */
+  uint32_t dwUsed;		/* Day number of the last use */
+  uint32_t dwReserved;		/* Padding. Must be 0. */
+  uint8_t digest[32];		/* SHA-256 digest of the file contents */
+} cacherec;
+
+char *pszCacheFile = NULL;	    /* Content hash cache file name */
+static cacheheader *pCacheMap = NULL; /* The mapped cache file */
+static size_t nCacheMap = 0;	    /* Size of the above mapping */
+static cacherec *pCache = NULL;	    /* The records from the cache file */
+static size_t nCache = 0;	    /* Number of records in the above array */
+static cacherec *pNewRecs = NULL;   /* Records for files hashed during this run */
+static size_t nNewRecs = 0;	    /* Number of records in the above array */
+static size_t nNewAlloc = 0;	    /* Number of records allocated */
+static uint32_t dwToday = 0;	    /* Day number of this run */
+long lNCacheHits = 0;		    /* Number of digests found in the cache */
+long lNCacheMisses = 0;		    /* Number of digests computed */
+
+/* Minimal SHA-256 implementation, per FIPS 180-4 */
+
+typedef struct {
+  uint32_t h[8];
+  uint64_t qwBytes;
+  uint8_t block[64];
+} sha256ctx;
+
+static const uint32_t sha256k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(sha256ctx *pCtx, const uint8_t *p) {
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    w[i] = ((uint32_t)p[4*i] << 24) | ((uint32_t)p[4*i+1] << 16)
+	 | ((uint32_t)p[4*i+2] << 8) | (uint32_t)p[4*i+3];
+  }
+  for (i = 16; i < 64; i++) {
+    uint32_t s0 = ROR32(w[i-15], 7) ^ ROR32(w[i-15], 18) ^ (w[i-15] >> 3);
+    uint32_t s1 = ROR32(w[i-2], 17) ^ ROR32(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+  a = pCtx->h[0]; b = pCtx->h[1]; c = pCtx->h[2]; d = pCtx->h[3];
+  e = pCtx->h[4]; f = pCtx->h[5]; g = pCtx->h[6]; h = pCtx->h[7];
+  for (i = 0; i < 64; i++) {
+    uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))
+		+ ((e & f) ^ (~e & g)) + sha256k[i] + w[i];
+    uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22))
+		+ ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  pCtx->h[0] += a; pCtx->h[1] += b; pCtx->h[2] += c; pCtx->h[3] += d;
+  pCtx->h[4] += e; pCtx->h[5] += f; pCtx->h[6] += g; pCtx->h[7] += h;
+}
+
+static void sha256_init(sha256ctx *pCtx) {
+  static const uint32_t h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(pCtx->h, h0, sizeof(h0));
+  pCtx->qwBytes = 0;
+}
+
+static void sha256_update(sha256ctx *pCtx, const uint8_t *p, size_t n) {
+  size_t nUsed = (size_t)(pCtx->qwBytes % 64);
+
+  pCtx->qwBytes += n;
+  if (nUsed) { /* Complete the pending block first */
+    size_t nCopy = 64 - nUsed;
+    if (nCopy > n) nCopy = n;
+    memcpy(pCtx->block + nUsed, p, nCopy);
+    p += nCopy;
+    n -= nCopy;
+    if ((nUsed + nCopy) < 64) return;
+    sha256_block(pCtx, pCtx->block);
+  }
+  for ( ; n >= 64; p += 64, n -= 64) sha256_block(pCtx, p);
+  if (n) memcpy(pCtx->block, p, n);
+}
+
+static void sha256_final(sha256ctx *pCtx, uint8_t digest[32]) {
+  uint64_t qwBits = pCtx->qwBytes * 8;
+  uint8_t pad[72] = {0x80};
+  size_t nPad = 64 - (size_t)((pCtx->qwBytes + 8) % 64);
+  int i;
+
+  for (i = 0; i < 8; i++) pad[nPad + i] = (uint8_t)(qwBits >> (56 - 8*i));
+  sha256_update(pCtx, pad, nPad + 8);
+  for (i = 0; i < 32; i++) digest[i] = (uint8_t)(pCtx->h[i/4] >> (24 - 8*(i%4)));
+}
+
+/* Hash a file contents. Same access method as CompareFdData(). */
+static void HashFdData(int fd, off_t size, char *pbuf, uint8_t digest[32]) {
+  sha256ctx ctx;
+  off_t offset;
+
+  sha256_init(&ctx);
+  if ((size <= MMAP_MAX_SIZE) && ((uintmax_t)size <= (uintmax_t)SIZE_MAX)) {
+    void *p = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    bs.nMaps += 1;
+    if (p != MAP_FAILED) {
+      madvise(p, (size_t)size, MADV_SEQUENTIAL);
+      InitMapGuard();
+      if (!sigsetjmp(jbMapFault, 1)) {
+	bMapGuard = TRUE;
+	sha256_update(&ctx, (uint8_t *)p, (size_t)size);
+	bMapGuard = FALSE;
+	munmap(p, (size_t)size);
+	sha256_final(&ctx, digest);
+	return;
+      }
+      bMapGuard = FALSE;	/* We got a SIGBUS. The file is now shorter. */
+      fprintf(stderr, "dirc: Warning: A file was truncated while hashing it.\n");
+      munmap(p, (size_t)size);
+      sha256_init(&ctx);	/* Start again, reading what remains */
+    }
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  for (offset = 0; ; ) {
+    ssize_t l = pread(fd, pbuf, FBUFSIZE, offset);
+    bs.nReads += 1;
+    if (l <= 0) break;
+    sha256_update(&ctx, (uint8_t *)pbuf, (size_t)l);
+    offset += l;
+  }
+  sha256_final(&ctx, digest);
+}
+
+static uint64_t HashPathname(char *pathname) {
+  uint64_t qwHash = 0xcbf29ce484222325ULL; /* FNV-1a 64-bits offset basis */
+  for ( ; *pathname; pathname++) {
+    qwHash ^= (uint8_t)*pathname;
+    qwHash *= 0x100000001b3ULL;	/* FNV-1a 64-bits prime */
+  }
+  return qwHash;
+}
+
+static int CDECL cmpcacherec(const void *p1, const void *p2) {
+  uint64_t qw1 = ((const cacherec *)p1)->qwPathHash;
+  uint64_t qw2 = ((const cacherec *)p2)->qwPathHash;
+  return (qw1 < qw2) ? -1 : (qw1 > qw2) ? 1 : 0;
+}
+
+/* Map the cache file, if it exists and is valid. Else start with an empty cache. */
+void OpenCache(void) {
+  int fd;
+  struct stat st;
+
+  dwToday = (uint32_t)(time(NULL) / 86400);
+  fd = open(pszCacheFile, O_RDONLY);
+  if (fd == -1) return; /* No cache yet */
+  if (!fstat(fd, &st) && (st.st_size >= (off_t)sizeof(cacheheader))) {
+    nCacheMap = (size_t)st.st_size;
+    /* Private writable mapping, to update the last use days in memory */
+    pCacheMap = (cacheheader *)mmap(NULL, nCacheMap, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if ((void *)pCacheMap == MAP_FAILED) pCacheMap = NULL;
+  }
+  close(fd);
+  if (   pCacheMap
+      && !memcmp(pCacheMap->magic, CACHE_MAGIC, 8)
+      && (pCacheMap->dwRecSize == sizeof(cacherec))
+      && (nCacheMap == sizeof(cacheheader) + (size_t)pCacheMap->dwRecords * sizeof(cacherec))) {
+    pCache = (cacherec *)(pCacheMap + 1);
+    nCache = pCacheMap->dwRecords;
+  } else {
+    if (iVerbose) fprintf(stderr, "dirc: Warning: Ignoring invalid cache file %s.\n", pszCacheFile);
+    if (pCacheMap) munmap(pCacheMap, nCacheMap);
+    pCacheMap = NULL;
+  }
+  DEBUG_PRINTF(("// Loaded %lu records from cache %s\n", (unsigned long)nCache, pszCacheFile));
+}
+
+/* Get a file digest from the cache, or else compute it and remember it */
+static void GetFileDigest(char *pathname, int fd, struct stat *pst, char *pbuf, uint8_t digest[32]) {
+  cacherec rec;
+  cacherec *pRec;
+  char *pszReal = realpath(pathname, NULL); /* The same file has the same key */
+
+  memset(&rec, 0, sizeof(rec));
+  rec.qwPathHash = HashPathname(pszReal ? pszReal : pathname);
+  free(pszReal);
+  rec.qwSize = (uint64_t)pst->st_size;
+  rec.qwMTime = (int64_t)pst->st_mtime;
+  rec.dwMTimeNs = (uint32_t)pst->st_mtim.tv_nsec;
+  rec.qwCTime = (int64_t)pst->st_ctime;
+  rec.dwCTimeNs = (uint32_t)pst->st_ctim.tv_nsec;
+  rec.qwDevice = (uint64_t)pst->st_dev;
+  rec.qwInode = (uint64_t)pst->st_ino;
+  rec.dwUsed = dwToday;
+
+  pRec = (cacherec *)bsearch(&rec, pCache, nCache, sizeof(cacherec), cmpcacherec);
+  if (   pRec
+      && (pRec->qwSize == rec.qwSize)
+      && (pRec->qwMTime == rec.qwMTime)
+      && (pRec->dwMTimeNs == rec.dwMTimeNs)
+      && (pRec->qwCTime == rec.qwCTime)
+      && (pRec->dwCTimeNs == rec.dwCTimeNs)
+      && (pRec->qwDevice == rec.qwDevice)
+      && (pRec->qwInode == rec.qwInode)) {
+    pRec->dwUsed = dwToday;
+    memcpy(digest, pRec->digest, 32);
+    lNCacheHits += 1;
+    return;
+  }
+
+  /* Not found, or the file changed. Hash it and add a new record. */
+  HashFdData(fd, pst->st_size, pbuf, rec.digest);
+  memcpy(digest, rec.digest, 32);
+  lNCacheMisses += 1;
+  if (nNewRecs == nNewAlloc) {
+    size_t nAlloc = 2 * nNewAlloc + 256;
+    cacherec *pNew = (cacherec *)realloc(pNewRecs, nAlloc * sizeof(cacherec));
+    if (!pNew) return; /* Not fatal. Just don't remember it. */
+    pNewRecs = pNew;
+    nNewAlloc = nAlloc;
+  }
+  pNewRecs[nNewRecs++] = rec;
+}
+
+/* Compare two regular files of the same size, using their cached digests.
+   Same results as CompareFdData(), which is used to order different files. */
+int CompareFileDigests(char *name1, int fd1, struct stat *pst1,
+		       char *name2, int fd2, struct stat *pst2, char *pbuf1, char *pbuf2) {
+  uint8_t digest1[32];
+  uint8_t digest2[32];
+
+  GetFileDigest(name1, fd1, pst1, pbuf1, digest1);
+  GetFileDigest(name2, fd2, pst2, pbuf1, digest2);
+  if (!memcmp(digest1, digest2, 32)) return 0;
+  return CompareFdData(fd1, fd2, pst1->st_size, pbuf1, pbuf2);
+}
+
+/* Merge the new records into the cache file, and drop the obsolete ones */
+void CloseCache(void) {
+  char *pszTemp;
+  FILE *hf;
+  cacheheader hdr;
+  size_t i, j, n;
+
+  if (!nNewRecs && !pCacheMap) return; /* Nothing to do */
+
+  /* Sort the new records. If a file was hashed twice, keep the last one. */
+  qsort(pNewRecs, nNewRecs, sizeof(cacherec), cmpcacherec);
+  for (i = j = 0; i < nNewRecs; i++) {
+    if ((i+1 < nNewRecs) && (pNewRecs[i+1].qwPathHash == pNewRecs[i].qwPathHash)) continue;
+    pNewRecs[j++] = pNewRecs[i];
+  }
+  nNewRecs = j;
+
+  pszTemp = (char *)malloc(strlen(pszCacheFile) + 16);
+  if (!pszTemp) finis(RETCODE_NO_MEMORY, "Out of memory");
+  sprintf(pszTemp, "%s.%d", pszCacheFile, (int)getpid());
+  hf = fopen(pszTemp, "wb");
+  if (!hf) {
+    fprintf(stderr, "dirc: Warning: Cannot write cache file %s.\n", pszTemp);
+    free(pszTemp);
+    return;
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CACHE_MAGIC, 8);
+  hdr.dwRecSize = sizeof(cacherec);
+  fwrite(&hdr, sizeof(hdr), 1, hf); /* Rewritten below with the final count */
+
+  /* Merge the two sorted arrays. New records replace old ones for the same path. */
+  for (i = j = n = 0; (i < nCache) || (j < nNewRecs); n++) {
+    if (   (i < nCache)
+	&& ((j == nNewRecs) || (pCache[i].qwPathHash < pNewRecs[j].qwPathHash))) {
+      if ((dwToday - pCache[i].dwUsed) > CACHE_MAX_AGE) { /* Obsolete. Drop it. */
+	i += 1;
+	n -= 1;
+	continue;
+      }
+      fwrite(pCache + i++, sizeof(cacherec), 1, hf);
+    } else {
+      if ((i < nCache) && (pCache[i].qwPathHash == pNewRecs[j].qwPathHash)) i += 1;
+      fwrite(pNewRecs + j++, sizeof(cacherec), 1, hf);
+    }
+  }
+  hdr.dwRecords = (uint32_t)n;
+  fseek(hf, 0, SEEK_SET);
+  fwrite(&hdr, sizeof(hdr), 1, hf);
+  if (fclose(hf) || rename(pszTemp, pszCacheFile)) {
+    fprintf(stderr, "dirc: Warning: Cannot update cache file %s.\n", pszCacheFile);
+    remove(pszTemp);
+  }
+  DEBUG_PRINTF(("// Saved %lu records into cache %s\n", (unsigned long)n, pszCacheFile));
+
+  free(pszTemp);
+  free(pNewRecs);
+  pNewRecs = NULL;
+  nNewRecs = nNewAlloc = 0;
+  if (pCacheMap) munmap(pCacheMap, nCacheMap);
+  pCacheMap = NULL;
+  pCache = NULL;
+  nCache = 0;
+}
+
+#endif /* HAS_MMAP */
+
+/******************************************************************************
+*                                                                             *
+*       Function:       filecompare                                           *
+*                                                                             *
+*       Description:    Compare the contents of two files                     *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         char *name1   Pathname of first file                                *
+*         char *name2   Pathname of second file                               *
+*                                                                             *
+*       Return value:   0=Same contents                                       *
+*                       1/-1=Length difference                                *
+*                       2/-2=Data difference                                  *
+*                       3/-3=One of the files is missing                      *
+*                                                                             *
+*       Notes:          In Unix, regular files of different sizes are         *
+*                       reported as different without reading them.           *
+*                       Else their data is compared by CompareFdData(), or    *
+*                       their digests by CompareFileDigests() with --cache.   *
+*                                                                             *
+*       Updates:                                                              *
+*        1995-06-12 JFL Made this routine generic (Independant of DIRC)       *
+*        2014-01-21 JFL Use a much larger buffer for 32-bits apps, to improve *
+*                       performance.                                          *
+*        2026-10-16 JFL In Unix, check the sizes first, then compare memory-  *
+*                       mapped views using vectorized comparisons.            *
+*                       Bug fix: A longer 2nd file was reported as identical. *
+*                                                                             *
+******************************************************************************/
 
 #ifdef _MSC_VER
 #pragma warning(disable:4706) /* Ignore the "assignment within conditional expression" warning */
@@ -1939,6 +3066,9 @@ int filecompare(char *name1, char *name2) { /* Compare two files */
   struct stat st1;
   struct stat st2;
 #endif // _MSDOS
+#if HAS_MMAP
+  int fd1, fd2;
+#endif
 
   DEBUG_ENTER(("filecompare(\"%s\", \"%s\");\n", name1, name2));
 
@@ -1954,12 +3084,14 @@ int filecompare(char *name1, char *name2) { /* Compare two files */
 #ifndef _MSDOS
   err1 = lstat(name1, &st1);
   err2 = lstat(name2, &st2);
+  bs.nStats += 2;
   if ((!err1) && S_ISLNK(st1.st_mode) && (!err2) && S_ISLNK(st2.st_mode)) {
 #if defined(_WIN32) && _MSVCLIBX_STAT_DEFINED
     if ((st1.st_Win32Attrs & FILE_ATTRIBUTE_DIRECTORY) && (st2.st_Win32Attrs & FILE_ATTRIBUTE_DIRECTORY))
 #else
     err1 = stat(name1, &st1);
     err2 = stat(name2, &st2);
+    bs.nStats += 2;
     if (err1 && err2) RETURN_INT_COMMENT(0, ("Both dead links. Ignore.\n"));
     if (err1) RETURN_INT_COMMENT(-3, ("The first link is dead.\n"));
     if (err2) RETURN_INT_COMMENT( 3, ("The second link is dead.\n"));
@@ -1980,8 +3112,42 @@ int filecompare(char *name1, char *name2) { /* Compare two files */
 #endif // _MSDOS
 
   /* For files or links to files, compare the data itself */
+#if HAS_MMAP
+  fd1 = open(name1, O_RDONLY);
+  fd2 = open(name2, O_RDONLY);
+  bs.nOpens += 2;
+  if ((fd1 == -1) && (fd2 == -1)) RETURN_INT_COMMENT(0, ("Neither file exists.\n"));
+  if (fd1 == -1) {
+    close(fd2);
+    RETURN_INT_COMMENT(-3, ("The first file does not exist.\n"));
+  }
+  if (fd2 == -1) {
+    close(fd1);
+    RETURN_INT_COMMENT( 3, ("The second file does not exist.\n"));
+  }
+  bs.nStats += 2;
+  if (   !fstat(fd1, &st1) && S_ISREG(st1.st_mode)
+      && !fstat(fd2, &st2) && S_ISREG(st2.st_mode)) {
+    /* Regular files with different sizes can't be identical */
+    if (st1.st_size != st2.st_size) {
+      dif = (st1.st_size > st2.st_size) ? 1 : -1;
+    } else if (pszCacheFile && (st1.st_size >= CACHE_MIN_SIZE)) {
+      dif = CompareFileDigests(name1, fd1, &st1, name2, fd2, &st2, pbuf1, pbuf2);
+    } else {
+      dif = CompareFdData(fd1, fd2, st1.st_size, pbuf1, pbuf2);
+    }
+    close(fd1);
+    close(fd2);
+    RETURN_INT_COMMENT(dif, ("Files are %s\n", dif ? "different" : "identical"));
+  }
+  /* Else for devices, pipes, etc, read them sequentially */
+  f1 = fdopen(fd1, "rb");
+  f2 = fdopen(fd2, "rb");
+  if ((!f1) || (!f2)) finis(RETCODE_NO_MEMORY, "Out of memory");
+#else
   f1 = fopen(name1, "rb");
   f2 = fopen(name2, "rb");
+  bs.nOpens += 2;
   if ((!f1) && (!f2)) RETURN_INT_COMMENT(0, ("Neither file exists.\n"));
   if (!f1) {
     fclose(f2);
@@ -1991,18 +3157,21 @@ int filecompare(char *name1, char *name2) { /* Compare two files */
     fclose(f1);
     RETURN_INT_COMMENT( 3, ("The second file does not exist.\n"));
   }
+#endif
 
   dif = 0;
   while ((l1 = fread(pbuf1, 1, FBUFSIZE, f1))) {
     l2 = fread(pbuf2, 1, FBUFSIZE, f2);
+    bs.nReads += 2;
     if (l1 > l2) {dif = 1; break;}
     if (l1 < l2) {dif = -1; break;}
-    dif = memcmp(pbuf1, pbuf2, l1);
+    dif = pMemCmp(pbuf1, pbuf2, l1);
     if (dif) {
       dif = (dif > 0) ? 2 : -2;
       break;   /* If different data found, return immediately */
     }
   }
+  if ((!dif) && fread(pbuf2, 1, 1, f2)) dif = -1; /* The second file is longer */
 
   fclose(f1);
   fclose(f2);
@@ -2021,6 +3190,7 @@ int filecompare(char *name1, char *name2) { /* Compare two files */
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
+*         fifarena *pDirs	Subdirectories of from and to, from lis().    *
 *         char *from		First directory to list.                      *
 *         char *to		Second directory to list, or NULL.            *
 *         char *switches	Switch string to pass to next level.          *
@@ -2033,7 +3203,8 @@ int filecompare(char *name1, char *name2) { /* Compare two files */
 *                                                                             *
 *       Return value:   0=Success; !0=Failure                                 *
 *                                                                             *
-*       Notes:                                                                *
+*       Notes:          Each subdirectory is read only once, by the lis()     *
+*                       call that lists its files and its subdirectories.     *
 *                                                                             *
 *       Updates:                                                              *
 *	 1993-10-15 JFL  Initial implementation 			      *
@@ -2041,175 +3212,1186 @@ int filecompare(char *name1, char *name2) { /* Compare two files */
 *                                                                             *
 ******************************************************************************/
 
-int descend(char *from, char *to, char *pattern,
+int descend(fifarena *pDirs, char *from, char *to, char *pattern,
                 int attrib,
                 BOOL both, BOOL diff, BOOL zero,
 		time_t datemin, time_t datemax) {
   int nfif;
   int i;
-  fif **directories;
-  fif **ppfif;
-  uint16_t wFlags = 0x8000 | _A_SUBDIR | _A_SYSTEM | _A_HIDDEN;
+  fifarena faSubDirs;		/* The next level's subdirectories */
+  fif *directories;
+  NEW_PATHNAME_BUF(name1);
+  NEW_PATHNAME_BUF(name2);
+
+  DEBUG_ENTER(("descend(\"%s\", \"%s\", \"%s\", 0x%X, %d, %d, %d, 0x%lX, 0x%lX);\n", from, to, pattern,
+	       attrib, both, diff, zero, (unsigned long)datemin, (unsigned long)datemax));
+
+#if PATHNAME_BUFS_IN_HEAP
+  if ((!name1) || (!name2)) {
+    FREE_PATHNAME_BUF(name1);
+    FREE_PATHNAME_BUF(name2);
+    RETURN_CONST_COMMENT(0, ("Out of memory\n"));
+  }
+#endif
+
+  /* Sort all subdirectories */
+  nfif = pDirs->nFifs;
+  directories = pDirs->pFifs;	/* Stable, as nothing more is added to pDirs */
+  trie(directories, nfif);
+  InitFifArena(&faSubDirs);
+
+  for (i=0; i<nfif; i++) {
+    char *pname1;
+    char *pname2;
+    char *pn1;
+    int ndir;
+
+    pn1 = directories[i].name;
+    path1[0] = path2[0] = '\0'; /* Cleanup static title buffers */
+    pname1 = pname2 = NULL;
+    ndir = 1;
+    if (from) {
+      makepathname(name1, from, pn1);
+      pname1 = name1;
+      DEBUG_PRINTF(("// Descent possible into %s\n", name1));
+    }
+    name2[0] = '\0';
+    if (to) {
+      makepathname(name2, to, pn1);
+      pname2 = name2;
+      ndir = 2;
+      DEBUG_PRINTF(("// and into %s\n", name2));
+    }
+    if (   to
+	 && ((i+1) < nfif)
+	 && (ignorecase ?
+		!stricmp(directories[i].name, directories[i+1].name)
+	      : streq(directories[i].name, directories[i+1].name)  ) ) {
+      /* Both subdirectories match */
+      i += 1;
+      ResetFifArena(&faFiles);
+      ResetFifArena(&faSubDirs);
+      lis(&faFiles, &faSubDirs, name1, pattern, 1, attrib, datemin, datemax);
+      if (to) lis(&faFiles, &faSubDirs, name2, pattern, 2, attrib, datemin, datemax);
+      affiche(&faFiles, ndir, both, diff, zero);
+
+      descend(&faSubDirs, pname1, pname2, pattern, attrib, both, diff, zero,
+		  datemin, datemax);
+    } else if (!both) {
+      DEBUG_PRINTF(("// There is no directory %s",
+		 (directories[i].column == 1) ? name2 : name1));
+      ResetFifArena(&faFiles);
+      ResetFifArena(&faSubDirs);
+      if (directories[i].column == 1) {
+	pname2 = NULL;
+	lis(&faFiles, &faSubDirs, name1, pattern, 1, attrib, datemin, datemax);
+      } else {
+	pname1 = NULL;
+	lis(&faFiles, &faSubDirs, name2, pattern, 2, attrib, datemin, datemax);
+      }
+      affiche(&faFiles, ndir, both, diff, zero);
+
+      descend(&faSubDirs, pname1, pname2, pattern, attrib, both, diff, zero,
+		  datemin, datemax);
+    }
+  } /* End for */
+
+  FreeFifArena(&faSubDirs);
+  FREE_PATHNAME_BUF(name1);
+  FREE_PATHNAME_BUF(name2);
+  RETURN_CONST(0);
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       pdescend                                              *
+*                                                                             *
+*       Description:    Go down the directory trees using parallel threads    *
+*                                                                             *
+*       Arguments:      Same as descend()                                     *
+*                                                                             *
+*       Return value:   0=Success; !0=Failure                                 *
+*                                                                             *
+*       Notes:          A pool of iJobs worker threads scans the two trees.   *
+*                       Each job reads one directory pair, and queues jobs    *
+*                       for the subdirectory pairs found, in the order that   *
+*                       descend() would have visited them. Each worker has    *
+*                       its own queue. It processes its newest jobs first,    *
+*                       and when idle it steals the oldest jobs of the others.*
+*                                                                             *
+*                       The workers never change the current directory.       *
+*                       They open the same absolute pathnames as lis() would, *
+*                       and use fstatat() relative to the directory opened.   *
+*                       Like lis(), if a pathname cannot be opened, its last  *
+*                       node is used as a pattern in its parent directory.    *
+*                       So roots with a pattern, or missing roots, give the   *
+*                       same results as in the serial case.                   *
+*                                                                             *
+*                       Meanwhile the main thread walks the job tree in the   *
+*                       same order as descend(), waiting for each job to be   *
+*                       done, then reports its errors, displays it and frees  *
+*                       it. So the output is the same as in the serial case,  *
+*                       including with option -e.                             *
+*                                                                             *
+*                       The workers stop when JOBS_AHEAD jobs per worker are  *
+*                       scanned and not displayed yet, so that the memory     *
+*                       used does not grow with the tree size. If the main    *
+*                       thread needs a job that no worker started, it scans   *
+*                       it itself.                                            *
+*                                                                             *
+*       Updates:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
+*        2026-10-16 JFL Split patterns off pathnames the same way as lis().   *
+*                       Report errors in the serial order.                    *
+*                       Bound the number of jobs scanned ahead of the display.*
+*                                                                             *
+******************************************************************************/
+
+#if HAS_THREADS
+
+#define JOBS_AHEAD 64		/* Max jobs scanned ahead of the display, per worker */
+
+typedef struct dirjob {	    /* A directory pair to scan, and the scan results */
+  char *relpath[2];		/* Path relative to each root, or NULL if absent */
+  char *title[2];		/* Absolute path of the directory listed, or NULL */
+  char *errpath[2];		/* Path of the directory that could not be opened */
+  int bFiles;			/* TRUE if the files list is needed */
+  fifarena files;		/* Entries matching the pattern, in lis() order */
+  struct dirjob **children;	/* Subdirectory pairs, in descend() order */
+  int nchildren;		/* Number of entries in the above array */
+  long nEntries;		/* Number of directory entries read */
+  long nStatCalls;		/* Number of stat() calls done for them */
+  int started;			/* TRUE when a thread took it off the queues */
+  int done;			/* TRUE when all the above fields are valid */
+} dirjob;
+
+typedef struct {	    /* A worker's double-ended job queue */
+  pthread_mutex_t mutex;
+  dirjob **ppJobs;		/* Array of job pointers */
+  int iFirst;			/* Index of the oldest job. Stolen by others. */
+  int iLast;			/* Index past the newest job. Popped by owner. */
+  int nAlloc;			/* Number of pointers allocated in ppJobs */
+} jobdeque;
+
+typedef struct {	    /* Parallel scan parameters and shared state */
+  int nWorkers;			/* Number of worker threads */
+  jobdeque *pDeques;		/* One job queue per worker */
+  char *rootabs[2];		/* Roots absolute pathnames, as lis() builds them */
+  char *rootpath[2];		/* Roots canonical pathnames, or NULL if none */
+  char *pattern;		/* Wildcards pattern */
+  int attrib;			/* Search attribute */
+  BOOL both;			/* Command line switch /b */
+  time_t datemin;		/* First date to consider */
+  time_t datemax;		/* Last date to consider */
+  pthread_mutex_t mutex;	/* Protects all fields below, and jobs flags */
+  pthread_cond_t workCond;	/* Signaled when jobs are queued, freed, or all done */
+  pthread_cond_t doneCond;	/* Signaled when a job is done */
+  int nQueued;			/* Number of jobs waiting in the queues */
+  int nActive;			/* Number of jobs queued or in progress */
+  int nHeld;			/* Number of jobs started and not freed yet */
+  int nMaxHeld;			/* Workers wait when nHeld reaches this */
+} pscan;
+
+static pscan ps;
+
+static dirjob *NewJob(char *relpath0, char *relpath1) {
+  dirjob *pJob = (dirjob *)calloc(1, sizeof(dirjob));
+  if (!pJob) finis(RETCODE_NO_MEMORY, "Out of memory for directory jobs");
+  if (relpath0 && !(pJob->relpath[0] = strdup(relpath0))) pJob = NULL;
+  if (pJob && relpath1 && !(pJob->relpath[1] = strdup(relpath1))) pJob = NULL;
+  if (!pJob) finis(RETCODE_NO_MEMORY, "Out of memory for directory jobs");
+  pJob->bFiles = TRUE;
+  InitFifArena(&pJob->files);
+  return pJob;
+}
+
+static void FreeJob(dirjob *pJob) {
+  int i;
+
+  FreeFifArena(&pJob->files);
+  free(pJob->children);
+  for (i=0; i<2; i++) {
+    free(pJob->relpath[i]);
+    free(pJob->title[i]);
+    free(pJob->errpath[i]);
+  }
+  free(pJob);
+}
+
+/* Append a node name to a relative path. "." is the root itself. */
+static char *JoinRelPath(char *buf, char *relpath, char *name) {
+  if (streq(relpath, ".")) {
+    strncpyz(buf, name, PATHNAME_SIZE);
+  } else {
+    makepathname(buf, relpath, name);
+  }
+  return buf;
+}
+
+/* Queue jobs in the worker's own queue. The first job will be popped first. */
+static void PushJobs(int iWorker, dirjob **ppJobs, int nJobs) {
+  jobdeque *pDQ = ps.pDeques + iWorker;
+  int i;
+
+  if (!nJobs) return;
+  pthread_mutex_lock(&pDQ->mutex);
+  if ((pDQ->iLast + nJobs) > pDQ->nAlloc) {
+    int nUsed = pDQ->iLast - pDQ->iFirst;
+    if ((nUsed + nJobs) > pDQ->nAlloc) { /* Compacting won't be enough */
+      int nAlloc = 2 * (nUsed + nJobs) + 16;
+      dirjob **ppNew = (dirjob **)realloc(pDQ->ppJobs, nAlloc * sizeof(dirjob *));
+      if (!ppNew) finis(RETCODE_NO_MEMORY, "Out of memory for job queue");
+      pDQ->ppJobs = ppNew;
+      pDQ->nAlloc = nAlloc;
+    }
+    memmove(pDQ->ppJobs, pDQ->ppJobs + pDQ->iFirst, nUsed * sizeof(dirjob *));
+    pDQ->iFirst = 0;
+    pDQ->iLast = nUsed;
+  }
+  for (i = nJobs-1; i >= 0; i--) pDQ->ppJobs[pDQ->iLast++] = ppJobs[i];
+  pthread_mutex_unlock(&pDQ->mutex);
+
+  pthread_mutex_lock(&ps.mutex);
+  ps.nQueued += nJobs;
+  ps.nActive += nJobs;
+  pthread_cond_broadcast(&ps.workCond);
+  pthread_mutex_unlock(&ps.mutex);
+}
+
+/* Get the newest job from our own queue, else the oldest from another one */
+static dirjob *PopJob(int iWorker) {
+  dirjob *pJob = NULL;
+  int i;
+
+  for (i = 0; (i < ps.nWorkers) && !pJob; i++) {
+    jobdeque *pDQ = ps.pDeques + ((iWorker + i) % ps.nWorkers);
+    pthread_mutex_lock(&pDQ->mutex);
+    if (pDQ->iLast > pDQ->iFirst) {
+      if (!i) {			/* Our own queue */
+	pJob = pDQ->ppJobs[--(pDQ->iLast)];
+      } else {			/* Steal from another worker */
+	pJob = pDQ->ppJobs[(pDQ->iFirst)++];
+      }
+      if (pDQ->iFirst == pDQ->iLast) pDQ->iFirst = pDQ->iLast = 0;
+    }
+    pthread_mutex_unlock(&pDQ->mutex);
+  }
+  if (pJob) {
+    pthread_mutex_lock(&ps.mutex);
+    ps.nQueued -= 1;
+    pJob->started = TRUE;
+    ps.nHeld += 1;
+    pthread_mutex_unlock(&ps.mutex);
+  }
+  return pJob;
+}
+
+/* Remove a given job from the queues. Returns FALSE if a worker got it first. */
+static int UnqueueJob(dirjob *pJob) {
+  int i, j;
+  int bFound = FALSE;
+
+  for (i = 0; (i < ps.nWorkers) && !bFound; i++) {
+    jobdeque *pDQ = ps.pDeques + i;
+    pthread_mutex_lock(&pDQ->mutex);
+    for (j = pDQ->iFirst; j < pDQ->iLast; j++) { /* Usually among the oldest */
+      if (pDQ->ppJobs[j] == pJob) {
+	memmove(pDQ->ppJobs + j, pDQ->ppJobs + j + 1, (pDQ->iLast - j - 1) * sizeof(dirjob *));
+	pDQ->iLast -= 1;
+	if (pDQ->iFirst == pDQ->iLast) pDQ->iFirst = pDQ->iLast = 0;
+	bFound = TRUE;
+	break;
+      }
+    }
+    pthread_mutex_unlock(&pDQ->mutex);
+  }
+  if (bFound) {
+    pthread_mutex_lock(&ps.mutex);
+    ps.nQueued -= 1;
+    pJob->started = TRUE;
+    ps.nHeld += 1;
+    pthread_mutex_unlock(&ps.mutex);
+  }
+  return bFound;
+}
+
+/* Same as GetDirentStat(), relative to a directory. Returns the # of calls. */
+static int pfstatat(int fd, char *name, struct stat *pst, int iFlags) {
+  int nCalls = 1;
+  int err = fstatat(fd, name, pst, iFlags);
+  if (err && !(iFlags & AT_SYMLINK_NOFOLLOW)) { /* Dead link with option -L */
+    err = fstatat(fd, name, pst, AT_SYMLINK_NOFOLLOW);
+    nCalls += 1;
+  }
+  if (err) memset(pst, 0, sizeof(struct stat));
+  return nCalls;
+}
+
+/* Scan one side of a directory pair. Same selection criteria as lis() */
+static void plis(dirjob *pJob, int col, fifarena *pDirs) {
+  int iSide = col - 1;
+  int fd;
+  DIR *pDir;
+  struct dirent *pDirent;
+  char *pattern = ps.pattern ? ps.pattern : PATTERN_ALL;
+  char pattern2[NODENAME_SIZE];
+  int bSplit = FALSE;		    /* TRUE if the pattern came from the path */
+  int iFlags = (pStat == lstat) ? AT_SYMLINK_NOFOLLOW : 0;
+  NEW_PATHNAME_BUF(path);	    /* Absolute pathname, as lis() builds it */
+  NEW_PATHNAME_BUF(target);	    /* Link target */
+  double dStart = iBench ? BenchTime() : 0;
+
+#if PATHNAME_BUFS_IN_HEAP
+  if ((!path) || (!target)) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+
+  if (!ps.rootabs[iSide]) { /* The NUL place holder. Nothing to scan. */
+    FREE_PATHNAME_BUF(path);
+    FREE_PATHNAME_BUF(target);
+    return;
+  }
+  if (streq(pJob->relpath[iSide], ".")) {
+    strncpyz(path, ps.rootabs[iSide], PATHNAME_SIZE);
+  } else {
+    makepathname(path, ps.rootabs[iSide], pJob->relpath[iSide]);
+  }
+  strncpyz(pattern2, pattern, NODENAME_SIZE);
+  fd = open(path, O_RDONLY | O_DIRECTORY);
+  if (fd == -1) { /* Directory not found. See if this is because of a file name pattern */
+    char *pc = strrchr(path, DIRSEPARATOR);
+    if (pc) {
+      strncpyz(pattern2, pc+1, NODENAME_SIZE);
+      bSplit = TRUE;		/* Then it applies to subdirectories too */
+      if (pc > path) {
+	*pc = '\0';
+      } else {			/* Special case of the root directory */
+	path[1] = '\0';
+      }
+      fd = open(path, O_RDONLY | O_DIRECTORY);
+    }
+  }
+  pDir = (fd != -1) ? fdopendir(fd) : NULL;
+  if (!pDir) { /* Reported by the main thread, in the serial order */
+    if (fd != -1) close(fd);
+    pJob->errpath[iSide] = strdup(path);
+    if (!pJob->errpath[iSide]) finis(RETCODE_NO_MEMORY, "Out of memory");
+    FREE_PATHNAME_BUF(path);
+    FREE_PATHNAME_BUF(target);
+    return;
+  }
+  /* The title, as lis() gets it from getcwd() */
+  if (bSplit || !ps.rootpath[iSide]) {
+    char *pszReal = realpath(path, NULL);
+    pJob->title[iSide] = pszReal ? pszReal : strdup(path);
+  } else if (streq(pJob->relpath[iSide], ".")) {
+    pJob->title[iSide] = strdup(ps.rootpath[iSide]);
+  } else {
+    makepathname(path, ps.rootpath[iSide], pJob->relpath[iSide]);
+    pJob->title[iSide] = strdup(path);
+  }
+  if (!pJob->title[iSide]) finis(RETCODE_NO_MEMORY, "Out of memory");
+
+  while ((pDirent = readdir(pDir))) {
+    struct stat st;
+    int iType = pDirent->d_type;
+    int bStatDone = FALSE;
+    int bMatch;
+    int bFile;
+
+    if (streq(pDirent->d_name, ".") || streq(pDirent->d_name, "..")) continue;
+    pJob->nEntries += 1;
+
+    /* First filter on the name and type, which cost no system call */
+    bMatch = (fnmatch(pattern2, pDirent->d_name, FNM_CASEFOLD) == FNM_MATCH);
+    bFile = pJob->bFiles && bMatch;
+    if (!bFile && ((iType && (iType != DT_DIR)) || (bSplit && !bMatch))) continue;
+    if (!iType) { /* Some filesystems don't set this field */
+      pJob->nStatCalls += pfstatat(fd, pDirent->d_name, &st, iFlags);
+      bStatDone = TRUE;
+      if (S_ISREG(st.st_mode)) iType = DT_REG;
+      if (S_ISDIR(st.st_mode)) iType = DT_DIR;
+      if (S_ISLNK(st.st_mode)) iType = DT_LNK;
+      if (S_ISBLK(st.st_mode)) iType = DT_BLK;
+      if (S_ISCHR(st.st_mode)) iType = DT_CHR;
+      if (S_ISFIFO(st.st_mode)) iType = DT_FIFO;
+      if (S_ISSOCK(st.st_mode)) iType = DT_SOCK;
+    }
+    if (!(ps.attrib & _A_SUBDIR) && (iType == DT_DIR)) bFile = FALSE;
+
+    /* Then get the file information, if needed for the date filter and the display */
+    if (bFile && !bStatDone) {
+      pJob->nStatCalls += pfstatat(fd, pDirent->d_name, &st, iFlags);
+      bStatDone = TRUE;
+    }
+
+    /* Subdirectories to descend into. Same as lis(..., 0x8000 | _A_SUBDIR, 0, TIME_T_MAX) */
+    if ((iType == DT_DIR) && (bMatch || !bSplit)) {
+      if (!bStatDone) { /* Only the type is used by descend() */
+	memset(&st, 0, sizeof(st));
+	st.st_mode = S_IFDIR;
+      }
+      NewFif(pDirs, pDirent->d_name, &st, col);
+    }
+
+    /* Files and directories to display. Same as lis(..., attrib, datemin, datemax) */
+    if (   bFile
+	&& (st.st_mtime >= ps.datemin)
+	&& (st.st_mtime <= ps.datemax)) {
+      fif *pfif = NewFif(&pJob->files, pDirent->d_name, &st, col);
+      if (iType == DT_LNK) {
+	int lTarget = (int)readlinkat(fd, pDirent->d_name, target, PATHNAME_SIZE-1);
+	if (lTarget != -1) {
+	  target[lTarget] = '\0';
+	  pfif->target = FifArenaStrDup(&pJob->files, target);
+	}
+      }
+      CheckFifArena(&pJob->files); /* Enforce the -m memory limit */
+    }
+  }
+
+  closedir(pDir); /* Also closes fd */
+  if (iBench) BenchAdd(BENCH_SCAN, dStart);
+  FREE_PATHNAME_BUF(path);
+  FREE_PATHNAME_BUF(target);
+}
+
+/* Scan a directory pair, then queue jobs for its subdirectory pairs */
+static void RunJob(dirjob *pJob, int iWorker) {
+  fifarena faDirs;
+  int nDirs;
+  fif *directories;
+  dirjob **children;
+  int nChildren = 0;
+  int i;
   NEW_PATHNAME_BUF(name1);
   NEW_PATHNAME_BUF(name2);
 
-  DEBUG_ENTER(("descend(\"%s\", \"%s\", \"%s\", 0x%X, %d, %d, %d, 0x%lX, 0x%lX);\n", from, to, pattern,
-	       attrib, both, diff, zero, (unsigned long)datemin, (unsigned long)datemax));
+#if PATHNAME_BUFS_IN_HEAP
+  if ((!name1) || (!name2)) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+
+  /* Scan the left side first, then the right side, like descend() */
+  InitFifArena(&faDirs);
+  if (pJob->relpath[0]) plis(pJob, 1, &faDirs);
+  if (pJob->relpath[1]) plis(pJob, 2, &faDirs);
+  nDirs = faDirs.nFifs;
+  directories = faDirs.pFifs;
+  trie(directories, nDirs);
+
+  /* Select subdirectories pairs the same way as descend() */
+  children = (dirjob **)malloc((nDirs+1) * sizeof(dirjob *));
+  if (!children) finis(RETCODE_NO_MEMORY, "Out of memory for directory jobs");
+  for (i=0; i<nDirs; i++) {
+    char *pn1 = directories[i].name;
+    char *pname1 = NULL;
+    char *pname2 = NULL;
+    if (pJob->relpath[0]) pname1 = JoinRelPath(name1, pJob->relpath[0], pn1);
+    if (pJob->relpath[1]) pname2 = JoinRelPath(name2, pJob->relpath[1], pn1);
+    if (   pJob->relpath[1]
+	 && ((i+1) < nDirs)
+	 && (ignorecase ?
+		!stricmp(directories[i].name, directories[i+1].name)
+	      : streq(directories[i].name, directories[i+1].name)  ) ) {
+      /* Both subdirectories match */
+      i += 1;
+      children[nChildren++] = NewJob(pname1, pname2);
+    } else if (!ps.both) {
+      if (directories[i].column == 1) {
+	children[nChildren++] = NewJob(pname1, NULL);
+      } else {
+	children[nChildren++] = NewJob(NULL, pname2);
+      }
+    }
+  }
+  FreeFifArena(&faDirs);
+  FREE_PATHNAME_BUF(name1);
+  FREE_PATHNAME_BUF(name2);
+
+  pJob->children = children;
+  pJob->nchildren = nChildren;
+  PushJobs(iWorker, children, nChildren);
+
+  pthread_mutex_lock(&ps.mutex);
+  lNEntries += pJob->nEntries;
+  lNStatCalls += pJob->nStatCalls;
+  pJob->done = TRUE;
+  ps.nActive -= 1;
+  pthread_cond_broadcast(&ps.doneCond);
+  if (!ps.nActive) pthread_cond_broadcast(&ps.workCond);
+  pthread_mutex_unlock(&ps.mutex);
+}
+
+static void *WorkerThread(void *pParam) {
+  int iWorker = (int)(intptr_t)pParam;
+
+  while (1) {
+    dirjob *pJob;
+    pthread_mutex_lock(&ps.mutex);
+    /* Wait for queued jobs, and for the display to catch up if it's too late */
+    while (ps.nActive && (!ps.nQueued || (ps.nHeld >= ps.nMaxHeld))) {
+      pthread_cond_wait(&ps.workCond, &ps.mutex);
+    }
+    if (!ps.nActive) { /* Everything has been scanned */
+      pthread_mutex_unlock(&ps.mutex);
+      break;
+    }
+    pthread_mutex_unlock(&ps.mutex);
+    pJob = PopJob(iWorker);
+    if (pJob) RunJob(pJob, iWorker);
+  }
+  return NULL;
+}
+
+/* Wait for a job to be done. Scan it now if no worker started it yet. */
+static void WaitForJob(dirjob *pJob) {
+  int bStarted;
+
+  pthread_mutex_lock(&ps.mutex);
+  bStarted = pJob->started;
+  pthread_mutex_unlock(&ps.mutex);
+  /* If the workers are busy, or waiting for us, scan it ourselves */
+  if (!bStarted && UnqueueJob(pJob)) RunJob(pJob, 0);
+
+  pthread_mutex_lock(&ps.mutex);
+  while (!pJob->done) pthread_cond_wait(&ps.doneCond, &ps.mutex);
+  pthread_mutex_unlock(&ps.mutex);
+}
+
+/* Display the subdirectories of a job, in the same order as descend() */
+static void ShowJobChildren(dirjob *pJob, BOOL diff, BOOL zero) {
+  int ndir = pJob->relpath[1] ? 2 : 1;
+  int i, j;
+
+  WaitForJob(pJob);
+  for (i=0; i<pJob->nchildren; i++) {
+    dirjob *pChild = pJob->children[i];
+
+    WaitForJob(pChild);
+    for (j=0; j<2; j++) { /* Report errors like lis() would have */
+      if (!pChild->errpath[j]) continue;
+      if (iVerbose || !iContinue) {
+	fprintf(stderr, "dirc: Error: Cannot access directory %s.\n", pChild->errpath[j]);
+      }
+      if (!iContinue) finis(RETCODE_INACCESSIBLE, NULL);
+    }
+    path1[0] = path2[0] = '\0'; /* Cleanup static title buffers */
+    if (pChild->title[0]) strncpyz(path1, pChild->title[0], PATHNAME_SIZE);
+    if (pChild->title[1]) strncpyz(path2, pChild->title[1], PATHNAME_SIZE);
+    affiche(&pChild->files, ndir, ps.both, diff, zero);
+    FreeFifArena(&pChild->files);
+
+    ShowJobChildren(pChild, diff, zero);
+    FreeJob(pChild);
+    pJob->children[i] = NULL;
+
+    pthread_mutex_lock(&ps.mutex);
+    ps.nHeld -= 1;
+    pthread_cond_broadcast(&ps.workCond); /* Let the workers scan further */
+    pthread_mutex_unlock(&ps.mutex);
+  }
+}
+
+int pdescend(char *from, char *to, char *pattern,
+                int attrib,
+                BOOL both, BOOL diff, BOOL zero,
+		time_t datemin, time_t datemax) {
+  char *roots[2];
+  pthread_t *pThreads;
+  dirjob *pRoot;
+  int i;
+  int nThreads = 0;
+  NEW_PATHNAME_BUF(path);
+
+  DEBUG_ENTER(("pdescend(\"%s\", \"%s\", \"%s\", 0x%X, %d, %d, %d, 0x%lX, 0x%lX);\n", from, to, pattern,
+	       attrib, both, diff, zero, (unsigned long)datemin, (unsigned long)datemax));
+
+#if PATHNAME_BUFS_IN_HEAP
+  if (!path) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+
+  memset(&ps, 0, sizeof(ps));
+  ps.nWorkers = iJobs;
+  ps.nMaxHeld = JOBS_AHEAD * iJobs;
+  ps.pattern = pattern;
+  ps.attrib = attrib;
+  ps.both = both;
+  ps.datemin = datemin;
+  ps.datemax = datemax;
+  pthread_mutex_init(&ps.mutex, NULL);
+  pthread_cond_init(&ps.workCond, NULL);
+  pthread_cond_init(&ps.doneCond, NULL);
+
+  pThreads = (pthread_t *)malloc(ps.nWorkers * sizeof(pthread_t));
+  ps.pDeques = (jobdeque *)calloc(ps.nWorkers, sizeof(jobdeque));
+  if (!pThreads || !ps.pDeques) finis(RETCODE_NO_MEMORY, "Out of memory for threads");
+  for (i=0; i<ps.nWorkers; i++) pthread_mutex_init(&ps.pDeques[i].mutex, NULL);
+
+  /* Make the roots absolute the same way as lis(). Their errors were already
+     reported by the caller's lis(), so plis() will fail silently on them. */
+  roots[0] = from;
+  roots[1] = to;
+  for (i=0; i<2; i++) {
+    if (!roots[i] || !stricmp(roots[i], "nul")) continue; /* lis() ignores NUL */
+    if (roots[i][0] == DIRSEPARATOR) {
+      strncpyz(path, roots[i], PATHNAME_SIZE);
+    } else {
+      if (!getdir(path, PATHNAME_SIZE)) finis(RETCODE_INACCESSIBLE, "Cannot get the current directory");
+      if (path[1]) strcat(path, "/");
+      strcat(path, roots[i]);
+    }
+    ps.rootabs[i] = strdup(path);
+    if (!ps.rootabs[i]) finis(RETCODE_NO_MEMORY, "Out of memory");
+    ps.rootpath[i] = realpath(path, NULL);
+  }
+  pRoot = NewJob(from ? "." : NULL, to ? "." : NULL);
+  pRoot->bFiles = FALSE; /* The caller already listed the root files */
+
+  PushJobs(0, &pRoot, 1);
+  for (i=0; i<ps.nWorkers; i++) {
+    if (pthread_create(pThreads+nThreads, NULL, WorkerThread, (void *)(intptr_t)i)) break;
+    nThreads += 1;
+  }
+  if (!nThreads) { /* No thread could be started. Use the serial version. */
+    fifarena faDirs;
+    int wFlags = 0x8000 | _A_SUBDIR | _A_SYSTEM | _A_HIDDEN;
+    DEBUG_PRINTF(("// Cannot create threads. Falling back to descend().\n"));
+    InitFifArena(&faDirs);
+    if (from) lis(&faDirs, NULL, from, PATTERN_ALL, 1, wFlags, 0, TIME_T_MAX);
+    if (to) lis(&faDirs, NULL, to, PATTERN_ALL, 2, wFlags, 0, TIME_T_MAX);
+    descend(&faDirs, from, to, pattern, attrib, both, diff, zero, datemin, datemax);
+    FreeFifArena(&faDirs);
+    PopJob(0);
+  } else {
+    ShowJobChildren(pRoot, diff, zero);
+    for (i=0; i<nThreads; i++) pthread_join(pThreads[i], NULL);
+  }
+  FreeJob(pRoot);
+
+  for (i=0; i<2; i++) {
+    free(ps.rootabs[i]);
+    free(ps.rootpath[i]);
+  }
+  for (i=0; i<ps.nWorkers; i++) {
+    pthread_mutex_destroy(&ps.pDeques[i].mutex);
+    free(ps.pDeques[i].ppJobs);
+  }
+  free(ps.pDeques);
+  free(pThreads);
+  pthread_cond_destroy(&ps.doneCond);
+  pthread_cond_destroy(&ps.workCond);
+  pthread_mutex_destroy(&ps.mutex);
+  FREE_PATHNAME_BUF(path);
+  RETURN_CONST(0);
+}
+
+#endif /* HAS_THREADS */
+
+/******************************************************************************
+*                                                                             *
+*       Function:       InitFifArena                                          *
+*                                                                             *
+*       Description:    Initialize an empty fif arena                         *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         fifarena *pfa		The arena to initialize.                      *
+*                                                                             *
+*       Return value:   None                                                  *
+*                                                                             *
+*       Notes:          A fif arena holds a contiguous array of fif records,  *
+*                       that can be sorted in place, and the strings they     *
+*                       point to. The strings are allocated from large blocks,*
+*                       with a bump pointer, and identical names are stored   *
+*                       only once. So listing a directory costs a handful of  *
+*                       malloc() calls, instead of two or three per file.     *
+*                                                                             *
+*       Updates:                                                              *
+*                                                                             *
+******************************************************************************/
+
+#define FIFS_MIN_ALLOC 64	/* Initial number of fif records */
+#define FIFCHUNK_MIN 0x1000	/* Initial strings block size */
+#ifdef _MSDOS
+#define FIFCHUNK_MAX 0x4000	/* Maximum strings block size */
+#else
+#define FIFCHUNK_MAX 0x100000	/* Maximum strings block size */
+#endif
+
+void InitFifArena(fifarena *pfa) {
+  memset(pfa, 0, sizeof(fifarena));
+}
+
+/* Allocate n bytes in the current block, or in the next one */
+static char *FifArenaAlloc(fifarena *pfa, size_t n) {
+  fifchunk *pfc = pfa->pCur;
+  char *p;
+
+  if (!pfc || ((pfa->nUsed + n) > pfc->size)) { /* Switch to the next block */
+    if (pfc && pfc->next && (n <= pfc->next->size)) { /* Reuse it */
+      pfc = pfc->next;
+    } else { /* Allocate a new block, twice as big as the previous one */
+      fifchunk *pfcNew;
+      size_t size = pfc ? (2 * pfc->size) : FIFCHUNK_MIN;
+      if (size > FIFCHUNK_MAX) size = FIFCHUNK_MAX;
+      if (size < n) size = n;
+      pfcNew = (fifchunk *)malloc(offsetof(fifchunk, data) + size);
+      if (!pfcNew) finis(RETCODE_NO_MEMORY, "Out of memory for directory access");
+      pfcNew->size = size;
+      if (pfc) { /* Insert it after the current block */
+	pfcNew->next = pfc->next;
+	pfc->next = pfcNew;
+      } else {	 /* This is the first block */
+	pfcNew->next = NULL;
+	pfa->pFirst = pfcNew;
+      }
+      pfc = pfcNew;
+    }
+    pfa->pCur = pfc;
+    pfa->nUsed = 0;
+  }
+  p = pfc->data + pfa->nUsed;
+  pfa->nUsed += n;
+  pfa->nStrUsed += n;
+  return p;
+}
+
+char *FifArenaStrDup(fifarena *pfa, char *string) {
+  size_t l = strlen(string) + 1;
+  return (char *)memcpy(FifArenaAlloc(pfa, l), string, l);
+}
+
+/* FNV-1a hash of a name */
+static uint32_t FifNameHash(const char *name) {
+  uint32_t h = 2166136261U;
+  while (*name) {
+    h ^= (unsigned char)*(name++);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/* Get a copy of the name in the arena. Names found in both columns are shared. */
+static char *FifArenaName(fifarena *pfa, char *name) {
+  size_t mask, i;
+  char *pName;
+
+  if ((2 * (pfa->nNames + 1)) > pfa->nSlots) { /* Keep the table half empty */
+    size_t nSlots = pfa->nSlots ? (2 * pfa->nSlots) : (2 * FIFS_MIN_ALLOC);
+    char **ppNames = (char **)calloc(nSlots, sizeof(char *));
+    if (!ppNames) finis(RETCODE_NO_MEMORY, "Out of memory for directory access");
+    for (i=0; i<pfa->nSlots; i++) { /* Move existing names to the new table */
+      size_t j;
+      if (!(pName = pfa->ppNames[i])) continue;
+      for (j = FifNameHash(pName) & (nSlots-1); ppNames[j]; j = (j+1) & (nSlots-1)) ;
+      ppNames[j] = pName;
+    }
+    free(pfa->ppNames);
+    pfa->ppNames = ppNames;
+    pfa->nSlots = nSlots;
+  }
+
+  mask = pfa->nSlots - 1;
+  for (i = FifNameHash(name) & mask; (pName = pfa->ppNames[i]); i = (i+1) & mask) {
+    if (streq(pName, name)) return pName;
+  }
+  pName = FifArenaStrDup(pfa, name);
+  pfa->ppNames[i] = pName;
+  pfa->nNames += 1;
+  return pName;
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       NewFif                                                *
+*                                                                             *
+*       Description:    Append a fif record to a fif arena                    *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         fifarena *pfa		The arena to append to.                       *
+*         char *name		File node name. Copied into the arena.        *
+*         struct stat *pst	File information. Copied.                     *
+*         int col		1 = left column; 2 = right column.            *
+*                                                                             *
+*       Return value:   The new record. Aborts the program if failure.        *
+*                                                                             *
+*       Notes:          The record may move when the next one is appended.    *
+*                                                                             *
+*       Updates:                                                              *
+*                                                                             *
+******************************************************************************/
+
+fif *NewFif(fifarena *pfa, char *name, struct stat *pst, int col) {
+  fif *pfif;
+
+  if (pfa->nFifs == pfa->nAlloc) {
+    int nAlloc = pfa->nAlloc ? (2 * pfa->nAlloc) : FIFS_MIN_ALLOC;
+    pfif = (fif *)realloc(pfa->pFifs, nAlloc * sizeof(fif));
+    if (!pfif) finis(RETCODE_NO_MEMORY, "Out of memory for directory access");
+    pfa->pFifs = pfif;
+    pfa->nAlloc = nAlloc;
+  }
+  pfif = pfa->pFifs + pfa->nFifs++;
+  pfif->name = FifArenaName(pfa, name);
+#ifndef _MSDOS
+  pfif->target = NULL;
+#endif
+  pfif->size = (uintmax_t)(pst->st_size);
+  pfif->mtime = pst->st_mtime;
+  pfif->mode = (unsigned int)(pst->st_mode);
+  pfif->column = col;
+#if _MSVCLIBX_STAT_DEFINED
+  pfif->win32attrs = pst->st_Win32Attrs;
+  pfif->reparsetag = pst->st_ReparseTag;
+#endif
+  return pfif;
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       ResetFifArena                                         *
+*                                                                             *
+*       Description:    Empty a fif arena, keeping its memory for reuse       *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         fifarena *pfa		The arena to reset.                           *
+*                                                                             *
+*       Return value:   None                                                  *
+*                                                                             *
+*       Notes:          All fif records and names in it become invalid.       *
+*                                                                             *
+*       Updates:                                                              *
+*                                                                             *
+******************************************************************************/
+
+/* Forget the records in memory. Keep those moved to the temporary file. */
+static void EmptyFifArena(fifarena *pfa) {
+  pfa->nFifs = 0;
+  pfa->pCur = pfa->pFirst;
+  pfa->nUsed = 0;
+  pfa->nStrUsed = 0;
+  if (pfa->nNames) memset(pfa->ppNames, 0, pfa->nSlots * sizeof(char *));
+  pfa->nNames = 0;
+}
+
+/* Delete the temporary file, if any */
+static void FreeFifRuns(fifarena *pfa) {
+  int i;
+
+  if (pfa->pfRuns) fclose(pfa->pfRuns); /* tmpfile() files are deleted when closed */
+  for (i=0; i<pfa->nRuns; i++) free(pfa->pRuns[i].pBuf);
+  free(pfa->pRuns);
+  pfa->pfRuns = NULL;
+  pfa->pRuns = NULL;
+  pfa->nRuns = 0;
+}
+
+void ResetFifArena(fifarena *pfa) {
+  EmptyFifArena(pfa);
+  if (pfa->pfRuns) FreeFifRuns(pfa);
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       FreeFifArena                                          *
+*                                                                             *
+*       Description:    Empty a fif arena, and free all its memory            *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         fifarena *pfa		The arena to free.                            *
+*                                                                             *
+*       Return value:   None                                                  *
+*                                                                             *
+*       Notes:          The arena can be reused afterwards.                   *
+*                                                                             *
+*       Updates:                                                              *
+*                                                                             *
+******************************************************************************/
+
+void FreeFifArena(fifarena *pfa) {
+  fifchunk *pfc, *pNext;
+
+  for (pfc = pfa->pFirst; pfc; pfc = pNext) {
+    pNext = pfc->next;
+    free(pfc);
+  }
+  free(pfa->ppNames);
+  free(pfa->pFifs);
+  FreeFifRuns(pfa);
+  InitFifArena(pfa);
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       CheckFifArena                                         *
+*                                                                             *
+*       Description:    Move the records to a temporary file if over limit    *
+*                                                                             *
+*       Arguments:                                                            *
+*                                                                             *
+*         fifarena *pfa		The arena to check.                           *
+*                                                                             *
+*       Return value:   None                                                  *
+*                                                                             *
+*       Notes:          When the records use more than a quarter of the limit *
+*                       set by option -m, they're sorted, and written as one  *
+*                       sorted run into a temporary file. The rest is left    *
+*                       for the array growth, and for the buffers of trie().  *
+*                       The reader then merges all runs. (External merge sort)*
+*                                                                             *
+*       Updates:                                                              *
+*                                                                             *
+******************************************************************************/
+
+typedef struct fifrec {	    /* A fif record in a temporary file */
+  uintmax_t size;		/* File size */
+  time_t mtime;			/* File modification time */
+  unsigned int mode;		/* File type and permissions */
+  int column;			/* 1 = left column; 2 = right column */
+#if _MSVCLIBX_STAT_DEFINED
+  unsigned long win32attrs;	/* Windows file attributes */
+  unsigned long reparsetag;	/* Windows reparse point tag */
+#endif
+  unsigned short lName;		/* Name size, including the NUL. Follows the record */
+  unsigned short lTarget;	/* Link target size, incl. the NUL, or 0 if none. */
+} fifrec;			/* Followed by the name, then the target */
 
-#if PATHNAME_BUFS_IN_HEAP
-  if ((!name1) || (!name2)) {
-    FREE_PATHNAME_BUF(name1);
-    FREE_PATHNAME_BUF(name2);
-    RETURN_CONST_COMMENT(0, ("Out of memory\n"));
-  }
+#define FIFRUN_BUF_MIN (sizeof(fifrec) + 2*PATHNAME_SIZE) /* Room for any record */
+#ifdef _MSDOS
+#define FIFRUN_BUF_MAX 0x1000	/* Maximum read buffer size */
+#else
+#define FIFRUN_BUF_MAX 0x10000	/* Maximum read buffer size */
 #endif
 
-  /* Get all subdirectories */
-  nfif = 0;
-  if (from) nfif = lis(from, PATTERN_ALL, nfif, 1, wFlags, 0, TIME_T_MAX);
-  if (to) nfif = lis(to, PATTERN_ALL, nfif, 2, wFlags, 0, TIME_T_MAX);
-  directories = AllocFifArray(nfif);
-  trie(directories, nfif);
+static size_t FifArenaUsage(fifarena *pfa) {
+  return (pfa->nFifs * sizeof(fif)) + pfa->nStrUsed + (pfa->nSlots * sizeof(char *));
+}
 
-  for (i=0; i<nfif; i++) {
-    char *pname1;
-    char *pname2;
-    char *pn1;
-    int nfif2;
-    int ndir;
+static void SpillFifArena(fifarena *pfa) {
+  fifrun *pRun;
+  int i;
 
-    pn1 = directories[i]->name;
-    path1[0] = path2[0] = '\0'; /* Cleanup static title buffers */
-    pname1 = pname2 = NULL;
-    ndir = 1;
-    if (from) {
-      makepathname(name1, from, pn1);
-      pname1 = name1;
-      DEBUG_PRINTF(("// Descent possible into %s\n", name1));
-    }
-    name2[0] = '\0';
-    if (to) {
-      makepathname(name2, to, pn1);
-      pname2 = name2;
-      ndir = 2;
-      DEBUG_PRINTF(("// and into %s\n", name2));
-    }
-    if (   to
-	 && ((i+1) < nfif)
-	 && (ignorecase ?
-		!stricmp(directories[i]->name, directories[i+1]->name)
-	      : streq(directories[i]->name, directories[i+1]->name)  ) ) {
-      /* Both subdirectories match */
-      i += 1;
-      nfif2 = lis(name1, pattern, 0, 1, attrib,
-		      datemin, datemax);
-      if (to) nfif2 = lis(name2, pattern, nfif2, 2, attrib,
-			      datemin, datemax);
-      ppfif = AllocFifArray(nfif2);
-      trie(ppfif, nfif2);
-      affiche(ppfif, nfif2, ndir, both, diff, zero);
-      FreeFifArray(ppfif);
-
-      descend(pname1, pname2, pattern, attrib, both, diff, zero,
-		  datemin, datemax);
-    } else if (!both) {
-      DEBUG_PRINTF(("// There is no directory %s",
-		 (directories[i]->column == 1) ? name2 : name1));
-      if (directories[i]->column == 1) {
-	pname2 = NULL;
-	nfif2 = lis(name1, pattern, 0, 1, attrib, datemin, datemax);
-      } else {
-	pname1 = NULL;
-	nfif2 = lis(name2, pattern, 0, 2, attrib, datemin, datemax);
-      }
-      ppfif = AllocFifArray(nfif2);
-      trie(ppfif, nfif2);
-      affiche(ppfif, nfif2, ndir, both, diff, zero);
-      FreeFifArray(ppfif);
+  DEBUG_PRINTF(("// Moving %d sorted records to a temporary file\n", pfa->nFifs));
+  if (!pfa->pfRuns) {
+    pfa->pfRuns = tmpfile();
+    if (!pfa->pfRuns) finis(RETCODE_NO_MEMORY, "Cannot create a temporary file");
+  }
+  pRun = (fifrun *)realloc(pfa->pRuns, (pfa->nRuns + 1) * sizeof(fifrun));
+  if (!pRun) finis(RETCODE_NO_MEMORY, "Out of memory for directory access");
+  pfa->pRuns = pRun;
+  pRun += pfa->nRuns++;
+  memset(pRun, 0, sizeof(fifrun));
+  pRun->nLeft = pfa->nFifs;
+  fgetpos(pfa->pfRuns, &pRun->pos);
+
+  trie(pfa->pFifs, pfa->nFifs);
+  for (i=0; i<pfa->nFifs; i++) {
+    fif *pfif = pfa->pFifs + i;
+    fifrec rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.size = pfif->size;
+    rec.mtime = pfif->mtime;
+    rec.mode = pfif->mode;
+    rec.column = pfif->column;
+#if _MSVCLIBX_STAT_DEFINED
+    rec.win32attrs = pfif->win32attrs;
+    rec.reparsetag = pfif->reparsetag;
+#endif
+    rec.lName = (unsigned short)(strlen(pfif->name) + 1);
+#ifndef _MSDOS
+    if (pfif->target) rec.lTarget = (unsigned short)(strlen(pfif->target) + 1);
+#endif
+    fwrite(&rec, sizeof(rec), 1, pfa->pfRuns);
+    fwrite(pfif->name, rec.lName, 1, pfa->pfRuns);
+#ifndef _MSDOS
+    if (rec.lTarget) fwrite(pfif->target, rec.lTarget, 1, pfa->pfRuns);
+#endif
+  }
+  if (ferror(pfa->pfRuns)) finis(RETCODE_NO_MEMORY, "Cannot write a temporary file");
 
-      descend(pname1, pname2, pattern, attrib, both, diff, zero,
-		  datemin, datemax);
-    }
-  } /* End for */
+  EmptyFifArena(pfa);
+}
 
-  FreeFifArray(directories);
-  FREE_PATHNAME_BUF(name1);
-  FREE_PATHNAME_BUF(name2);
-  RETURN_CONST(0);
+void CheckFifArena(fifarena *pfa) {
+  if (nMemLimit && pfa->nFifs && (FifArenaUsage(pfa) > (nMemLimit / 4))) {
+    SpillFifArena(pfa);
+  }
 }
 
 /******************************************************************************
 *                                                                             *
-*       Function:       AllocFifArray                                         *
+*       Function:       OpenFifReader                                         *
 *                                                                             *
-*       Description:    Allocate an array of fif pointers, to be sorted.      *
+*       Description:    Prepare reading the records of an arena, in order     *
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
-*         int nfif      Number of fif structures.                             *
+*         fifreader *pfr	The reader to initialize.                     *
+*         fifarena *pfa		The arena to read.                            *
 *                                                                             *
-*       Return value:   The array address. Aborts the program if failure.     *
+*       Return value:   None                                                  *
 *                                                                             *
-*       Notes:                                                                *
+*       Notes:          If all records are in memory, they're sorted in place.*
+*                       Else the last ones are moved to the temporary file    *
+*                       too, and NextFif() merges all the sorted runs.        *
 *                                                                             *
 *       Updates:                                                              *
 *                                                                             *
 ******************************************************************************/
 
-fif **AllocFifArray(size_t nfif) {
-  fif **ppfif;
-  fif *pfif;
-  size_t i;
+/* Read the next record of a run. Return FALSE if there's none left. */
+static int LoadFifRun(fifarena *pfa, fifrun *pRun) {
+  fifrec rec;
+  size_t nNeeded = sizeof(fifrec);
+  char *pc;
+  int iPass;
+
+  if (!pRun->nLeft) return FALSE;
+  for (iPass = 0; iPass < 2; iPass++) { /* Get the fixed part, then the strings */
+    if ((pRun->nBuf - pRun->iBuf) < nNeeded) { /* Refill the buffer */
+      FILE *pf = pfa->pfRuns;
+      size_t nKept = pRun->nBuf - pRun->iBuf;
+      memmove(pRun->pBuf, pRun->pBuf + pRun->iBuf, nKept);
+      fsetpos(pf, &pRun->pos);
+      pRun->nBuf = nKept + fread(pRun->pBuf + nKept, 1, pRun->nBufSize - nKept, pf);
+      pRun->iBuf = 0;
+      fgetpos(pf, &pRun->pos);
+      if (pRun->nBuf < nNeeded) finis(RETCODE_NO_MEMORY, "Cannot read a temporary file");
+    }
+    if (!iPass) {
+      memcpy(&rec, pRun->pBuf + pRun->iBuf, sizeof(fifrec));
+      nNeeded += rec.lName + rec.lTarget;
+    }
+  }
+  /* The strings are used in place, until the next record of this run is read */
+  pc = pRun->pBuf + pRun->iBuf + sizeof(fifrec);
+  pRun->f.name = pc;
+#ifndef _MSDOS
+  pRun->f.target = rec.lTarget ? (pc + rec.lName) : NULL;
+#endif
+  pRun->f.size = rec.size;
+  pRun->f.mtime = rec.mtime;
+  pRun->f.mode = rec.mode;
+  pRun->f.column = rec.column;
+#if _MSVCLIBX_STAT_DEFINED
+  pRun->f.win32attrs = rec.win32attrs;
+  pRun->f.reparsetag = rec.reparsetag;
+#endif
+  pRun->iBuf += nNeeded;
+  pRun->nLeft -= 1;
+  return TRUE;
+}
 
-  /* Allocate an array for sorting */
-  ppfif = (fif **)malloc((nfif+1) * sizeof(fif *));
-  if (!ppfif) finis(RETCODE_NO_MEMORY, "Out of memory for fif array");
-  /* Fill the array with pointers to the list of structures */
-  pfif = firstfif;
-  for (i=0; i<nfif; i++) {
-    ppfif[i] = pfif;
-    pfif = pfif->next;
+/* Compare the current records of two runs. Equal records: Keep the run order. */
+static int CmpFifRuns(fifarena *pfa, int iRun1, int iRun2) {
+  int dif = cmpfif(&pfa->pRuns[iRun1].f, &pfa->pRuns[iRun2].f);
+  if (!dif) dif = iRun1 - iRun2;
+  return dif;
+}
+
+/* Move a heap element down to its place */
+static void SiftFifHeap(fifreader *pfr, int i) {
+  int *piHeap = pfr->piHeap;
+  int iRun = piHeap[i];
+
+  while ((2*i + 1) < pfr->nHeap) {
+    int iChild = 2*i + 1;
+    if (   ((iChild + 1) < pfr->nHeap)
+	&& (CmpFifRuns(pfr->pfa, piHeap[iChild + 1], piHeap[iChild]) < 0)) {
+      iChild += 1;
+    }
+    if (CmpFifRuns(pfr->pfa, iRun, piHeap[iChild]) <= 0) break;
+    piHeap[i] = piHeap[iChild];
+    i = iChild;
+  }
+  piHeap[i] = iRun;
+}
+
+void OpenFifReader(fifreader *pfr, fifarena *pfa) {
+  size_t nBufSize;
+  int i;
+
+  memset(pfr, 0, sizeof(fifreader));
+  pfr->pfa = pfa;
+  if (!pfa->nRuns) { /* Common case: Everything is in memory */
+    trie(pfa->pFifs, pfa->nFifs);
+    return;
   }
-  /* Make sure following the linked list ends with the array */
-  if (nfif) ppfif[nfif-1]->next = NULL;
-  /* Make sure FreeFifArray works in all cases. */
-  ppfif[nfif] = NULL;
 
-  return ppfif;
+  /* Move the last records to the temporary file too, then merge all runs */
+  if (pfa->nFifs) SpillFifArena(pfa);
+  nBufSize = nMemLimit / (4 * pfa->nRuns);
+  if (nBufSize > FIFRUN_BUF_MAX) nBufSize = FIFRUN_BUF_MAX;
+  if (nBufSize < FIFRUN_BUF_MIN) nBufSize = FIFRUN_BUF_MIN;
+  pfr->piHeap = (int *)malloc(pfa->nRuns * sizeof(int));
+  pfr->pSlotBufs = (char *)malloc(4 * PATHNAME_SIZE);
+  if ((!pfr->piHeap) || (!pfr->pSlotBufs)) {
+    finis(RETCODE_NO_MEMORY, "Out of memory for directory access");
+  }
+  for (i=0; i<pfa->nRuns; i++) {
+    fifrun *pRun = pfa->pRuns + i;
+    pRun->pBuf = (char *)malloc(nBufSize);
+    if (!pRun->pBuf) finis(RETCODE_NO_MEMORY, "Out of memory for directory access");
+    pRun->nBufSize = nBufSize;
+    if (LoadFifRun(pfa, pRun)) pfr->piHeap[pfr->nHeap++] = i;
+  }
+  for (i = pfr->nHeap/2 - 1; i >= 0; i--) SiftFifHeap(pfr, i);
 }
 
 /******************************************************************************
 *                                                                             *
-*       Function:       FreeFifArray                                          *
+*       Function:       NextFif                                               *
 *                                                                             *
-*       Description:    Free an array of fif pointers, and the fifs too.      *
+*       Description:    Get the next record of an arena, in sorted order      *
 *                                                                             *
 *       Arguments:                                                            *
 *                                                                             *
-*         fif **pfif    Pointer to the fif array.                             *
+*         fifreader *pfr	The reader initialized by OpenFifReader().    *
 *                                                                             *
-*       Return value:   None                                                  *
+*       Return value:   The record, or NULL if there are no more.             *
 *                                                                             *
-*       Notes:                                                                *
+*       Notes:          The record remains valid until the second next call.  *
+*                       So the caller can compare it with the next one.       *
 *                                                                             *
 *       Updates:                                                              *
 *                                                                             *
 ******************************************************************************/
 
-void FreeFifArray(fif **ppfif) {
-  fif **ppf;
+fif *NextFif(fifreader *pfr) {
+  fifarena *pfa = pfr->pfa;
+  fifrun *pRun;
+  fif *pfif;
+  char *pszName;
+
+  if (!pfr->piHeap) { /* All records are in memory */
+    if (pfr->iNext >= pfa->nFifs) return NULL;
+    return pfa->pFifs + pfr->iNext++;
+  }
 
-  for (ppf=ppfif; *ppf; ppf++) {
-    free((*ppf)->name);
+  if (!pfr->nHeap) return NULL;
+  /* Copy the smallest current record, as its run buffer is about to change */
+  pRun = pfa->pRuns + pfr->piHeap[0];
+  pfif = pfr->aSlots + pfr->iSlot;
+  pszName = pfr->pSlotBufs + (pfr->iSlot * 2 * PATHNAME_SIZE);
+  pfr->iSlot ^= 1;
+  *pfif = pRun->f;
+  pfif->name = strcpy(pszName, pRun->f.name);
 #ifndef _MSDOS
-    free((*ppf)->target);
+  if (pRun->f.target) pfif->target = strcpy(pszName + PATHNAME_SIZE, pRun->f.target);
 #endif
-    free(*ppf);
-  }
-
-  free(ppfif);
+  /* Then advance that run */
+  if (!LoadFifRun(pfa, pRun)) pfr->piHeap[0] = pfr->piHeap[--(pfr->nHeap)];
+  if (pfr->nHeap) SiftFifHeap(pfr, 0);
+  return pfif;
+}
 
-  return;
+void CloseFifReader(fifreader *pfr) {
+  free(pfr->piHeap);
+  free(pfr->pSlotBufs);
+  pfr->piHeap = NULL;
+  pfr->pSlotBufs = NULL;
 }
 
 /******************************************************************************
@@ -2604,6 +4786,405 @@ void printflf(void) {
   return;
 }
 
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|	Function:	OutWrite					      |
+|                                                                             |
+|	Description:	Append data to the machine-readable output buffer     |
+|                                                                             |
+|       Arguments:                                                            |
+|                                                                             |
+|	 const void *pData	Data to output				      |
+|	 size_t n		Number of bytes				      |
+|                                                                             |
+|	Return value:	None						      |
+|                                                                             |
+|       Notes:                                                                |
+|                                                                             |
+|	The ndjson and binary formats generate one small record per file.    |
+|	Accumulate them in one large buffer, and write it with a single      |
+|	fwrite() each time it's full, instead of going through printf() for  |
+|	every field.							      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.                                     |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+#ifdef _MSDOS
+#define OUTBUFSIZE 4096
+#else
+#define OUTBUFSIZE (1024 * 1024)
+#endif
+
+static char *pOutBuf = NULL;
+static size_t nOutBuf = 0;
+
+void OutWrite(const void *pData, size_t n) {
+  if (!pOutBuf) {
+    pOutBuf = malloc(OUTBUFSIZE);
+    if (!pOutBuf) finis(RETCODE_NO_MEMORY, "Out of memory for the output buffer");
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY); /* Don't convert \n to \r\n */
+#endif
+  }
+  while (n) {
+    size_t l = OUTBUFSIZE - nOutBuf;
+    if (l > n) l = n;
+    memcpy(pOutBuf + nOutBuf, pData, l);
+    nOutBuf += l;
+    pData = (const char *)pData + l;
+    n -= l;
+    if (nOutBuf == OUTBUFSIZE) OutFlush();
+  }
+}
+
+void OutFlush(void) {
+  if (nOutBuf) {
+    fwrite(pOutBuf, 1, nOutBuf, stdout);
+    nOutBuf = 0;
+  }
+  fflush(stdout);
+}
+
+#define OutString(s) OutWrite(s, strlen(s))
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|	Function:	OutJsonString					      |
+|                                                                             |
+|	Description:	Output a quoted JSON string                           |
+|                                                                             |
+|       Arguments:                                                            |
+|                                                                             |
+|	 const char *psz	The UTF-8 string to output		      |
+|                                                                             |
+|	Return value:	None						      |
+|                                                                             |
+|	Notes:		Unix file names are any sequence of bytes, and may    |
+|			not be valid UTF-8. Invalid bytes are output as lone  |
+|			low surrogates \uDC80 to \uDCFF, like Python's	      |
+|			surrogateescape, so that the name can be recovered.   |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.                                     |
+|    2026-10-16 JFL Escape the bytes that are not valid UTF-8.		      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+/* Get the length of a valid UTF-8 multi-byte sequence, or 0 if it's invalid */
+static int Utf8SeqLen(const unsigned char *pc) {
+  unsigned int uc;
+  int n, i;
+
+  if (pc[0] < 0xC2) return 0;		/* Continuation byte, or overlong */
+  if (pc[0] < 0xE0) n = 2;
+  else if (pc[0] < 0xF0) n = 3;
+  else if (pc[0] < 0xF5) n = 4;
+  else return 0;			/* Beyond U+10FFFF */
+  uc = pc[0] & (0x7F >> n);
+  for (i=1; i<n; i++) {
+    if ((pc[i] & 0xC0) != 0x80) return 0; /* Also stops on the final NUL */
+    uc = (uc << 6) | (pc[i] & 0x3F);
+  }
+  if ((n == 3) && ((uc < 0x800) || ((uc >= 0xD800) && (uc <= 0xDFFF)))) return 0;
+  if ((n == 4) && ((uc < 0x10000) || (uc > 0x10FFFF))) return 0;
+  return n;
+}
+
+void OutJsonString(const char *psz) {
+  const char *pc0;
+  char buf[8];
+
+  OutWrite("\"", 1);
+  for (pc0 = psz; *psz; psz++) {
+    unsigned char c = (unsigned char)*psz;
+    if ((c >= 0x20) && (c < 0x80) && (c != '"') && (c != '\\')) continue;
+    if (c >= 0x80) {
+      int n = Utf8SeqLen((const unsigned char *)psz);
+      if (n) {			/* Valid UTF-8 sequence. Output it as it is. */
+	psz += n - 1;
+	continue;
+      }
+    }
+    OutWrite(pc0, psz - pc0);	/* Output the run of plain characters */
+    pc0 = psz + 1;
+    switch (c) {
+      case '"':  OutWrite("\\\"", 2); break;
+      case '\\': OutWrite("\\\\", 2); break;
+      case '\n': OutWrite("\\n", 2); break;
+      case '\r': OutWrite("\\r", 2); break;
+      case '\t': OutWrite("\\t", 2); break;
+      default:			/* Control character, or invalid UTF-8 byte */
+	sprintf(buf, "\\u%04X", (c < 0x80) ? c : (0xDC00 | c));
+	OutWrite(buf, 6);
+	break;
+    }
+  }
+  OutWrite(pc0, psz - pc0);
+  OutWrite("\"", 1);
+}
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|	Function:	FifTypeName					      |
+|                                                                             |
+|	Description:	Get the name of the type of a file		      |
+|                                                                             |
+|       Arguments:                                                            |
+|                                                                             |
+|	 fif *pfif		The file information			      |
+|                                                                             |
+|	Return value:	"dir", "file", "link", etc.			      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.                                     |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+const char *FifTypeName(fif *pfif) {
+  if (S_ISDIR(pfif->mode)) return "dir";
+  if (S_ISREG(pfif->mode)) return "file";
+#if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
+  if (S_ISLNK(pfif->mode)) return "link";
+#endif
+#if defined(S_ISBLK) && S_ISBLK(S_IFBLK) /* In DOS it's defined, but always returns 0 */
+  if (S_ISBLK(pfif->mode)) return "blk";
+#endif
+#if defined(S_ISCHR) && S_ISCHR(S_IFCHR) /* In DOS it's defined, but always returns 0 */
+  if (S_ISCHR(pfif->mode)) return "chr";
+#endif
+#if defined(S_ISFIFO) && S_ISFIFO(S_IFFIFO) /* In DOS it's defined, but always returns 0 */
+  if (S_ISFIFO(pfif->mode)) return "fifo";
+#endif
+#if defined(S_ISSOCK) && S_ISSOCK(S_IFSOCK) /* In DOS it's defined, but always returns 0 */
+  if (S_ISSOCK(pfif->mode)) return "sock";
+#endif
+  return "other";
+}
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|	Function:	OutDirRecord / OutFileRecord			      |
+|                                                                             |
+|	Description:	Output one record in the ndjson or binary format      |
+|                                                                             |
+|       Arguments:                                                            |
+|                                                                             |
+|	 fif *pLeft		The file in the first tree, or NULL	      |
+|	 fif *pRight		The file in the second tree, or NULL	      |
+|	 int difference		The comparison result, if both are present    |
+|                                                                             |
+|	Return value:	None						      |
+|                                                                             |
+|       Notes:                                                                |
+|                                                                             |
+|	ndjson: One object per line:					      |
+|	{"type":"dir","left":PATH1,"right":PATH2}			      |
+|	{"type":"file","cmp":SYMBOL,"left":{...},"right":{...}}		      |
+|	The cmp symbol is the same as in the text output. Missing sides are  |
+|	null. Each side has name, type, size, mtime, and optionally target.  |
+|                                                                             |
+|	binary: The 8-byte signature "DircBin1", then records, all integers  |
+|	in the host byte order:						      |
+|	uint32 record size (including this field)			      |
+|	uint8 record type ('D' or 'F')					      |
+|	'D': uint16 lPath1, uint16 lPath2, path1, path2 (Not NUL-terminated) |
+|	'F': int8 difference (0 if one side only), uint8 sides (1=L, 2=R),   |
+|	     then for each side present: uint64 size, int64 mtime,	      |
+|	     uint32 mode, uint16 lName, uint16 lTarget, name, target.	      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created these routines.                                   |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+static const char *CmpSymbol(int difference) {
+  switch (difference) {
+    case 0: return "=";
+    case 1: return ">";
+    case -1: return "<";
+    case 2: return "}";
+    case -2: return "{";
+    default: return "#";
+  }
+}
+
+static void OutJsonFif(fif *pfif) {
+  char buf[64];
+
+  if (!pfif) {
+    OutString("null");
+    return;
+  }
+  OutString("{\"name\":");
+  OutJsonString(pfif->name);
+  OutString(",\"type\":\"");
+  OutString(FifTypeName(pfif));
+  sprintf(buf, "\",\"size\":%" PRIuMAX ",\"mtime\":%" PRIdMAX, pfif->size, (intmax_t)(pfif->mtime));
+  OutString(buf);
+#ifndef _MSDOS
+  if (pfif->target) {
+    OutString(",\"target\":");
+    OutJsonString(pfif->target);
+  }
+#endif
+  OutWrite("}", 1);
+}
+
+#ifndef _MSDOS
+static int iBinHeaderDone = FALSE;
+
+static void OutBinHeader(void) {
+  if (!iBinHeaderDone) {
+    OutWrite("DircBin1", 8);
+    iBinHeaderDone = TRUE;
+  }
+}
+
+static size_t BinStrLen(const char *psz) { /* Lengths are stored as uint16 */
+  size_t l = psz ? strlen(psz) : 0;
+  return (l > 0xFFFF) ? 0xFFFF : l;
+}
+
+static void OutBinFif(fif *pfif) {
+  uint64_t qwSize = (uint64_t)(pfif->size);
+  int64_t qwTime = (int64_t)(pfif->mtime);
+  uint32_t dwMode = (uint32_t)(pfif->mode);
+  uint16_t wName = (uint16_t)BinStrLen(pfif->name);
+  uint16_t wTarget = (uint16_t)BinStrLen(pfif->target);
+
+  OutWrite(&qwSize, sizeof(qwSize));
+  OutWrite(&qwTime, sizeof(qwTime));
+  OutWrite(&dwMode, sizeof(dwMode));
+  OutWrite(&wName, sizeof(wName));
+  OutWrite(&wTarget, sizeof(wTarget));
+  OutWrite(pfif->name, wName);
+  if (wTarget) OutWrite(pfif->target, wTarget);
+}
+#endif /* !defined(_MSDOS) */
+
+void OutDirRecord(void) {
+#ifndef _MSDOS
+  if (iFormat == FORMAT_BINARY) {
+    uint16_t wPath1 = (uint16_t)BinStrLen(path1);
+    uint16_t wPath2 = (uint16_t)BinStrLen(path2);
+    uint32_t dwSize = 4 + 1 + 2 + 2 + wPath1 + wPath2;
+    OutBinHeader();
+    OutWrite(&dwSize, sizeof(dwSize));
+    OutWrite("D", 1);
+    OutWrite(&wPath1, sizeof(wPath1));
+    OutWrite(&wPath2, sizeof(wPath2));
+    OutWrite(path1, wPath1);
+    OutWrite(path2, wPath2);
+    return;
+  }
+#endif
+  OutString("{\"type\":\"dir\",\"left\":");
+  OutJsonString(path1);
+  OutString(",\"right\":");
+  if (path2[0]) {
+    OutJsonString(path2);
+  } else {
+    OutString("null");
+  }
+  OutString("}\n");
+}
+
+void OutFileRecord(fif *pLeft, fif *pRight, int difference) {
+#ifndef _MSDOS
+  if (iFormat == FORMAT_BINARY) {
+    uint32_t dwSize = 4 + 1 + 1 + 1;
+    signed char cDiff = (signed char)((pLeft && pRight) ? difference : 0);
+    unsigned char cSides = (unsigned char)((pLeft ? 1 : 0) | (pRight ? 2 : 0));
+    const size_t lFixed = 8 + 8 + 4 + 2 + 2;
+    if (pLeft) dwSize += (uint32_t)(lFixed + BinStrLen(pLeft->name) + BinStrLen(pLeft->target));
+    if (pRight) dwSize += (uint32_t)(lFixed + BinStrLen(pRight->name) + BinStrLen(pRight->target));
+    OutBinHeader();
+    OutWrite(&dwSize, sizeof(dwSize));
+    OutWrite("F", 1);
+    OutWrite(&cDiff, 1);
+    OutWrite(&cSides, 1);
+    if (pLeft) OutBinFif(pLeft);
+    if (pRight) OutBinFif(pRight);
+    return;
+  }
+#endif
+  OutString("{\"type\":\"file\",\"cmp\":\"");
+  OutString((pLeft && pRight) ? CmpSymbol(difference) : (pLeft ? ">" : "<"));
+  OutString("\",\"left\":");
+  OutJsonFif(pLeft);
+  OutString(",\"right\":");
+  OutJsonFif(pRight);
+  OutString("}\n");
+}
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|	Function:	BenchTime / BenchAdd / BenchReport		      |
+|                                                                             |
+|	Description:	Measure the time spent in each phase, for --bench     |
+|                                                                             |
+|       Arguments:                                                            |
+|                                                                             |
+|	 int iPhase		BENCH_SCAN, BENCH_SORT, or BENCH_COMPARE      |
+|	 double dStart		The BenchTime() at the beginning of the call  |
+|                                                                             |
+|	Return value:	BenchTime: The current time, in seconds		      |
+|                                                                             |
+|       Notes:                                                                |
+|                                                                             |
+|	With -J, lis() and trie() run in several threads at the same time,   |
+|	so their times are added up over all threads, and can be longer than |
+|	the total time.							      |
+|                                                                             |
+|	The report goes to stderr, with one line per phase, so that the      |
+|	dircbench script can parse it, whatever the output format.	      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created these routines.                                   |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+#if HAS_THREADS
+static pthread_mutex_t mBench = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+double BenchTime(void) {
+#ifdef __unix__
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+void BenchAdd(int iPhase, double dStart) {
+  double dTime = BenchTime() - dStart;
+#if HAS_THREADS
+  pthread_mutex_lock(&mBench);
+#endif
+  bs.dTime[iPhase] += dTime;
+  bs.nCalls[iPhase] += 1;
+#if HAS_THREADS
+  pthread_mutex_unlock(&mBench);
+#endif
+}
+
+void BenchReport(double dStart) {
+  fprintf(stderr, "\n%-8s %9s %9s  %s\n", "Phase", "Count", "Seconds", "Counters");
+  fprintf(stderr, "%-8s %9ld %9.3f  opendir=%ld entries=%ld stat=%ld\n", "scan",
+	  bs.nCalls[BENCH_SCAN], bs.dTime[BENCH_SCAN],
+	  bs.nCalls[BENCH_SCAN], lNEntries, lNStatCalls);
+  fprintf(stderr, "%-8s %9ld %9.3f\n", "sort",
+	  bs.nCalls[BENCH_SORT], bs.dTime[BENCH_SORT]);
+  fprintf(stderr, "%-8s %9ld %9.3f  open=%ld stat=%ld mmap=%ld read=%ld\n", "compare",
+	  bs.nCalls[BENCH_COMPARE], bs.dTime[BENCH_COMPARE],
+	  bs.nOpens, bs.nStats, bs.nMaps, bs.nReads);
+  fprintf(stderr, "%-8s %9s %9.3f\n", "total", "", BenchTime() - dStart);
+}
+
 /*---------------------------------------------------------------------------*\
 *                                                                             *
 |   Function:	    GetPsp						      |
@@ -62,13 +62,37 @@
 *		    Version 3.3.					      *
 *    2018-05-31 JFL Changed #if DIRENT2STAT_DEFINED to _DIRENT2STAT_DEFINED.  *
 *		    Version 3.3.1.					      *
+*    2026-10-16 JFL Added option -j [N] to scan subdirectories in parallel in *
+*		    Unix, using N worker threads.			      *
+*		    Version 3.4.					      *
+*    2026-10-16 JFL ScanFiles() now calls lstat() only once per file, and     *
+*		    only for files matching the pattern. Removed scandirX().  *
+*		    Version 3.4.1.					      *
+*    2026-10-16 JFL Added option -a to display the allocated sizes too.       *
+*		    Use statx() in Linux, requesting only the fields needed.  *
+*		    Version 3.5.					      *
+*    2026-10-16 JFL Added option -l to count hard-linked files only once.     *
+*		    Version 3.6.					      *
+*    2026-10-16 JFL Added option --index FILE to reuse the sizes of the       *
+*		    directories that did not change since the previous run.   *
+*		    Version 3.7.					      *
+*    2026-10-16 JFL Added option --top N to list only the N largest dirs      *
+*		    and files, and option --hist for a file sizes histogram.  *
+*		    Version 3.8.					      *
+*    2026-10-16 JFL Added option --uring to get the files information in      *
+*		    batches of io_uring statx requests in Linux.	      *
+*		    Factored out the files selection into AddFile().	      *
+*		    Version 3.9.					      *
+*    2026-10-16 JFL Keep the current directory pathname in a path stack,      *
+*		    instead of calling getcwd() for every directory.	      *
+*		    Version 3.9.1.					      *
 *		    							      *
 *         © Copyright 2016 Hewlett Packard Enterprise Development LP          *
 * Licensed under the Apache 2.0 license - www.apache.org/licenses/LICENSE-2.0 *
 \*****************************************************************************/
 
-#define PROGRAM_VERSION "3.3.1"
-#define PROGRAM_DATE    "2018-05-31"
+#define PROGRAM_VERSION "3.9.1"
+#define PROGRAM_DATE    "2026-10-16"
 
 #define _CRT_SECURE_NO_WARNINGS /* Prevent warnings about using sprintf and sscanf */
 /* #define __USE_BSD	    */	/* Use BSD extensions (DT_xxx types in dirent.h) */
@@ -156,6 +180,31 @@ DEBUG_GLOBALS	/* Define global variables used by debugging macros. (Necessary fo
 
 #define CDECL				/* No such thing needed for Linux builds */
 
+#define HAS_THREADS TRUE		/* Scan subdirectories in parallel with option -j */
+#include <pthread.h>
+#include <fcntl.h>			/* For openat() */
+
+#define CURDIR_FD AT_FDCWD		/* Directory fd for the current directory */
+
+#define HAS_HARDLINKS TRUE		/* Count hard-linked files once with option -l */
+
+#define HAS_INDEX TRUE			/* Cache directories sizes with option --index */
+#include <sys/mman.h>			/* For mmap() */
+
+#if defined(STATX_BLOCKS)		/* glibc >= 2.28 declares statx() in sys/stat.h */
+#define HAS_STATX TRUE			/* Get just the file information needed */
+#endif
+
+#if defined(__linux__) && defined(__has_include) && HAS_STATX
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_FAST_POLL)	/* Linux >= 5.7 headers, with IORING_OP_STATX */
+#define HAS_URING TRUE			/* Batch statx() calls with option --uring */
+#include <sys/syscall.h>		/* For the io_uring system calls */
+#endif
+#endif
+#endif
+
 #endif /* defined(__unix__) */
 
 /*********************************** Other ***********************************/
@@ -164,6 +213,36 @@ DEBUG_GLOBALS	/* Define global variables used by debugging macros. (Necessary fo
 #error "Unidentified OS. Please define OS-specific settings for it."
 #endif
 
+#ifndef HAS_THREADS
+#define HAS_THREADS FALSE
+#endif
+
+#ifndef HAS_STATX
+#define HAS_STATX FALSE
+#endif
+
+#ifndef HAS_HARDLINKS
+#define HAS_HARDLINKS FALSE
+#endif
+
+#ifndef HAS_URING
+#define HAS_URING FALSE
+#endif
+
+#ifndef HAS_INDEX
+#define HAS_INDEX FALSE
+#endif
+
+#if HAS_INDEX
+#define USE_INDEX (pszIndex != NULL)
+#else
+#define USE_INDEX FALSE
+#endif
+
+#ifndef CURDIR_FD
+#define CURDIR_FD 0			/* Directory fds are not used */
+#endif
+
 /********************** End of OS-specific definitions ***********************/
 
 /* Local definitions */
@@ -214,6 +293,66 @@ typedef struct _selectOpts {	/* Options for selecting files */
   time_t datemax;		    /* Maximum timestamp. 0 = no maximum */
 } selectOpts;
 
+typedef struct _sizeTotals {	/* Sizes added up for a set of files */
+  total_t size;			    /* Apparent size, from st_size */
+  total_t alloc;		    /* Allocated size on disk */
+} sizeTotals;
+
+#define ADD_SIZES(to, from) do {(to).size += (from).size; (to).alloc += (from).alloc;} while (0)
+
+typedef struct _fileInfo {	/* The information needed about a file */
+  unsigned int mode;		    /* File type. Only valid if WANT_TYPE */
+  time_t mtime;			    /* Modification time. Only valid if WANT_TIME */
+  sizeTotals sizes;		    /* Apparent and allocated sizes */
+#if HAS_HARDLINKS
+  uint64_t dev;			    /* Device ID. Only valid if WANT_LINKS */
+  uint64_t ino;			    /* Inode number. Only valid if WANT_LINKS */
+  unsigned long nlink;		    /* Number of links. Only valid if WANT_LINKS */
+#endif
+} fileInfo;
+
+#define WANT_TYPE 1		/* GetFileInfo() flags */
+#define WANT_TIME 2
+#define WANT_LINKS 4
+
+#if HAS_HARDLINKS
+typedef struct _inodeKey {	/* An inode unique ID. 16 bytes. */
+  uint64_t dev;			    /* Device ID */
+  uint64_t ino;			    /* Inode number. 0=Empty slot. */
+} inodeKey;
+
+typedef struct _inodeSet {	/* An open-addressing hash set of inodes */
+  inodeKey *pKeys;		    /* Array of nSlots keys */
+  size_t nSlots;		    /* Number of slots. A power of 2. */
+  size_t nUsed;			    /* Number of slots used */
+} inodeSet;
+
+typedef struct _linkRec {	/* A file with multiple links */
+  uint64_t dev;			    /* Device ID */
+  uint64_t ino;			    /* Inode number */
+  sizeTotals sizes;		    /* Its sizes, as added in the job totals */
+  char *pszPath;		    /* Its pathname if needed for --top, else NULL */
+} linkRec;
+#endif
+
+typedef struct _topEntry {	/* A directory or file in a top-N list */
+  sizeTotals sizes;		    /* Its sizes */
+  char *path;			    /* Its pathname */
+} topEntry;
+
+typedef struct _topHeap {	/* A min-heap of the N largest entries seen */
+  topEntry *pEntries;		    /* Array of nMax entries. [0]=Smallest. */
+  int n;			    /* Number of entries used */
+  int nMax;			    /* Maximum number of entries */
+} topHeap;
+
+#define HIST_BUCKETS 65		/* 0, then 1 bucket per power of 2 up to 2^64 */
+
+typedef struct _sizeHist {	/* Histogram of file sizes */
+  long nFiles[HIST_BUCKETS];	    /* Number of files with sizes in [2^(i-1), 2^i) */
+  total_t size[HIST_BUCKETS];	    /* Total size of the same */
+} sizeHist;
+
 typedef struct _scanOpts {	/* Options for scanning the directory tree */
   int recur;			    /* If TRUE, list subdirectories recursively */
   int total;			    /* If TRUE, totalize size of all subdirs */
@@ -221,6 +360,57 @@ typedef struct _scanOpts {	/* Options for scanning the directory tree */
   int depth;			    /* Current depth in the scan tree */
 } scanOpts;
 
+typedef struct _pathStack {	/* A growable pathname */
+  char *psz;			    /* The pathname. NUL-terminated. */
+  size_t len;			    /* Its length */
+  size_t nAlloc;		    /* Size of the psz buffer */
+} pathStack;
+
+typedef struct _fileAcc {	/* Accumulators for the files selected in a dir */
+  selectOpts *pC;		    /* File selection constraints */
+  sizeTotals size;		    /* Total sizes of the files selected */
+  long nFiles;			    /* Number of files selected */
+  sizeHist *pHist;		    /* Where to count them for --hist */
+  topHeap *pTop;		    /* Where to add them for --top */
+  char *(*pfnDir)(struct _fileAcc *pAcc); /* Get a malloc'ed dir pathname */
+  void *pRef;			    /* Reference data for pfnDir */
+  char *pszDir;			    /* The dir pathname, once needed for --top */
+#if HAS_HARDLINKS
+  int bDeferLinks;		    /* If TRUE, record files with multiple links */
+  total_t linksTopMin;		    /* Smaller links can't be in --top. 0=Unknown. */
+  linkRec *pLinks;		    /* The files with multiple links recorded */
+  int nLinks;			    /* Number of entries in the above array */
+  int nLinksAlloc;		    /* Number of entries allocated */
+#endif
+} fileAcc;
+
+#if HAS_URING
+#define STAT_BATCH 256		/* Number of statx requests submitted at once */
+
+typedef struct _statBatch {	/* An io_uring, and a batch of statx requests */
+  int fd;			    /* The io_uring file descriptor */
+  void *pSqRing;		    /* Submission queue ring mapping */
+  size_t sqRingSize;		    /* Its size */
+  void *pCqRing;		    /* Completion queue ring mapping. Maybe the same. */
+  size_t cqRingSize;		    /* Its size */
+  struct io_uring_sqe *pSqes;	    /* Submission queue entries mapping */
+  size_t sqesSize;		    /* Its size */
+  unsigned *puSqTail;		    /* Submission queue ring fields */
+  unsigned *puSqMask;
+  unsigned *puSqArray;
+  unsigned *puCqHead;		    /* Completion queue ring fields */
+  unsigned *puCqTail;
+  unsigned *puCqMask;
+  struct io_uring_cqe *pCqes;
+  int iDirFd;			    /* Directory of the names queued */
+  unsigned int uMask;		    /* statx() mask for them */
+  int n;			    /* Number of requests queued */
+  int res[STAT_BATCH];		    /* Results. 0=Success, else -errno */
+  struct statx stx[STAT_BATCH];	    /* The files information */
+  char names[STAT_BATCH][NODENAME_SIZE]; /* The file names */
+} statBatch;
+#endif
+
 /* Global variables */
 
 char init_dir[PATHNAME_SIZE];       /* Initial directory */
@@ -232,6 +422,31 @@ int iQuiet = FALSE;		    /* If TRUE, only display major errors */
 int iVerbose = FALSE;		    /* If TRUE, display additional information */
 int iHuman = TRUE;		    /* If TRUE, display human-friendly values with a comma every 3 digits */
 char *pszUnit = "B";		    /* "B"=bytes; "KB"=Kilo-Bytes; "MB"; GB" */
+int iAlloc = FALSE;		    /* If TRUE, display the allocated sizes too */
+long lAllocUnit = 0;		    /* Allocation unit, if there's no st_blocks */
+#if HAS_STATX
+int iStatx = TRUE;		    /* FALSE if the kernel does not support statx() */
+#endif
+#if HAS_URING
+int iUring = FALSE;		    /* If TRUE, batch statx() calls in an io_uring */
+statBatch *pStatBatch = NULL;	    /* The batch used by ScanFiles() */
+#endif
+#if HAS_THREADS
+int iJobs = 0;			    /* If > 1, number of threads scanning subdirs */
+#endif
+#if HAS_HARDLINKS
+int iLinks = FALSE;		    /* If TRUE, count hard-linked files only once */
+inodeSet linksSeen = {0};	    /* Inodes with multiple links already counted */
+#endif
+#if HAS_INDEX
+char *pszIndex = NULL;		    /* Directory sizes index file name */
+#endif
+int iTop = 0;			    /* If > 0, report only the N largest dirs and files */
+topHeap topDirs = {0};		    /* The largest directories */
+topHeap topFiles = {0};		    /* The largest files */
+int iHist = FALSE;		    /* If TRUE, display a histogram of file sizes */
+sizeHist hist = {{0}};		    /* The file sizes histogram */
+pathStack curDir = {0};		    /* Current dir pathname, in ScanFiles() and ScanDirs() */
 
 /* Function prototypes */
 
@@ -242,14 +457,36 @@ int parse_date(char *token, time_t *pdate); /* Convert the argument to a time_t
 int Size2String(char *pBuf, total_t ll); /* Convert size to a decimal, with a comma every 3 digits */
 int Size2StringWithUnit(char *pBuf, total_t llSize); /* Idem, appending the user-specified unit */
 
-total_t ScanFiles(scanOpts *pOpts, void *pConstraints); /* Scan the current dir */
-total_t ScanDirs(scanOpts *pOpts, void *pConstraints);  /* Scan every subdir */
-void affiche(char *path, total_t size);/* Display sorted list */
-int scandirX(const char *pszName,
-	     struct dirent ***resultList,
-	     int (*cbSelect) (const struct dirent *, void *pRef),
-	     int (CDECL *cbCompare) (const struct dirent **, const struct dirent **),
-	     void *pRef);	    /* scandir() extension, passing a pRef to cbSelect() */
+int GetFileInfo(int iDirFd, struct dirent *pDE, int iWant, fileInfo *pfi);
+int TopWants(topHeap *pHeap, total_t size); /* TRUE if the size may enter the heap */
+void TopAdd(topHeap *pHeap, sizeTotals *pSizes, char *pszPath); /* Add if large enough */
+void TopReport(char *pszTitle, topHeap *pHeap); /* Display the heap, and free it */
+void HistAdd(sizeHist *pHist, total_t size); /* Count a file in the histogram */
+void HistReport(sizeHist *pHist);   /* Display the histogram */
+char *JoinPath(char *pBuf, char *pszDir, char *pszName); /* Build a file pathname */
+void PathInit(pathStack *pPath);    /* Set it to the current directory */
+size_t PathPush(pathStack *pPath, char *pszName); /* Append a name. Return the old length */
+void PathPop(pathStack *pPath, size_t len); /* Truncate back to that length */
+void InitFileAcc(fileAcc *pAcc, selectOpts *pC, sizeHist *pHist, topHeap *pTop,
+		 char *(*pfnDir)(fileAcc *pAcc), void *pRef);
+void AddFile(fileAcc *pAcc, fileInfo *pfi, char *pszName); /* Select and add up a file */
+#if HAS_URING
+statBatch *StatBatchOpen(void);	    /* Create an io_uring. NULL if unavailable */
+void StatBatchClose(statBatch *pB);
+void StatBatchAdd(statBatch *pB, fileAcc *pAcc, int iDirFd, int iWant, char *pszName);
+void StatBatchRun(statBatch *pB, fileAcc *pAcc); /* Get the info, and AddFile() */
+#endif
+#if HAS_HARDLINKS
+int InodeSetAdd(inodeSet *pSet, uint64_t dev, uint64_t ino); /* TRUE if not seen yet */
+void InodeSetFree(inodeSet *pSet);
+#endif
+sizeTotals ScanFiles(scanOpts *pOpts, void *pConstraints); /* Scan the current dir */
+sizeTotals ScanDirs(scanOpts *pOpts, void *pConstraints);  /* Scan every subdir */
+void affiche(char *path, sizeTotals *pSizes); /* Display the sizes of a directory */
+int Sizes2String(char *pBuf, sizeTotals *pSizes); /* Convert sizes to a string */
+#if HAS_THREADS
+int pScanTree(scanOpts *pOpts, selectOpts *pC, sizeTotals *pSizes); /* Idem with threads */
+#endif
 
 long GetClusterSize(char drive);    /* Get cluster size */
 
@@ -278,7 +515,7 @@ int main(int argc, char *argv[]) {
   int iUseCsz = FALSE;		/* If TRUE, use the cluster size */
   int err;
   char *pc;
-  total_t size;			/* Total size */
+  sizeTotals size;		/* Total sizes */
 
   /* Parse command line arguments */
   for (i=1; i<argc; i++) {
@@ -289,6 +526,10 @@ int main(int argc, char *argv[]) {
 #endif
        ) { /* It's a switch */
       char *opt = arg+1;
+      if (streq(opt, "a")) {
+	iAlloc = TRUE;	/* Display the allocated size too */
+	continue;
+      }
       if (streq(opt, "b")) {
 	band = TRUE;
 	continue;
@@ -329,6 +570,10 @@ int main(int argc, char *argv[]) {
 	pszUnit = "GB";
 	continue;
       }
+      if (streq(opt, "hist") || streq(opt, "-hist")) {
+	iHist = TRUE;	/* Display a histogram of file sizes */
+	continue;
+      }
       if (streq(opt, "H")) {
 	iHuman = FALSE;
 	continue;
@@ -341,6 +586,43 @@ int main(int argc, char *argv[]) {
 	iContinue = FALSE;
 	continue;
       }
+#if HAS_HARDLINKS
+      if (streq(opt, "l")) {	/* Count hard-linked files only once */
+	iLinks = TRUE;
+	continue;
+      }
+#endif
+#if HAS_INDEX
+      if (   (streq(opt, "index") || streq(opt, "-index"))
+	  && ((i+1) < argc)) {	/* Directory sizes index file */
+	pszIndex = argv[++i];
+	if (pszIndex[0] != DIRSEPARATOR_CHAR) { /* Make it absolute, before main() changes dir. */
+	  char *pszAbs = (char *)malloc(PATHNAME_SIZE);
+	  if (!pszAbs) finis(RETCODE_NO_MEMORY, "Out of memory");
+	  if (!getcwd(init_dir, PATHNAME_SIZE)) {
+	    finis(RETCODE_INACCESSIBLE, "Cannot get the current directory");
+	  }
+	  pszIndex = JoinPath(pszAbs, init_dir, pszIndex);
+	}
+	continue;
+      }
+#endif
+#if HAS_THREADS
+      if (streq(opt, "j")) {	/* Number of threads for scanning subdirs */
+	iJobs = 0;		/* Default: One per processor */
+	if (((i+1) < argc) && (argv[i+1][0] != '-')) {
+	  char *pc2;
+	  long l = strtol(argv[i+1], &pc2, 10);
+	  if (!*pc2) { /* It's a valid number */
+	    iJobs = (int)l;
+	    i += 1;
+	  }
+	}
+	if (iJobs <= 0) iJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (iJobs <= 0) iJobs = 1;
+	continue;
+      }
+#endif
       if (streq(opt, "k")) {
 	pszUnit = "KB";
 	continue;
@@ -363,6 +645,17 @@ int main(int argc, char *argv[]) {
 	sOpts.total = TRUE;
 	continue;
       }
+      if (   (streq(opt, "top") || streq(opt, "-top"))
+	  && ((i+1) < argc)) {	/* Report only the N largest dirs and files */
+	iTop = atoi(argv[++i]);
+	if (iTop <= 0) {
+	  fprintf(stderr, "Error: Invalid number: --top %s\n", argv[i]);
+	  iTop = 0;
+	  continue;
+	}
+	sOpts.recur = TRUE;	/* We need the sizes of all subdirectories */
+	continue;
+      }
       if (streq(opt, "to")) {
 	datemaxarg = argv[++i];
 	if (!parse_date(datemaxarg, &fConstraints.datemax)) {
@@ -371,6 +664,12 @@ int main(int argc, char *argv[]) {
 	}
 	continue;
       }
+#if HAS_URING
+      if (streq(opt, "uring") || streq(opt, "-uring")) { /* Batch statx() calls */
+	iUring = TRUE;
+	continue;
+      }
+#endif
       if (streq(opt, "v")) {
 	iVerbose = TRUE;
 	continue;
@@ -473,6 +772,7 @@ int main(int argc, char *argv[]) {
       finis(RETCODE_INACCESSIBLE, "Cannot access directory %s", from);
     }
   }
+  PathInit(&curDir);	/* Canonic name of the target directory */
 
   /* Check the cluster size on the target drive (and directory for Linux) */
   if (iUseCsz) {
@@ -481,18 +781,60 @@ int main(int argc, char *argv[]) {
     }
     if (iVerbose) printf("The cluster size is %ld bytes.\n\n", csz);
   }
+#ifndef __unix__
+  if (iAlloc) { /* There's no st_blocks. Round sizes to the cluster size. */
+    lAllocUnit = csz ? csz : GetClusterSize(0);
+  }
+#endif
+
+#if HAS_INDEX && HAS_HARDLINKS
+  if (pszIndex && iLinks) {
+    finis(RETCODE_INACCESSIBLE, "Options --index and -l cannot be used together");
+  }
+#endif
+#if HAS_INDEX
+  if (pszIndex && (iTop || iHist)) { /* The index has no information about files */
+    finis(RETCODE_INACCESSIBLE, "Option --index cannot be used with --top or --hist");
+  }
+#endif
+  topDirs.nMax = topFiles.nMax = iTop;
+#if HAS_URING
+  if (iUring) { /* Check that the kernel supports it */
+    pStatBatch = StatBatchOpen();
+    if (!pStatBatch) {
+      if (iVerbose) fprintf(stderr, "io_uring statx is not available. Using statx() instead.\n");
+      iUring = FALSE;
+    }
+  }
+#endif
 
   /* Compute the files sizes */
+#if HAS_THREADS
+  if (   ((iJobs > 1) || USE_INDEX)
+      && (sOpts.recur || sOpts.total || sOpts.subdirs)
+      && pScanTree(&sOpts, &fConstraints, &size)) {
+    /* Done in parallel */
+  } else
+#endif
   if (!sOpts.subdirs) {
     size = ScanFiles(&sOpts, &fConstraints);
-    if (!sOpts.recur) {
-      char szBuf[40];
-      Size2StringWithUnit(szBuf, size);
-      printf("%s\n", szBuf);
-    }
   } else {
     size = ScanDirs(&sOpts, &fConstraints);
   }
+  if (!sOpts.subdirs && !sOpts.recur) {
+    char szBuf[80];
+    Sizes2String(szBuf, &size);
+    printf("%s\n", szBuf);
+  }
+  if (iTop) {
+    TopReport("Largest directories", &topDirs);
+    printf("\n");
+    TopReport("Largest files", &topFiles);
+  }
+  if (iHist) {
+    if (iTop) printf("\n");
+    HistReport(&hist);
+  }
 
   /* Restores the initial drive and directory and exit */
   finis(RETCODE_SUCCESS);
@@ -531,6 +873,7 @@ Display the total size used by the target directory.\n\
 \n\
 Switches:\n\
   -?          Display this help message and exit.\n\
+  -a          Display the allocated size too, after the apparent size.\n\
   -b	      Skip a line every 5 lines, to improve readability.\n\
   -c	      Use the actual cluster size to compute the total size.\n\
   -c size     Use the specified cluster size to compute the total size.\n\
@@ -543,14 +886,37 @@ Switches:\n\
   -from Y-M-D List only files starting from that date.\n\
   -g	      Display sizes in Giga bytes.\n\
   -H	      Display sizes without the human-friendly commas.\n\
+  --hist      Display a histogram of the file sizes, by powers of 2.\n\
   -i	      Ignore directory access errors.\n\
-  -I	      Stop in case of directory access error. (Default)\n\
-  -k	      Display sizes in Kilo bytes.\n\
+  -I	      Stop in case of directory access error. (Default)\n"
+#if HAS_INDEX
+"\
+  --index FILE Reuse the sizes of unchanged directories cached in FILE, then\n\
+              update FILE. Only directories changes are detected, not files\n\
+              changed in place. Use a different FILE for every TARGET.\n"
+#endif
+#if HAS_THREADS
+"\
+  -j [N]      Scan subdirectories with N threads. Default: 1 per processor.\n"
+#endif
+"\
+  -k	      Display sizes in Kilo bytes.\n"
+#if HAS_HARDLINKS
+"\
+  -l          Count hard-linked files only once.\n"
+#endif
+"\
   -m	      Display sizes in Mega bytes.\n\
   -q          Quiet mode: Do not display minor errors.\n\
   -r|-s	      Display the sizes of all subdirectories too.\n\
   -t	      Count the total size of all files plus that of all subdirs.\n\
   -to Y-M-D   List only files up to that date.\n\
+  --top N     List only the N largest directories, then the N largest files.\n"
+#if HAS_URING
+"\
+  --uring     Get the files information in batches, with Linux io_uring.\n"
+#endif
+"\
   -v          Display verbose information.\n\
   -V          Display this program version and exit.\n\
 \n\
@@ -615,235 +981,1928 @@ void finis(int retcode, ...) {
   exit(retcode);
 }
 
+#if HAS_STATX
+/* Get the statx() mask for the fields GetFileInfo() must return */
+static unsigned int StatxMask(int iWant) {
+  unsigned int uMask = STATX_SIZE;
+
+  if (iWant & WANT_TYPE) uMask |= STATX_TYPE;
+  if (iWant & WANT_TIME) uMask |= STATX_MTIME;
+  if (iWant & WANT_LINKS) uMask |= STATX_NLINK | STATX_INO;
+  if (iAlloc) uMask |= STATX_BLOCKS;
+  return uMask;
+}
+
+/* Copy the statx() results into a fileInfo structure */
+static void Statx2FileInfo(struct statx *psx, fileInfo *pfi) {
+  pfi->mode = psx->stx_mode;
+  pfi->mtime = (time_t)psx->stx_mtime.tv_sec;
+  pfi->sizes.size = (total_t)psx->stx_size;
+  pfi->dev = ((uint64_t)psx->stx_dev_major << 32) | psx->stx_dev_minor;
+  pfi->ino = psx->stx_ino;
+  pfi->nlink = psx->stx_nlink;
+  if (psx->stx_mask & STATX_BLOCKS) {
+    pfi->sizes.alloc = (total_t)psx->stx_blocks * 512;
+  } else { /* Some file systems don't report it */
+    pfi->sizes.alloc = (total_t)psx->stx_size;
+  }
+}
+#endif
+
 /******************************************************************************
 *                                                                             *
-*       Function:       ScanFiles                                             *
+*       Function:       GetFileInfo                                           *
 *                                                                             *
-*       Description:    Scan the current directory, and add-up file sizes     *
+*       Description:    Get the size, and optionally the type and time, of a  *
+*                       directory entry                                       *
 *                                                                             *
 *       Arguments:                                                            *
-*         void *pConstraints	File selection constraints                    *
+*         int iDirFd		Directory descriptor. CURDIR_FD=Current dir.  *
+*         struct dirent *pDE	The directory entry                           *
+*         int iWant		WANT_TYPE | WANT_TIME | WANT_LINKS | 0        *
+*         fileInfo *pfi		Where to store the results                    *
 *                                                                             *
-*       Return value:   Total size of all files                               *
+*       Return value:   0=Success; -1=Failure, with errno set                 *
 *                                                                             *
-*       Notes:                                                                *
+*       Notes:          Linux statx() only fetches the fields requested, which*
+*                       saves work in network and FUSE file systems.          *
+*                       The allocated size is computed from the blocks count. *
+*                       The systems that have no such count estimate it by    *
+*                       rounding the size to the next cluster.                *
 *                                                                             *
 *       History:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
 *                                                                             *
 ******************************************************************************/
 
-int SelectFilesCB(const struct dirent *pDE, void *p) {
-  selectOpts *pC = p;
+int GetFileInfo(int iDirFd, struct dirent *pDE, int iWant, fileInfo *pfi) {
   struct stat sStat;
   int iErr;
+#ifndef __unix__
+  uintmax_t alloc;
+#endif
+
+#if HAS_STATX
+  if (iStatx) {
+    struct statx sx;
 
-  if (pDE->d_type != DT_REG) return FALSE;	/* We want only files */
+    iErr = statx(iDirFd, pDE->d_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, StatxMask(iWant), &sx);
+    if (!iErr) {
+      Statx2FileInfo(&sx, pfi);
+      return 0;
+    }
+    if (errno != ENOSYS) return iErr;
+    DEBUG_PRINTF(("// statx() is not supported. Falling back to fstatat().\n"));
+    iStatx = FALSE; /* Kernel < 4.11. Don't try again. */
+  }
+#endif
 
 #if _DIRENT2STAT_DEFINED /* DOS/Windows return stat info in the dirent structure */
   iErr = dirent2stat(pDE, &sStat);
-#else /* Unix has to query it separately */
+#elif defined(__unix__) /* Unix has to query it separately */
+  iErr = fstatat(iDirFd, pDE->d_name, &sStat, AT_SYMLINK_NOFOLLOW);
+#else
   iErr = lstat(pDE->d_name, &sStat);
 #endif
-  if (iErr) return FALSE;	/* Ignore suspect entries */
-
-  /* Skip files outside date range */
-  if (pC->datemin && (sStat.st_mtime < pC->datemin)) return FALSE;
-  if (pC->datemax && (sStat.st_mtime > pC->datemax)) return FALSE;
-
-  /* Skip files which don't match the wildcard pattern */
-  if (pC->pattern) {
-    if (fnmatch(pC->pattern, pDE->d_name, FNM_CASEFOLD) == FNM_NOMATCH) {
-      return FALSE;
-    }
+  if (iErr) return iErr;
+  pfi->mode = sStat.st_mode;
+  pfi->mtime = sStat.st_mtime;
+  pfi->sizes.size = (total_t)sStat.st_size;
+#if HAS_HARDLINKS
+  pfi->dev = (uint64_t)sStat.st_dev;
+  pfi->ino = (uint64_t)sStat.st_ino;
+  pfi->nlink = (unsigned long)sStat.st_nlink;
+#endif
+#ifdef __unix__
+  pfi->sizes.alloc = (total_t)sStat.st_blocks * 512;
+#else
+  alloc = sStat.st_size;
+  if (lAllocUnit) {	/* Round it to the next cluster multiple */
+    alloc += lAllocUnit-1;
+    alloc -= alloc % lAllocUnit;
   }
+  pfi->sizes.alloc = (total_t)alloc;
+#endif
+  return 0;
+}
 
-  /* OK, all criteria pass. */
-  return TRUE;
+/* Get the GetFileInfo() flags needed for selecting files */
+static int FileInfoWanted(selectOpts *pC) {
+  int iWant = (pC->datemin || pC->datemax) ? WANT_TIME : 0;
+
+#if HAS_HARDLINKS
+  if (iLinks) iWant |= WANT_LINKS;
+#endif
+  return iWant;
 }
 
-total_t ScanFiles(scanOpts *pOpts, void *pConstraints) {
-  total_t size = 0;
-  total_t dSize;
-  NEW_PATHNAME_BUF(szCurDir);
-  struct dirent *pDE;
-  struct dirent **ppDE;
-  struct dirent **pDElist;
-  int nDE;
-  uintmax_t fsize;
-  struct stat sStat;
-  int iErr;
+/******************************************************************************
+*                                                                             *
+*       Function:       InodeSetAdd                                           *
+*                                                                             *
+*       Description:    Add an inode to a set, if it's not there already      *
+*                                                                             *
+*       Arguments:                                                            *
+*         inodeSet *pSet	The set. Initially all 0.                     *
+*         uint64_t dev		Device ID                                     *
+*         uint64_t ino		Inode number                                  *
+*                                                                             *
+*       Return value:   TRUE if added; FALSE if it was there already          *
+*                                                                             *
+*       Notes:          Open addressing with linear probing, in a flat array  *
+*                       of 16-byte keys, so that a lookup usually touches a   *
+*                       single cache line. The array is doubled when it gets  *
+*                       3/4 full. Only files with multiple links are stored,  *
+*                       so most trees never store anything.                   *
+*                                                                             *
+*                       Inode 0 marks empty slots. No real file uses it.      *
+*                                                                             *
+*                       Not thread-safe. pScanTree() only calls it from the   *
+*                       main thread.                                          *
+*                                                                             *
+*       History:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
+*                                                                             *
+******************************************************************************/
 
-  DEBUG_ENTER(("ScanFiles(%p);\n", pConstraints));
+#if HAS_HARDLINKS
 
-#if PATHNAME_BUFS_IN_HEAP
-  if (!szCurDir) {
-    finis(RETCODE_NO_MEMORY, "Out of memory");
-  }
-#endif
+#define INODE_SET_MIN_SLOTS 4096
 
-  /* Scan all files */
-  nDE = scandirX(".", &pDElist, SelectFilesCB, NULL, pConstraints);
-  if (nDE < 0) {
-    finis(RETCODE_NO_MEMORY, "Out of directory handles");
-  }
-  for (ppDE = pDElist; nDE--; ppDE++) {
-    pDE = *ppDE;
-    memset(&sStat, 0, sizeof(sStat));
+static size_t InodeHash(uint64_t dev, uint64_t ino) {
+  uint64_t h = ino ^ (dev * 0x9E3779B97F4A7C15ULL);
+  h ^= h >> 33;		/* MurmurHash3 64-bit finalizer */
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return (size_t)h;
+}
 
-#if _DIRENT2STAT_DEFINED /* DOS/Windows return stat info in the dirent structure */
-    iErr = dirent2stat(pDE, &sStat);
-#else /* Unix has to query it separately */
-    iErr = lstat(pDE->d_name, &sStat);
-#endif
-    if (iErr) continue;
-    DEBUG_PRINTF(("// Counting %10"PRIuMAX" bytes for %-32s\n", (uintmax_t)(sStat.st_size), pDE->d_name));
-    fsize = sStat.st_size; /* Get the actual file size */
-    if (csz) {	/* If the cluster size is provided */
-		/* Round it to the next cluster multiple */
-      fsize += csz-1;
-      fsize -= fsize % csz;
+static void InodeSetGrow(inodeSet *pSet) {
+  size_t nSlots = pSet->nSlots ? 2 * pSet->nSlots : INODE_SET_MIN_SLOTS;
+  inodeKey *pKeys = (inodeKey *)calloc(nSlots, sizeof(inodeKey));
+  size_t i;
+
+  if (!pKeys) finis(RETCODE_NO_MEMORY, "Out of memory for the hard links table");
+  for (i=0; i<pSet->nSlots; i++) { /* Rehash the existing keys */
+    inodeKey *pKey = pSet->pKeys + i;
+    if (pKey->ino) {
+      size_t j = InodeHash(pKey->dev, pKey->ino) & (nSlots - 1);
+      while (pKeys[j].ino) j = (j + 1) & (nSlots - 1);
+      pKeys[j] = *pKey;
     }
-    size += fsize;  /* Totalize sizes */
-
-    free(pDE);
   }
-  free(pDElist);
+  free(pSet->pKeys);
+  pSet->pKeys = pKeys;
+  pSet->nSlots = nSlots;
+  DEBUG_PRINTF(("// Resized the hard links table to %lu slots.\n", (unsigned long)nSlots));
+}
 
-  /* Optionally scan all subdirectories */
-  if (pOpts->recur || pOpts->total) {
-    pOpts->depth += 1;
-    dSize = ScanDirs(pOpts, pConstraints);
-    pOpts->depth -= 1;
-    if (pOpts->total) size += dSize;  /* Totalize sizes */
-    if (pOpts->recur) {
-      char *pcd = getcwd(szCurDir, PATHNAME_SIZE); /* Canonic name of the target directory */
-      if (!pcd) {
-	finis(RETCODE_INACCESSIBLE, "Cannot get the current directory. %s", strerror(errno));
-      }
-      TRIM_PATHNAME_BUF(szCurDir);
-      affiche(szCurDir, size);
-    }
+int InodeSetAdd(inodeSet *pSet, uint64_t dev, uint64_t ino) {
+  size_t i;
+
+  if (!ino) return TRUE; /* Can't be stored. Assume it's not a duplicate. */
+  if ((pSet->nUsed + 1) > (pSet->nSlots - pSet->nSlots / 4)) InodeSetGrow(pSet);
+  for (i = InodeHash(dev, ino) & (pSet->nSlots - 1); pSet->pKeys[i].ino; i = (i + 1) & (pSet->nSlots - 1)) {
+    if ((pSet->pKeys[i].ino == ino) && (pSet->pKeys[i].dev == dev)) return FALSE;
   }
+  pSet->pKeys[i].dev = dev;
+  pSet->pKeys[i].ino = ino;
+  pSet->nUsed += 1;
+  return TRUE;
+}
 
-  FREE_PATHNAME_BUF(szCurDir);
-  DEBUG_LEAVE(("return %" TOTAL_FMT ";\n", size));
-  return size;
+void InodeSetFree(inodeSet *pSet) {
+  free(pSet->pKeys);
+  pSet->pKeys = NULL;
+  pSet->nSlots = pSet->nUsed = 0;
 }
 
+#endif /* HAS_HARDLINKS */
+
 /******************************************************************************
 *                                                                             *
-*       Function:       ScanDirs                                              *
+*       Function:       TopAdd                                                *
 *                                                                             *
-*       Description:    Scan subdirectories, and add-up file sizes            *
+*       Description:    Add an entry to a top-N list, if it's large enough    *
 *                                                                             *
 *       Arguments:                                                            *
-*         void *pConstraints	File selection constraints                    *
+*         topHeap *pHeap	The list. nMax must be set.                   *
+*         sizeTotals *pSizes	The entry sizes                               *
+*         char *pszPath		The entry pathname. Copied if kept.           *
 *                                                                             *
-*       Return value:   Total size of all files                               *
+*       Return value:   None                                                  *
 *                                                                             *
-*       Notes:                                                                *
+*       Notes:          The list is a min-heap of at most nMax entries, with  *
+*                       the smallest one at the root. So a new entry is       *
+*                       compared with the root only, and the memory used      *
+*                       does not depend on the number of entries seen.        *
+*                                                                             *
+*                       Entries of the same size are ranked by pathname, so   *
+*                       that the result does not depend on the scan order.    *
+*                                                                             *
+*                       Use TopWants() first, to avoid building pathnames of  *
+*                       entries that are too small.                           *
 *                                                                             *
 *       History:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
 *                                                                             *
 ******************************************************************************/
 
-int SelectDirsCB(const struct dirent *pDE) {
-  if (   (pDE->d_type == DT_DIR)	/* We want only directories */
-      && (!streq(pDE->d_name, "."))	/* Except . */
-      && (!streq(pDE->d_name, "..")))	/* and .. */
-    return TRUE;
-  else
-    return FALSE;
+/* Return > 0 if entry 1 comes before entry 2 in the report */
+static int TopRank(total_t size1, char *path1, total_t size2, char *path2) {
+  if (size1 != size2) return (size1 > size2) ? 1 : -1;
+  return strcmp(path2, path1);
 }
 
-/* Scan all subdirectories */
-total_t ScanDirs(scanOpts *pOpts, void *pConstraints) {
-  total_t size = 0;
-  total_t dSize;
-  struct dirent *pDE;
-  struct dirent **ppDE;
-  struct dirent **pDElist;
-  int nDE;
-  int iErr;
-  struct stat sStat;
-  NEW_PATHNAME_BUF(szCurDir);
+#define TOP_LESS(pHeap, i, j) \
+  (TopRank(pHeap->pEntries[i].sizes.size, pHeap->pEntries[i].path, \
+	   pHeap->pEntries[j].sizes.size, pHeap->pEntries[j].path) < 0)
 
-  DEBUG_ENTER(("ScanDirs(%p);\n", pConstraints));
+static void TopSwap(topHeap *pHeap, int i, int j) {
+  topEntry e = pHeap->pEntries[i];
+  pHeap->pEntries[i] = pHeap->pEntries[j];
+  pHeap->pEntries[j] = e;
+}
 
-#if PATHNAME_BUFS_IN_HEAP
-  if (!szCurDir) {
-    finis(RETCODE_NO_MEMORY, "Out of memory");
-  }
-#endif
+int TopWants(topHeap *pHeap, total_t size) {
+  return (pHeap->n < pHeap->nMax) || (size >= pHeap->pEntries[0].sizes.size);
+}
 
-  /* Get all subdirectories */
-  nDE = scandir(".", &pDElist, SelectDirsCB, alphasort);
-  if (nDE < 0) {
-    finis(RETCODE_NO_MEMORY, "Out of directory handles");
+void TopAdd(topHeap *pHeap, sizeTotals *pSizes, char *pszPath) {
+  int i;
+
+  if (pHeap->n < pHeap->nMax) { /* Append it, then sift it up */
+    if (!pHeap->pEntries) {
+      pHeap->pEntries = (topEntry *)malloc(pHeap->nMax * sizeof(topEntry));
+      if (!pHeap->pEntries) finis(RETCODE_NO_MEMORY, "Out of memory for the top list");
+    }
+    i = pHeap->n++;
+    pHeap->pEntries[i].sizes = *pSizes;
+    if (!(pHeap->pEntries[i].path = strdup(pszPath))) finis(RETCODE_NO_MEMORY, "Out of memory");
+    while (i && TOP_LESS(pHeap, i, (i-1)/2)) {
+      TopSwap(pHeap, i, (i-1)/2);
+      i = (i-1)/2;
+    }
+    return;
   }
-  for (ppDE = pDElist; nDE--; ppDE++) {
-    pDE = *ppDE;
+  if (TopRank(pSizes->size, pszPath, pHeap->pEntries[0].sizes.size, pHeap->pEntries[0].path) <= 0) {
+    return; /* Not larger than the smallest one kept */
+  }
+  /* Replace the root, then sift it down */
+  free(pHeap->pEntries[0].path);
+  pHeap->pEntries[0].sizes = *pSizes;
+  if (!(pHeap->pEntries[0].path = strdup(pszPath))) finis(RETCODE_NO_MEMORY, "Out of memory");
+  for (i = 0; ; ) {
+    int iMin = i;
+    int iLeft = 2*i + 1;
+    if ((iLeft < pHeap->n) && TOP_LESS(pHeap, iLeft, iMin)) iMin = iLeft;
+    if (((iLeft+1) < pHeap->n) && TOP_LESS(pHeap, iLeft+1, iMin)) iMin = iLeft+1;
+    if (iMin == i) break;
+    TopSwap(pHeap, i, iMin);
+    i = iMin;
+  }
+}
 
-#if _DIRENT2STAT_DEFINED /* DOS/Windows return stat info in the dirent structure */
-    iErr = dirent2stat(pDE, &sStat);
-#else /* Unix has to query it separately */
-    iErr = lstat(pDE->d_name, &sStat);
-#endif
+static int CDECL CompareTop(const void *p1, const void *p2) {
+  const topEntry *pE1 = (const topEntry *)p1;
+  const topEntry *pE2 = (const topEntry *)p2;
+  return TopRank(pE2->sizes.size, pE2->path, pE1->sizes.size, pE1->path);
+}
 
-#if !HAS_MSVCLIBX
-    DEBUG_PRINTF(("chdir(\"%s\");\n", pDE->d_name));
-#endif
-    iErr = chdir(pDE->d_name);
-    if (iErr) {
-      char *pszSeverity = iContinue ? "Warning" : "dirsize: Error";
-      if (iVerbose || !iContinue) {
-	char *pcd = getcwd(szCurDir, PATHNAME_SIZE); /* Canonic name of the target directory */
-	if (!pcd) {
-	  finis(RETCODE_INACCESSIBLE, "Cannot get the current directory, nor access %s. %s", pDE->d_name, strerror(errno));
-	}
-      	fprintf(stderr, "%s: Cannot access directory %s" DIRSEPARATOR_STRING "%s. %s\n", pszSeverity, szCurDir, pDE->d_name, strerror(errno));
-      }
-      if (!iContinue) finis(RETCODE_INACCESSIBLE, NULL); /* The error message has already been displayed */
-    } else {
-      dSize = ScanFiles(pOpts, pConstraints);
-      if (!pOpts->depth) {
-	char *pcd = getcwd(szCurDir, PATHNAME_SIZE); /* Canonic name of the target directory */
-	if (!pcd) {
-	  finis(RETCODE_INACCESSIBLE, "Cannot get the current directory. %s", strerror(errno));
-	}
-	/* Don't trim the pathname here, as we're in a loop, and subsequent paths might be longer */
-	affiche(szCurDir, dSize);
-      }
-#if !HAS_MSVCLIBX
-      DEBUG_PRINTF(("chdir(\"..\");\n"));
-#endif
-      iErr = chdir("..");
-      if (iErr) {
-	finis(RETCODE_INACCESSIBLE, "Cannot return to \"%s\" parent directory. %s", szCurDir, strerror(errno));
-      }
-  
-      size += dSize;  /* Totalize sizes */
+/* Display the list sorted by decreasing sizes, and free it */
+void TopReport(char *pszTitle, topHeap *pHeap) {
+  int i;
+  char szSize[40];
+
+  printf("%s:\n", pszTitle);
+  qsort(pHeap->pEntries, pHeap->n, sizeof(topEntry), CompareTop);
+  for (i=0; i<pHeap->n; i++) {
+    Size2StringWithUnit(szSize, pHeap->pEntries[i].sizes.size);
+    printf("%15s  ", szSize);
+    if (iAlloc) {
+      Size2StringWithUnit(szSize, pHeap->pEntries[i].sizes.alloc);
+      printf("%15s  ", szSize);
     }
+    printf("%s\n", pHeap->pEntries[i].path);
+    free(pHeap->pEntries[i].path);
+  }
+  free(pHeap->pEntries);
+  pHeap->pEntries = NULL;
+  pHeap->n = 0;
+}
 
-    free(pDE);
+/* Count a file in the histogram */
+void HistAdd(sizeHist *pHist, total_t size) {
+  int i = 0;
+  uint64_t n = (uint64_t)size;
+
+  while (n) {
+    n >>= 1;
+    i += 1;
   }
-  free(pDElist);
+  pHist->nFiles[i] += 1;
+  pHist->size[i] += size;
+}
 
-  FREE_PATHNAME_BUF(szCurDir);
-  DEBUG_LEAVE(("return %" TOTAL_FMT ";\n", size));
-  return size;
+/* Display the non-empty range of the histogram */
+void HistReport(sizeHist *pHist) {
+  int i, iFirst, iLast;
+  char szFrom[40], szTo[40], szFiles[40], szSize[40];
+
+  printf("File sizes histogram:\n");
+  printf("%15s  %15s  %12s  %15s\n", "From", "To", "Files", "Size");
+  for (iFirst = 0; (iFirst < HIST_BUCKETS) && !pHist->nFiles[iFirst]; iFirst++) ;
+  for (iLast = HIST_BUCKETS-1; (iLast > iFirst) && !pHist->nFiles[iLast]; iLast--) ;
+  for (i = iFirst; i <= iLast; i++) {
+    uint64_t from = i ? ((uint64_t)1 << (i-1)) : 0;
+    uint64_t to = i ? (from - 1) + from : 0; /* 2^i - 1, without overflowing */
+    Size2String(szFrom, (total_t)from);
+    Size2String(szTo, (total_t)to);
+    Size2String(szFiles, (total_t)pHist->nFiles[i]);
+    Size2StringWithUnit(szSize, pHist->size[i]);
+    printf("%15s  %15s  %12s  %15s\n", szFrom, szTo, szFiles, szSize);
+  }
+}
+
+/* Build a file pathname in the given buffer */
+char *JoinPath(char *pBuf, char *pszDir, char *pszName) {
+  size_t l = strlen(pszDir);
+  char *pszSep = (l && (pszDir[l-1] == DIRSEPARATOR_CHAR)) ? "" : DIRSEPARATOR_STRING;
+  snprintf(pBuf, PATHNAME_SIZE, "%s%s%s", pszDir, pszSep, pszName);
+  return pBuf;
 }
 
 /******************************************************************************
 *                                                                             *
-*   Function:       affiche                                                   *
+*       Function:       PathPush                                              *
+*                                                                             *
+*       Description:    Append a name to a path stack                         *
+*                                                                             *
+*       Arguments:                                                            *
+*         pathStack *pPath	The path stack                                *
+*         char *pszName		The name to append                            *
+*                                                                             *
+*       Return value:   The previous length, to pass to PathPop() later       *
+*                                                                             *
+*       Notes:          ScanDirs() appends each subdirectory name to curDir   *
+*                       when it enters it, and truncates it when it returns.  *
+*                       So curDir always contains the same name as getcwd()   *
+*                       would, without any system call. The buffer grows as   *
+*                       needed, and is never shrunk.                          *
+*                                                                             *
+*       History:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
+*                                                                             *
+******************************************************************************/
+
+size_t PathPush(pathStack *pPath, char *pszName) {
+  size_t lOld = pPath->len;
+  size_t lName = strlen(pszName);
+  int bSep = lOld && (pPath->psz[lOld-1] != DIRSEPARATOR_CHAR);
+  size_t lNew = lOld + bSep + lName;
+  char *pc;
+
+  if (lNew >= pPath->nAlloc) {
+    size_t nAlloc = 2 * lNew + 64;
+    char *psz = (char *)realloc(pPath->psz, nAlloc);
+    if (!psz) finis(RETCODE_NO_MEMORY, "Out of memory");
+    pPath->psz = psz;
+    pPath->nAlloc = nAlloc;
+  }
+  pc = pPath->psz + lOld;
+  if (bSep) *(pc++) = DIRSEPARATOR_CHAR;
+  memcpy(pc, pszName, lName + 1);
+  pPath->len = lNew;
+  return lOld;
+}
+
+void PathPop(pathStack *pPath, size_t len) {
+  pPath->len = len;
+  pPath->psz[len] = '\0';
+}
+
+void PathInit(pathStack *pPath) {
+  NEW_PATHNAME_BUF(szDir);
+
+#if PATHNAME_BUFS_IN_HEAP
+  if (!szDir) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+  if (!getcwd(szDir, PATHNAME_SIZE)) {
+    finis(RETCODE_INACCESSIBLE, "Cannot get the current directory. %s", strerror(errno));
+  }
+  pPath->len = 0;
+  PathPush(pPath, szDir);
+  FREE_PATHNAME_BUF(szDir);
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       AddFile                                               *
+*                                                                             *
+*       Description:    Select a file, and add up its sizes                   *
+*                                                                             *
+*       Arguments:                                                            *
+*         fileAcc *pAcc		Accumulators for the current directory        *
+*         fileInfo *pfi		The file information from GetFileInfo()       *
+*         char *pszName		The file name                                 *
+*                                                                             *
+*       Return value:   None                                                  *
+*                                                                             *
+*       Notes:          The caller has already checked the file type and name.*
+*                       This checks the date range, and with -l skips the     *
+*                       links to files already counted. Then it updates the   *
+*                       totals, and the --hist and --top accumulators.        *
+*                                                                             *
+*                       With bDeferLinks, the files with multiple links are   *
+*                       recorded instead, for the main thread to check them.  *
+*                       Their pathname is recorded for --top only if they may *
+*                       still make it into the list, so that the memory used  *
+*                       remains bounded in trees full of hard links.          *
+*                                                                             *
+*       History:                                                              *
+*        2026-10-16 JFL Moved here from ScanFiles() and RunJob(), so that the *
+*                       io_uring batches can use it too.                      *
+*        2026-10-16 JFL Only keep the pathnames of links large enough for     *
+*                       --top.                                                *
+*                                                                             *
+******************************************************************************/
+
+void InitFileAcc(fileAcc *pAcc, selectOpts *pC, sizeHist *pHist, topHeap *pTop,
+		 char *(*pfnDir)(fileAcc *pAcc), void *pRef) {
+  memset(pAcc, 0, sizeof(*pAcc));
+  pAcc->pC = pC;
+  pAcc->pHist = pHist;
+  pAcc->pTop = pTop;
+  pAcc->pfnDir = pfnDir;
+  pAcc->pRef = pRef;
+}
+
+/* Get the directory pathname once */
+static char *FileAccDir(fileAcc *pAcc) {
+  if (!pAcc->pszDir) pAcc->pszDir = pAcc->pfnDir(pAcc);
+  return pAcc->pszDir;
+}
+
+/* Build a file pathname, and strdup() it */
+static char *FileAccPath(fileAcc *pAcc, char *pszName) {
+  char *pszPath;
+  NEW_PATHNAME_BUF(szPath);
+#if PATHNAME_BUFS_IN_HEAP
+  if (!szPath) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+  pszPath = strdup(JoinPath(szPath, FileAccDir(pAcc), pszName));
+  if (!pszPath) finis(RETCODE_NO_MEMORY, "Out of memory");
+  FREE_PATHNAME_BUF(szPath);
+  return pszPath;
+}
+
+void AddFile(fileAcc *pAcc, fileInfo *pfi, char *pszName) {
+  selectOpts *pC = pAcc->pC;
+  uintmax_t fsize;
+
+  /* Skip files outside date range */
+  if (pC->datemin && (pfi->mtime < pC->datemin)) return;
+  if (pC->datemax && (pfi->mtime > pC->datemax)) return;
+
+#if HAS_HARDLINKS
+  /* Skip other links to files already counted */
+  if (   iLinks && (pfi->nlink > 1) && !pAcc->bDeferLinks
+      && !InodeSetAdd(&linksSeen, pfi->dev, pfi->ino)) return;
+#endif
+
+  DEBUG_PRINTF(("// Counting %10"PRIuMAX" bytes for %-32s\n", (uintmax_t)(pfi->sizes.size), pszName));
+  fsize = (uintmax_t)pfi->sizes.size; /* Get the actual file size */
+  if (csz) {	/* If the cluster size is provided */
+		/* Round it to the next cluster multiple */
+    fsize += csz-1;
+    fsize -= fsize % csz;
+  }
+  pfi->sizes.size = (total_t)fsize;
+  ADD_SIZES(pAcc->size, pfi->sizes);  /* Totalize sizes */
+  pAcc->nFiles += 1;
+
+#if HAS_HARDLINKS
+  if (iLinks && (pfi->nlink > 1) && pAcc->bDeferLinks) { /* Let the main thread check duplicates */
+    linkRec *pLink;
+    if (pAcc->nLinks == pAcc->nLinksAlloc) {
+      linkRec *pNew;
+      pAcc->nLinksAlloc = 2 * pAcc->nLinksAlloc + 16;
+      pNew = (linkRec *)realloc(pAcc->pLinks, pAcc->nLinksAlloc * sizeof(linkRec));
+      if (!pNew) finis(RETCODE_NO_MEMORY, "Out of memory");
+      pAcc->pLinks = pNew;
+    }
+    pLink = pAcc->pLinks + pAcc->nLinks++;
+    pLink->dev = pfi->dev;
+    pLink->ino = pfi->ino;
+    pLink->sizes = pfi->sizes;
+    /* The main thread will add it to the top list if it's not a duplicate.
+       Files smaller than the N ones already in either top list can't be in it. */
+    pLink->pszPath = NULL;
+    if (   iTop && (pfi->sizes.size >= pAcc->linksTopMin)
+	&& TopWants(pAcc->pTop, pfi->sizes.size)) {
+      pLink->pszPath = FileAccPath(pAcc, pszName);
+    }
+    return; /* The main thread will also update the histogram */
+  }
+#endif
+
+  if (iHist) HistAdd(pAcc->pHist, pfi->sizes.size);
+  if (iTop && TopWants(pAcc->pTop, pfi->sizes.size)) {
+    char *pszPath = FileAccPath(pAcc, pszName);
+    TopAdd(pAcc->pTop, &pfi->sizes, pszPath);
+    free(pszPath);
+  }
+}
+
+/* Get the current directory pathname, for ScanFiles() accumulators */
+static char *CurDirName(fileAcc *pAcc) {
+  char *pszDir = strdup(curDir.psz);
+  if (!pszDir) finis(RETCODE_NO_MEMORY, "Out of memory");
+  return pszDir;
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       StatBatchOpen                                         *
+*                                                                             *
+*       Description:    Create an io_uring for batches of statx requests      *
+*                                                                             *
+*       Arguments:      None                                                  *
+*                                                                             *
+*       Return value:   The new batch, or NULL if io_uring is not available   *
+*                                                                             *
+*       Notes:          Uses the raw io_uring system calls, as liburing is    *
+*                       not installed everywhere.                             *
+*                                                                             *
+*                       StatBatchAdd() queues the names of the files selected *
+*                       in a directory. StatBatchRun() submits them all with  *
+*                       a single system call, waits for all the results, then *
+*                       passes them to AddFile() in the order they were       *
+*                       queued. So the totals and the --top ties are the same *
+*                       as with synchronous statx() calls.                    *
+*                                                                             *
+*                       Each worker thread has its own batch, so no locks.    *
+*                       The batch must be run before closing the directory.   *
+*                                                                             *
+*                       IORING_OP_STATX requires Linux 5.6. A first request   *
+*                       on "/" checks that the kernel supports it. If not, or *
+*                       if io_uring is disabled, the caller falls back to     *
+*                       synchronous statx() calls.                            *
+*                                                                             *
+*       History:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
+*                                                                             *
+******************************************************************************/
+
+#if HAS_URING
+
+static int StatBatchSubmit(statBatch *pB);
+
+statBatch *StatBatchOpen(void) {
+  struct io_uring_params p;
+  statBatch *pB = (statBatch *)calloc(1, sizeof(statBatch));
+  unsigned char *pSq, *pCq;
+
+  if (!pB) finis(RETCODE_NO_MEMORY, "Out of memory");
+  pB->pSqRing = pB->pCqRing = pB->pSqes = MAP_FAILED;
+  memset(&p, 0, sizeof(p));
+  pB->fd = (int)syscall(__NR_io_uring_setup, STAT_BATCH, &p);
+  if (pB->fd < 0) {
+    DEBUG_PRINTF(("// io_uring_setup() failed. %s\n", strerror(errno)));
+    free(pB);
+    return NULL;
+  }
+  pB->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  pB->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) { /* Both rings in a single mapping */
+    if (pB->cqRingSize > pB->sqRingSize) pB->sqRingSize = pB->cqRingSize;
+    pB->cqRingSize = 0;
+  }
+  pB->pSqRing = mmap(NULL, pB->sqRingSize, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, pB->fd, IORING_OFF_SQ_RING);
+  if (pB->pSqRing == MAP_FAILED) goto fail;
+  if (pB->cqRingSize) {
+    pB->pCqRing = mmap(NULL, pB->cqRingSize, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, pB->fd, IORING_OFF_CQ_RING);
+    if (pB->pCqRing == MAP_FAILED) goto fail;
+  }
+  pB->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  pB->pSqes = mmap(NULL, pB->sqesSize, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, pB->fd, IORING_OFF_SQES);
+  if (pB->pSqes == MAP_FAILED) goto fail;
+
+  pSq = (unsigned char *)pB->pSqRing;
+  pCq = (unsigned char *)(pB->cqRingSize ? pB->pCqRing : pB->pSqRing);
+  pB->puSqTail = (unsigned *)(pSq + p.sq_off.tail);
+  pB->puSqMask = (unsigned *)(pSq + p.sq_off.ring_mask);
+  pB->puSqArray = (unsigned *)(pSq + p.sq_off.array);
+  pB->puCqHead = (unsigned *)(pCq + p.cq_off.head);
+  pB->puCqTail = (unsigned *)(pCq + p.cq_off.tail);
+  pB->puCqMask = (unsigned *)(pCq + p.cq_off.ring_mask);
+  pB->pCqes = (struct io_uring_cqe *)(pCq + p.cq_off.cqes);
+
+  /* Check that the kernel supports IORING_OP_STATX */
+  pB->iDirFd = AT_FDCWD;
+  pB->uMask = STATX_TYPE;
+  strcpy(pB->names[0], DIRSEPARATOR_STRING);
+  pB->n = 1;
+  if (StatBatchSubmit(pB) || pB->res[0]) {
+    DEBUG_PRINTF(("// IORING_OP_STATX failed. %s\n", strerror(-pB->res[0])));
+    goto fail;
+  }
+  pB->n = 0;
+  return pB;
+
+fail:
+  StatBatchClose(pB);
+  return NULL;
+}
+
+void StatBatchClose(statBatch *pB) {
+  if (!pB) return;
+  if (pB->pSqes != MAP_FAILED) munmap(pB->pSqes, pB->sqesSize);
+  if (pB->pCqRing != MAP_FAILED) munmap(pB->pCqRing, pB->cqRingSize);
+  if (pB->pSqRing != MAP_FAILED) munmap(pB->pSqRing, pB->sqRingSize);
+  close(pB->fd);
+  free(pB);
+}
+
+/* Submit all queued requests, and wait for all their results */
+static int StatBatchSubmit(statBatch *pB) {
+  unsigned uTail = *pB->puSqTail; /* Only we update it */
+  unsigned uSqMask = *pB->puSqMask;
+  int nToSubmit = pB->n;
+  int nDone = 0;
+  int i;
+
+  for (i=0; i<pB->n; i++) {
+    unsigned uIndex = uTail++ & uSqMask;
+    struct io_uring_sqe *pSqe = pB->pSqes + uIndex;
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode = IORING_OP_STATX;
+    pSqe->fd = pB->iDirFd;
+    pSqe->addr = (uint64_t)(uintptr_t)pB->names[i];
+    pSqe->len = pB->uMask;
+    pSqe->off = (uint64_t)(uintptr_t)(pB->stx + i);
+    pSqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+    pSqe->user_data = (uint64_t)i;
+    pB->puSqArray[uIndex] = uIndex;
+  }
+  __atomic_store_n(pB->puSqTail, uTail, __ATOMIC_RELEASE);
+
+  while (nDone < pB->n) {
+    unsigned uHead = *pB->puCqHead; /* Only we update it */
+    unsigned uCqTail = __atomic_load_n(pB->puCqTail, __ATOMIC_ACQUIRE);
+    int iRet;
+
+    for ( ; uHead != uCqTail; uHead++) {
+      struct io_uring_cqe *pCqe = pB->pCqes + (uHead & *pB->puCqMask);
+      if (pCqe->user_data < (uint64_t)pB->n) pB->res[pCqe->user_data] = pCqe->res;
+      nDone += 1;
+    }
+    __atomic_store_n(pB->puCqHead, uHead, __ATOMIC_RELEASE);
+    if (nDone >= pB->n) break;
+
+    /* Submit what's left, and wait for all results. (The kernel does not wait
+       if it could not submit everything. Then submit the rest next time.) */
+    iRet = (int)syscall(__NR_io_uring_enter, pB->fd, nToSubmit,
+			pB->n - nDone, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (iRet < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) continue;
+      if (nToSubmit == pB->n) { /* Nothing submitted. The caller can fall back. */
+	*pB->puSqTail -= nToSubmit; /* Drop the requests */
+	return -1;
+      }
+      finis(RETCODE_INACCESSIBLE, "io_uring error. %s", strerror(errno));
+    }
+    nToSubmit -= iRet;
+  }
+  return 0;
+}
+
+void StatBatchAdd(statBatch *pB, fileAcc *pAcc, int iDirFd, int iWant, char *pszName) {
+  pB->iDirFd = iDirFd;
+  pB->uMask = StatxMask(iWant);
+  strncpyz(pB->names[pB->n], pszName, NODENAME_SIZE);
+  pB->n += 1;
+  if (pB->n == STAT_BATCH) StatBatchRun(pB, pAcc);
+}
+
+void StatBatchRun(statBatch *pB, fileAcc *pAcc) {
+  int i;
+
+  if (!pB->n) return;
+  if (StatBatchSubmit(pB)) { /* Use synchronous statx() calls instead */
+    for (i=0; i<pB->n; i++) {
+      pB->res[i] = statx(pB->iDirFd, pB->names[i], AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+			 pB->uMask, pB->stx + i) ? -errno : 0;
+    }
+  }
+  for (i=0; i<pB->n; i++) {
+    fileInfo fi;
+    if (pB->res[i]) continue;	/* Ignore suspect entries, like GetFileInfo() */
+    Statx2FileInfo(pB->stx + i, &fi);
+    AddFile(pAcc, &fi, pB->names[i]);
+  }
+  pB->n = 0;
+}
+
+#endif /* HAS_URING */
+
+/******************************************************************************
+*                                                                             *
+*       Function:       ScanFiles                                             *
+*                                                                             *
+*       Description:    Scan the current directory, and add-up file sizes     *
+*                                                                             *
+*       Arguments:                                                            *
+*         void *pConstraints	File selection constraints                    *
+*                                                                             *
+*       Return value:   Total apparent and allocated sizes of all files       *
+*                                                                             *
+*       Notes:                                                                *
+*                                                                             *
+*       History:                                                              *
+*        2026-10-16 JFL Select and add up files in a single readdir() loop,   *
+*                       calling lstat() only once per selected file, and      *
+*                       filtering on the name before that.                    *
+*        2026-10-16 JFL Use GetFileInfo(), and add up the allocated sizes too.*
+*        2026-10-16 JFL With -l, skip the files with multiple links that have *
+*                       already been counted.                                 *
+*        2026-10-16 JFL Update the --top files list and the --hist histogram. *
+*        2026-10-16 JFL Use AddFile(), and with --uring, batch statx() calls. *
+*        2026-10-16 JFL Display the curDir path stack, instead of getcwd().   *
+*                                                                             *
+******************************************************************************/
+
+sizeTotals ScanFiles(scanOpts *pOpts, void *pConstraints) {
+  selectOpts *pC = pConstraints;
+  sizeTotals size;
+  sizeTotals dSize;
+  DIR *pDir;
+  struct dirent *pDE;
+  fileInfo fi;
+  int iWant = FileInfoWanted(pC);
+  fileAcc acc;
+
+  DEBUG_ENTER(("ScanFiles(%p);\n", pConstraints));
+
+  InitFileAcc(&acc, pC, &hist, &topFiles, CurDirName, NULL);
+
+  /* Scan all files */
+  pDir = opendir(".");
+  if (!pDir) {
+    finis(RETCODE_NO_MEMORY, "Out of directory handles");
+  }
+  while ((pDE = readdir(pDir))) {
+    int bInfoDone = FALSE;
+
+    if (!pDE->d_type) { /* Some filesystems don't set this field */
+      if (GetFileInfo(CURDIR_FD, pDE, iWant | WANT_TYPE, &fi)) continue;
+      bInfoDone = TRUE;
+      if (!S_ISREG(fi.mode)) continue;
+    } else if (pDE->d_type != DT_REG) {
+      continue;			/* We want only files */
+    }
+
+    /* Skip files which don't match the wildcard pattern */
+    if (pC->pattern) {
+      if (fnmatch(pC->pattern, pDE->d_name, FNM_CASEFOLD) == FNM_NOMATCH) {
+	continue;
+      }
+    }
+
+#if HAS_URING
+    if (!bInfoDone && pStatBatch) { /* Queue the request. AddFile() is called later. */
+      StatBatchAdd(pStatBatch, &acc, dirfd(pDir), iWant, pDE->d_name);
+      continue;
+    }
+#endif
+
+    /* Get the sizes, and the time for the date filter, with a single call */
+    if (!bInfoDone && GetFileInfo(CURDIR_FD, pDE, iWant, &fi)) {
+      continue;			/* Ignore suspect entries */
+    }
+
+    AddFile(&acc, &fi, pDE->d_name);
+  }
+#if HAS_URING
+  if (pStatBatch) StatBatchRun(pStatBatch, &acc);
+#endif
+  closedir(pDir);
+  size = acc.size;
+  free(acc.pszDir);
+
+  /* Optionally scan all subdirectories */
+  if (pOpts->recur || pOpts->total) {
+    pOpts->depth += 1;
+    dSize = ScanDirs(pOpts, pConstraints);
+    pOpts->depth -= 1;
+    if (pOpts->total) ADD_SIZES(size, dSize);  /* Totalize sizes */
+    if (pOpts->recur) affiche(curDir.psz, &size);
+  }
+
+  DEBUG_LEAVE(("return %" TOTAL_FMT ";\n", size.size));
+  return size;
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       ScanDirs                                              *
+*                                                                             *
+*       Description:    Scan subdirectories, and add-up file sizes            *
+*                                                                             *
+*       Arguments:                                                            *
+*         void *pConstraints	File selection constraints                    *
+*                                                                             *
+*       Return value:   Total apparent and allocated sizes of all files       *
+*                                                                             *
+*       Notes:                                                                *
+*                                                                             *
+*       History:                                                              *
+*        2026-10-16 JFL Update the curDir path stack, instead of getcwd().    *
+*                                                                             *
+******************************************************************************/
+
+int SelectDirsCB(const struct dirent *pDE) {
+  if (   (pDE->d_type == DT_DIR)	/* We want only directories */
+      && (!streq(pDE->d_name, "."))	/* Except . */
+      && (!streq(pDE->d_name, "..")))	/* and .. */
+    return TRUE;
+  else
+    return FALSE;
+}
+
+/* Scan all subdirectories */
+sizeTotals ScanDirs(scanOpts *pOpts, void *pConstraints) {
+  sizeTotals size = {0};
+  sizeTotals dSize;
+  struct dirent *pDE;
+  struct dirent **ppDE;
+  struct dirent **pDElist;
+  int nDE;
+  int iErr;
+  size_t len;
+
+  DEBUG_ENTER(("ScanDirs(%p);\n", pConstraints));
+
+  /* Get all subdirectories */
+  nDE = scandir(".", &pDElist, SelectDirsCB, alphasort);
+  if (nDE < 0) {
+    finis(RETCODE_NO_MEMORY, "Out of directory handles");
+  }
+  for (ppDE = pDElist; nDE--; ppDE++) {
+    pDE = *ppDE;
+
+#if !HAS_MSVCLIBX
+    DEBUG_PRINTF(("chdir(\"%s\");\n", pDE->d_name));
+#endif
+    iErr = chdir(pDE->d_name);
+    if (iErr) {
+      char *pszSeverity = iContinue ? "Warning" : "dirsize: Error";
+      if (iVerbose || !iContinue) {
+      	fprintf(stderr, "%s: Cannot access directory %s" DIRSEPARATOR_STRING "%s. %s\n", pszSeverity, curDir.psz, pDE->d_name, strerror(errno));
+      }
+      if (!iContinue) finis(RETCODE_INACCESSIBLE, NULL); /* The error message has already been displayed */
+    } else {
+      len = PathPush(&curDir, pDE->d_name);
+      dSize = ScanFiles(pOpts, pConstraints);
+      if (!pOpts->depth) affiche(curDir.psz, &dSize);
+#if !HAS_MSVCLIBX
+      DEBUG_PRINTF(("chdir(\"..\");\n"));
+#endif
+      iErr = chdir("..");
+      if (iErr) {
+	finis(RETCODE_INACCESSIBLE, "Cannot return to \"%s\" parent directory. %s", curDir.psz, strerror(errno));
+      }
+      PathPop(&curDir, len);
+  
+      ADD_SIZES(size, dSize);  /* Totalize sizes */
+    }
+
+    free(pDE);
+  }
+  free(pDElist);
+
+  DEBUG_LEAVE(("return %" TOTAL_FMT ";\n", size.size));
+  return size;
+}
+
+/******************************************************************************
+*                                                                             *
+*       Function:       pScanTree                                             *
+*                                                                             *
+*       Description:    Same as ScanFiles() or ScanDirs(), using threads      *
+*                                                                             *
+*       Arguments:                                                            *
+*         scanOpts *pOpts	Tree scanning options                         *
+*         selectOpts *pC	File selection constraints                    *
+*         sizeTotals *pSize	Where to store the total sizes of all files   *
+*                                                                             *
+*       Return value:   TRUE if done, FALSE if threads can't be started       *
+*                                                                             *
+*       Notes:          A pool of iJobs worker threads scans the tree.        *
+*                       Each job reads one directory, adds up the sizes of    *
+*                       the files selected there, and queues jobs for the     *
+*                       subdirectories found, sorted like scandir() does.     *
+*                       Each worker has its own queue. It processes its       *
+*                       newest jobs first, and when idle it steals the oldest *
+*                       jobs of the others.                                   *
+*                                                                             *
+*                       With -l, the workers record the files with multiple   *
+*                       links, and the main thread skips the duplicates when  *
+*                       it merges the results. So the hard links table needs  *
+*                       no lock, and the same link is counted in the same     *
+*                       directory as in the serial case.                      *
+*                                                                             *
+*                       With --index, each worker first checks if the         *
+*                       directory mtime and ctime are still the same as in    *
+*                       the index. If so, it uses the files totals and the    *
+*                       subdirectories list cached there, without reading the *
+*                       directory. The main thread records the results of     *
+*                       every job in a new index, as it merges them.          *
+*                       If the index file is in the tree, it is not counted.  *
+*                                                                             *
+*                       The workers never change the current directory.       *
+*                       They use openat() and fstatat() relative to a file    *
+*                       descriptor on the root directory. Each worker adds    *
+*                       up its sizes in its own accumulators, without locks.  *
+*                                                                             *
+*                       Meanwhile the main thread walks the job tree in the   *
+*                       same order as ScanFiles() and ScanDirs(), waiting for *
+*                       each job to be done, then merges the subdirectories   *
+*                       totals, displays them, and frees the jobs. So the     *
+*                       output is the same as in the serial case.             *
+*                                                                             *
+*                       The workers stop when JOBS_AHEAD jobs per worker are  *
+*                       scanned and not merged yet, so that the memory used   *
+*                       does not grow with the number of directories. If the  *
+*                       main thread needs a job that no worker started, it    *
+*                       scans it itself, with its own accumulators.           *
+*                                                                             *
+*       History:                                                              *
+*        2026-10-16 JFL Initial implementation.                               *
+*        2026-10-16 JFL Added the --index cache.                              *
+*        2026-10-16 JFL Don't count the index files.                          *
+*        2026-10-16 JFL Bound the number of jobs scanned ahead of the merge.  *
+*                                                                             *
+******************************************************************************/
+
+#if HAS_THREADS
+
+#define JOBS_AHEAD 64		/* Max jobs scanned ahead of the merge, per worker */
+
+typedef struct dirjob {	    /* A directory to scan, and the scan results */
+  char *relpath;		/* Path relative to the root. "." for the root. */
+  int depth;			/* Depth in the scan tree. 0 for the root. */
+  int bFiles;			/* TRUE if the files sizes are needed */
+  int valid;			/* TRUE if the directory could be opened */
+  int iErr;			/* Else the errno for the failure */
+  sizeTotals size;		/* Total sizes of the files selected in it */
+  long nFiles;			/* Number of files selected in it */
+  int bSubdirs;			/* TRUE if the subdirectories were listed */
+#if HAS_INDEX
+  int bCached;			/* TRUE if the results came from the index */
+  int64_t mtime;		/* Directory modification time, in ns */
+  int64_t ctime;		/* Directory status change time, in ns */
+#endif
+#if HAS_HARDLINKS
+  linkRec *pLinks;		/* Selected files with multiple links */
+  int nLinks;			/* Number of entries in the above array */
+#endif
+  struct dirjob **children;	/* Subdirectories, in ScanDirs() order */
+  int nchildren;		/* Number of entries in the above array */
+  int started;			/* TRUE when a thread took it off the queues */
+  int done;			/* TRUE when all the above fields are valid */
+} dirjob;
+
+typedef struct {	    /* A worker's double-ended job queue */
+  pthread_mutex_t mutex;
+  dirjob **ppJobs;		/* Array of job pointers */
+  int iFirst;			/* Index of the oldest job. Stolen by others. */
+  int iLast;			/* Index past the newest job. Popped by owner. */
+  int nAlloc;			/* Number of pointers allocated in ppJobs */
+} jobdeque;
+
+typedef struct {	    /* A worker's private accumulators */
+  sizeTotals size;		/* Total sizes of the files it selected */
+  long nFiles;			/* Number of files it selected */
+  long nDirs;			/* Number of directories it scanned */
+  topHeap topFiles;		/* The largest files it selected */
+  sizeHist hist;		/* The histogram of their sizes */
+#if HAS_URING
+  statBatch *pBatch;		/* Its statx() batch, or NULL */
+#endif
+} jobtotals;
+
+typedef struct {	    /* Parallel scan parameters and shared state */
+  int nWorkers;			/* Number of worker threads */
+  jobdeque *pDeques;		/* One job queue per worker */
+  jobtotals *pTotals;		/* One set of accumulators per worker, then main's */
+  int rootfd;			/* Root directory descriptor */
+  char *rootpath;		/* Root directory absolute pathname */
+  scanOpts *pOpts;		/* Tree scanning options */
+  selectOpts *pC;		/* File selection constraints */
+  pthread_mutex_t mutex;	/* Protects all fields below, and jobs flags */
+  pthread_cond_t workCond;	/* Signaled when jobs are queued, freed, or all done */
+  pthread_cond_t doneCond;	/* Signaled when a job is done */
+  int nQueued;			/* Number of jobs waiting in the queues */
+  int nActive;			/* Number of jobs queued or in progress */
+  int nHeld;			/* Number of jobs started and not freed yet */
+  int nMaxHeld;			/* Workers wait when nHeld reaches this */
+#if HAS_HARDLINKS
+  sizeTotals dupSize;		/* Duplicate links sizes. Used by main thread only. */
+  long nDupFiles;		/* Number of duplicate links skipped. Idem. */
+  total_t topMin;		/* Smallest size in a full topFiles list, else 0 */
+#endif
+} pscan;
+
+static pscan ps;
+
+#if HAS_INDEX
+
+/* Index file layout, in the native byte order:
+   An indexHeader; nSlots uint64_t offsets of records (0=Empty slot), forming
+   an open-addressing hash table keyed by the relative path; the records.
+   The file is mapped in memory, and used in place, without parsing it. */
+
+#define INDEX_MAGIC "DirsizeX"
+#define INDEX_VERSION 1
+#define INDEX_BYTE_ORDER 0x01020304
+
+typedef struct {	    /* Index file header */
+  char magic[8];		/* INDEX_MAGIC */
+  uint32_t version;		/* INDEX_VERSION */
+  uint32_t byteOrder;		/* INDEX_BYTE_ORDER, to detect foreign files */
+  uint64_t optsHash;		/* Hash of the root path and selection options */
+  uint64_t fileSize;		/* Total size of the file */
+  uint64_t nSlots;		/* Number of hash table slots. A power of 2. */
+  uint64_t nRecords;		/* Number of directory records */
+} indexHeader;
+
+#define IREC_FILES 1		/* The sizes include the files in the directory */
+#define IREC_SUBDIRS 2		/* The subdirectories are listed */
+
+typedef struct {	    /* Index record for one directory */
+  uint64_t hash;		/* Hash of the relative path */
+  int64_t mtime;		/* Directory modification time, in ns */
+  int64_t ctime;		/* Directory status change time, in ns */
+  uint64_t size;		/* Apparent size of the files selected in it */
+  uint64_t alloc;		/* Allocated size of the same */
+  uint64_t nFiles;		/* Number of files selected in it */
+  uint32_t flags;		/* IREC_FILES | IREC_SUBDIRS */
+  uint32_t nSubdirs;		/* Number of subdirectory names */
+  uint32_t pathLen;		/* Relative path length, excluding the NUL */
+  uint32_t namesLen;		/* Subdirectory names length, including the NULs */
+} indexRec;	/* Followed by the NUL-terminated relative path and subdir names */
+
+#define INDEX_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef struct {	    /* The old index, and the new one being built */
+  uint64_t optsHash;		/* Hash for this scan root and options */
+  char *pOld;			/* Old index mapped in memory. NULL if none. */
+  size_t oldSize;		/* Size of the above */
+  uint64_t *pOldSlots;		/* Its hash table */
+  uint64_t oldMask;		/* Its number of slots - 1 */
+  char *pNew;			/* New index records */
+  size_t newSize;		/* Number of bytes used in the above */
+  size_t newAlloc;		/* Number of bytes allocated for the above */
+  size_t *pNewOffsets;		/* Offsets of the new records in pNew */
+  size_t nNew;			/* Number of new records */
+  size_t nNewAlloc;		/* Number of offsets allocated */
+  long nReused;			/* Number of directories reused. Only for -v. */
+  char *pszSkipDir;		/* Index directory relative path, if in the tree */
+  char *pszSkipName;		/* Index file name in that directory */
+} dirIndex;
+
+static dirIndex di;
+
+/* FNV-1a 64-bit hash */
+static uint64_t IndexHash(uint64_t h, const void *p, size_t n) {
+  const unsigned char *pc = (const unsigned char *)p;
+  if (!h) h = 0xCBF29CE484222325ULL;
+  while (n--) {
+    h ^= *(pc++);
+    h *= 0x100000001B3ULL;
+  }
+  return h;
+}
+
+/* Find if the index is inside the scanned tree, so that its files are skipped */
+static void IndexLocate(char *pszRoot) {
+  char *pszName = strrchr(pszIndex, DIRSEPARATOR_CHAR); /* pszIndex is absolute */
+  char *pszDir;
+  size_t l = strlen(pszRoot);
+
+  *pszName = '\0'; /* Temporarily split the directory and the name */
+  pszDir = realpath(pszIndex[0] ? pszIndex : DIRSEPARATOR_STRING, NULL);
+  *pszName++ = DIRSEPARATOR_CHAR;
+  if (!pszDir) return;
+  if (streq(pszRoot, DIRSEPARATOR_STRING)) l = 0;
+  if (!strncmp(pszDir, pszRoot, l) && (!pszDir[l] || (pszDir[l] == DIRSEPARATOR_CHAR))) {
+    di.pszSkipDir = strdup(pszDir[l] ? pszDir+l+1 : ".");
+    di.pszSkipName = pszName;
+  }
+  free(pszDir);
+}
+
+/* Check if a file in a job directory is the index, or its temporary copy */
+static int IsIndexFile(dirjob *pJob, char *pszName) {
+  size_t l;
+
+  if (!di.pszSkipDir) return FALSE;
+  l = strlen(di.pszSkipName);
+  if (strncmp(pszName, di.pszSkipName, l) || (pszName[l] && !streq(pszName+l, ".tmp"))) return FALSE;
+  return streq(pJob->relpath, di.pszSkipDir);
+}
+
+/* Map the old index file, if it's valid for this scan root and options */
+static void IndexOpen(char *pszRoot, selectOpts *pC) {
+  int fd;
+  struct stat sStat;
+  indexHeader *pHdr;
+  char *pszReason = NULL;
+  int64_t l;
+
+  memset(&di, 0, sizeof(di));
+  IndexLocate(pszRoot);
+  di.optsHash = IndexHash(0, pszRoot, strlen(pszRoot) + 1);
+  if (pC->pattern) di.optsHash = IndexHash(di.optsHash, pC->pattern, strlen(pC->pattern) + 1);
+  l = (int64_t)pC->datemin; di.optsHash = IndexHash(di.optsHash, &l, sizeof(l));
+  l = (int64_t)pC->datemax; di.optsHash = IndexHash(di.optsHash, &l, sizeof(l));
+  l = (int64_t)csz; di.optsHash = IndexHash(di.optsHash, &l, sizeof(l));
+  l = (int64_t)iAlloc; di.optsHash = IndexHash(di.optsHash, &l, sizeof(l));
+
+  fd = open(pszIndex, O_RDONLY);
+  if (fd == -1) {
+    if (iVerbose) fprintf(stderr, "Creating index %s\n", pszIndex);
+    return;
+  }
+  if (fstat(fd, &sStat) || (sStat.st_size < (off_t)sizeof(indexHeader))) {
+    pszReason = "it's truncated";
+  } else {
+    di.oldSize = (size_t)sStat.st_size;
+    di.pOld = mmap(NULL, di.oldSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (di.pOld == MAP_FAILED) {
+      di.pOld = NULL;
+      pszReason = strerror(errno);
+    }
+  }
+  close(fd);
+  if (di.pOld) {
+    pHdr = (indexHeader *)di.pOld;
+    if (   memcmp(pHdr->magic, INDEX_MAGIC, sizeof(pHdr->magic))
+	|| (pHdr->version != INDEX_VERSION)
+	|| (pHdr->byteOrder != INDEX_BYTE_ORDER)) {
+      pszReason = "it's not a dirsize index";
+    } else if (   (pHdr->fileSize != di.oldSize)
+	       || (!pHdr->nSlots) || (pHdr->nSlots & (pHdr->nSlots - 1))
+	       || (pHdr->nSlots > ((di.oldSize - sizeof(indexHeader)) / sizeof(uint64_t)))) {
+      pszReason = "it's corrupt";
+    } else if (pHdr->optsHash != di.optsHash) {
+      pszReason = "it's for another directory, or other options";
+    } else {
+      di.pOldSlots = (uint64_t *)(di.pOld + sizeof(indexHeader));
+      di.oldMask = pHdr->nSlots - 1;
+      return;
+    }
+    munmap(di.pOld, di.oldSize);
+    di.pOld = NULL;
+  }
+  if (!iQuiet) fprintf(stderr, "Warning: Ignoring index %s, as %s.\n", pszIndex, pszReason);
+}
+
+/* Find the old index record for a relative path, checking its bounds */
+static indexRec *IndexLookup(char *relpath) {
+  size_t len = strlen(relpath);
+  uint64_t h = IndexHash(0, relpath, len);
+  uint64_t i, n;
+
+  if (!di.pOld) return NULL;
+  for (i = h & di.oldMask, n = 0; n <= di.oldMask; i = (i + 1) & di.oldMask, n++) {
+    uint64_t off = di.pOldSlots[i];
+    indexRec *pRec;
+    if (!off) break;
+    if ((off & 7) || (off > (di.oldSize - sizeof(indexRec)))) break; /* Corrupt */
+    pRec = (indexRec *)(di.pOld + off);
+    if (pRec->hash != h) continue;
+    if (   ((uint64_t)pRec->pathLen + 1 + pRec->namesLen) > (di.oldSize - off - sizeof(indexRec))
+	|| (pRec->pathLen != len)
+	|| memcmp((char *)(pRec + 1), relpath, len)) continue;
+    return pRec;
+  }
+  return NULL;
+}
+
+/* Check that a record's names are well formed, so that a corrupt index can't loop */
+static int IndexRecIsValid(indexRec *pRec) {
+  char *pc = (char *)(pRec + 1);
+  char *pcEnd = pc + pRec->pathLen + 1 + pRec->namesLen;
+  uint32_t n;
+
+  if (pc[pRec->pathLen]) return FALSE;
+  pc += pRec->pathLen + 1;
+  for (n = 0; n < pRec->nSubdirs; n++) {
+    char *pszName = pc;
+    while ((pc < pcEnd) && *pc && (*pc != DIRSEPARATOR_CHAR)) pc++;
+    if ((pc == pcEnd) || *pc || (pc == pszName)) return FALSE;
+    if (streq(pszName, ".") || streq(pszName, "..")) return FALSE;
+    pc++;
+  }
+  return (pc == pcEnd);
+}
+
+/* Get the cached totals of a directory, if it has not changed since then */
+static indexRec *IndexCheck(dirjob *pJob, int fd, int bDescend) {
+  struct stat sStat;
+  indexRec *pRec;
+
+  if (fstat(fd, &sStat)) return NULL;
+  pJob->mtime = (int64_t)sStat.st_mtim.tv_sec * 1000000000 + sStat.st_mtim.tv_nsec;
+  pJob->ctime = (int64_t)sStat.st_ctim.tv_sec * 1000000000 + sStat.st_ctim.tv_nsec;
+  pRec = IndexLookup(pJob->relpath);
+  if (   (!pRec)
+      || (pRec->mtime != pJob->mtime)
+      || (pRec->ctime != pJob->ctime)
+      || (pJob->bFiles && !(pRec->flags & IREC_FILES))
+      || (bDescend && !(pRec->flags & IREC_SUBDIRS))
+      || !IndexRecIsValid(pRec)) return NULL;
+  return pRec;
+}
+
+/* Append a record for a job to the new index. Called by the main thread. */
+static void IndexAddJob(dirjob *pJob) {
+  size_t pathLen = strlen(pJob->relpath);
+  size_t namesLen = 0;
+  size_t recLen;
+  indexRec *pRec;
+  char *pc;
+  int i;
+
+  for (i=0; i<pJob->nchildren; i++) {
+    char *pszName = strrchr(pJob->children[i]->relpath, DIRSEPARATOR_CHAR);
+    namesLen += strlen(pszName ? pszName+1 : pJob->children[i]->relpath) + 1;
+  }
+  recLen = INDEX_ALIGN(sizeof(indexRec) + pathLen + 1 + namesLen);
+  if ((di.newSize + recLen) > di.newAlloc) {
+    size_t nAlloc = 2 * di.newAlloc + recLen + 65536;
+    char *pNew = (char *)realloc(di.pNew, nAlloc);
+    if (!pNew) finis(RETCODE_NO_MEMORY, "Out of memory for the index");
+    di.pNew = pNew;
+    di.newAlloc = nAlloc;
+  }
+  if (di.nNew == di.nNewAlloc) {
+    size_t nAlloc = 2 * di.nNewAlloc + 1024;
+    size_t *pNew = (size_t *)realloc(di.pNewOffsets, nAlloc * sizeof(size_t));
+    if (!pNew) finis(RETCODE_NO_MEMORY, "Out of memory for the index");
+    di.pNewOffsets = pNew;
+    di.nNewAlloc = nAlloc;
+  }
+  di.pNewOffsets[di.nNew++] = di.newSize;
+  if (pJob->bCached) di.nReused += 1;
+  pRec = (indexRec *)(di.pNew + di.newSize);
+  memset(pRec, 0, recLen);
+  pRec->hash = IndexHash(0, pJob->relpath, pathLen);
+  pRec->mtime = pJob->mtime;
+  pRec->ctime = pJob->ctime;
+  pRec->size = (uint64_t)pJob->size.size;
+  pRec->alloc = (uint64_t)pJob->size.alloc;
+  pRec->nFiles = (uint64_t)pJob->nFiles;
+  pRec->flags = (pJob->bFiles ? IREC_FILES : 0) | (pJob->bSubdirs ? IREC_SUBDIRS : 0);
+  pRec->nSubdirs = (uint32_t)pJob->nchildren;
+  pRec->pathLen = (uint32_t)pathLen;
+  pRec->namesLen = (uint32_t)namesLen;
+  pc = (char *)(pRec + 1);
+  memcpy(pc, pJob->relpath, pathLen + 1);
+  pc += pathLen + 1;
+  for (i=0; i<pJob->nchildren; i++) {
+    char *pszName = strrchr(pJob->children[i]->relpath, DIRSEPARATOR_CHAR);
+    pszName = pszName ? pszName+1 : pJob->children[i]->relpath;
+    strcpy(pc, pszName);
+    pc += strlen(pszName) + 1;
+  }
+  di.newSize += recLen;
+}
+
+/* Write the new index, and release both indexes */
+static void IndexSave(void) {
+  indexHeader hdr;
+  uint64_t *pSlots;
+  uint64_t nSlots = 16;
+  uint64_t base;
+  size_t i;
+  FILE *hf;
+  NEW_PATHNAME_BUF(szTemp);
+
+#if PATHNAME_BUFS_IN_HEAP
+  if (!szTemp) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+  while (nSlots < (2 * (uint64_t)di.nNew)) nSlots *= 2; /* Keep it at most half full */
+  pSlots = (uint64_t *)calloc((size_t)nSlots, sizeof(uint64_t));
+  if (!pSlots) finis(RETCODE_NO_MEMORY, "Out of memory for the index");
+  base = sizeof(indexHeader) + nSlots * sizeof(uint64_t);
+  for (i=0; i<di.nNew; i++) {
+    indexRec *pRec = (indexRec *)(di.pNew + di.pNewOffsets[i]);
+    uint64_t j = pRec->hash & (nSlots - 1);
+    while (pSlots[j]) j = (j + 1) & (nSlots - 1);
+    pSlots[j] = base + di.pNewOffsets[i];
+  }
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = INDEX_VERSION;
+  hdr.byteOrder = INDEX_BYTE_ORDER;
+  hdr.optsHash = di.optsHash;
+  hdr.fileSize = base + di.newSize;
+  hdr.nSlots = nSlots;
+  hdr.nRecords = di.nNew;
+
+  /* Write a temporary file, then rename it, so that the old index remains
+     valid if anything goes wrong */
+  snprintf(szTemp, PATHNAME_SIZE, "%s.tmp", pszIndex);
+  hf = fopen(szTemp, "wb");
+  if (   (!hf)
+      || (fwrite(&hdr, sizeof(hdr), 1, hf) != 1)
+      || (fwrite(pSlots, sizeof(uint64_t), (size_t)nSlots, hf) != (size_t)nSlots)
+      || (di.newSize && (fwrite(di.pNew, di.newSize, 1, hf) != 1))
+      || fclose(hf)
+      || rename(szTemp, pszIndex)) {
+    fprintf(stderr, "Warning: Cannot write index %s. %s\n", pszIndex, strerror(errno));
+    remove(szTemp);
+  } else if (iVerbose) {
+    fprintf(stderr, "Reused %ld directories totals from index %s\n", di.nReused, pszIndex);
+  }
+
+  if (di.pOld) munmap(di.pOld, di.oldSize);
+  free(pSlots);
+  free(di.pNew);
+  free(di.pNewOffsets);
+  free(di.pszSkipDir);
+  memset(&di, 0, sizeof(di));
+  FREE_PATHNAME_BUF(szTemp);
+}
+
+#endif /* HAS_INDEX */
+
+static dirjob *NewJob(char *relpath, int depth) {
+  dirjob *pJob = (dirjob *)calloc(1, sizeof(dirjob));
+  if (pJob && !(pJob->relpath = strdup(relpath))) pJob = NULL;
+  if (!pJob) finis(RETCODE_NO_MEMORY, "Out of memory for directory jobs");
+  pJob->depth = depth;
+  pJob->bFiles = TRUE;
+  return pJob;
+}
+
+static void FreeJob(dirjob *pJob) {
+#if HAS_HARDLINKS
+  int i;
+  for (i=0; i<pJob->nLinks; i++) free(pJob->pLinks[i].pszPath);
+  free(pJob->pLinks);
+#endif
+  free(pJob->children);
+  free(pJob->relpath);
+  free(pJob);
+}
+
+/* Build the absolute pathname of a job directory, like getcwd() would */
+static char *JobPath(char *buf, dirjob *pJob) {
+  if (streq(pJob->relpath, ".")) {
+    strncpyz(buf, ps.rootpath, PATHNAME_SIZE);
+  } else if (streq(ps.rootpath, DIRSEPARATOR_STRING)) {
+    snprintf(buf, PATHNAME_SIZE, "%s%s", DIRSEPARATOR_STRING, pJob->relpath);
+  } else {
+    snprintf(buf, PATHNAME_SIZE, "%s%s%s", ps.rootpath, DIRSEPARATOR_STRING, pJob->relpath);
+  }
+  return buf;
+}
+
+/* Get a job directory pathname, for RunJob() accumulators */
+static char *JobDirName(fileAcc *pAcc) {
+  char *pszDir = (char *)malloc(PATHNAME_SIZE);
+  if (!pszDir) finis(RETCODE_NO_MEMORY, "Out of memory");
+  return JobPath(pszDir, (dirjob *)(pAcc->pRef));
+}
+
+/* Queue jobs in the worker's own queue. The first job will be popped first. */
+static void PushJobs(int iWorker, dirjob **ppJobs, int nJobs) {
+  jobdeque *pDQ = ps.pDeques + iWorker;
+  int i;
+
+  if (!nJobs) return;
+  pthread_mutex_lock(&pDQ->mutex);
+  if ((pDQ->iLast + nJobs) > pDQ->nAlloc) {
+    int nUsed = pDQ->iLast - pDQ->iFirst;
+    if ((nUsed + nJobs) > pDQ->nAlloc) { /* Compacting won't be enough */
+      int nAlloc = 2 * (nUsed + nJobs) + 16;
+      dirjob **ppNew = (dirjob **)realloc(pDQ->ppJobs, nAlloc * sizeof(dirjob *));
+      if (!ppNew) finis(RETCODE_NO_MEMORY, "Out of memory for job queue");
+      pDQ->ppJobs = ppNew;
+      pDQ->nAlloc = nAlloc;
+    }
+    memmove(pDQ->ppJobs, pDQ->ppJobs + pDQ->iFirst, nUsed * sizeof(dirjob *));
+    pDQ->iFirst = 0;
+    pDQ->iLast = nUsed;
+  }
+  for (i = nJobs-1; i >= 0; i--) pDQ->ppJobs[pDQ->iLast++] = ppJobs[i];
+  pthread_mutex_unlock(&pDQ->mutex);
+
+  pthread_mutex_lock(&ps.mutex);
+  ps.nQueued += nJobs;
+  ps.nActive += nJobs;
+  pthread_cond_broadcast(&ps.workCond);
+  pthread_mutex_unlock(&ps.mutex);
+}
+
+/* Get the newest job from our own queue, else the oldest from another one */
+static dirjob *PopJob(int iWorker) {
+  dirjob *pJob = NULL;
+  int i;
+
+  for (i = 0; (i < ps.nWorkers) && !pJob; i++) {
+    jobdeque *pDQ = ps.pDeques + ((iWorker + i) % ps.nWorkers);
+    pthread_mutex_lock(&pDQ->mutex);
+    if (pDQ->iLast > pDQ->iFirst) {
+      if (!i) {			/* Our own queue */
+	pJob = pDQ->ppJobs[--(pDQ->iLast)];
+      } else {			/* Steal from another worker */
+	pJob = pDQ->ppJobs[(pDQ->iFirst)++];
+      }
+      if (pDQ->iFirst == pDQ->iLast) pDQ->iFirst = pDQ->iLast = 0;
+    }
+    pthread_mutex_unlock(&pDQ->mutex);
+  }
+  if (pJob) {
+    pthread_mutex_lock(&ps.mutex);
+    ps.nQueued -= 1;
+    pJob->started = TRUE;
+    ps.nHeld += 1;
+    pthread_mutex_unlock(&ps.mutex);
+  }
+  return pJob;
+}
+
+/* Remove a given job from the queues. Returns FALSE if a worker got it first. */
+static int UnqueueJob(dirjob *pJob) {
+  int i, j;
+  int bFound = FALSE;
+
+  for (i = 0; (i < ps.nWorkers) && !bFound; i++) {
+    jobdeque *pDQ = ps.pDeques + i;
+    pthread_mutex_lock(&pDQ->mutex);
+    for (j = pDQ->iFirst; j < pDQ->iLast; j++) { /* Usually among the oldest */
+      if (pDQ->ppJobs[j] == pJob) {
+	memmove(pDQ->ppJobs + j, pDQ->ppJobs + j + 1, (pDQ->iLast - j - 1) * sizeof(dirjob *));
+	pDQ->iLast -= 1;
+	if (pDQ->iFirst == pDQ->iLast) pDQ->iFirst = pDQ->iLast = 0;
+	bFound = TRUE;
+	break;
+      }
+    }
+    pthread_mutex_unlock(&pDQ->mutex);
+  }
+  if (bFound) {
+    pthread_mutex_lock(&ps.mutex);
+    ps.nQueued -= 1;
+    pJob->started = TRUE;
+    ps.nHeld += 1;
+    pthread_mutex_unlock(&ps.mutex);
+  }
+  return bFound;
+}
+
+/* Sort subdirectory names like alphasort() */
+static int CDECL CompareNames(const void *p1, const void *p2) {
+  return strcoll(*(char **)p1, *(char **)p2);
+}
+
+/* Append a copy of a name to a growable array */
+static void AddName(char ***pppNames, int *pnNames, int *pnAlloc, const char *pszName) {
+  if (*pnNames == *pnAlloc) {
+    char **ppNew;
+    *pnAlloc = 2 * *pnAlloc + 16;
+    ppNew = (char **)realloc(*pppNames, *pnAlloc * sizeof(char *));
+    if (!ppNew) finis(RETCODE_NO_MEMORY, "Out of memory");
+    *pppNames = ppNew;
+  }
+  if (!((*pppNames)[(*pnNames)++] = strdup(pszName))) finis(RETCODE_NO_MEMORY, "Out of memory");
+}
+
+/* Scan one directory. Same selection criteria as ScanFiles() and ScanDirs()
+   iWorker is ps.nWorkers when the main thread runs it. */
+static void RunJob(dirjob *pJob, int iWorker) {
+  jobtotals *pT = ps.pTotals + iWorker; /* This thread's accumulators */
+  selectOpts *pC = ps.pC;
+  int bDescend = ps.pOpts->recur || ps.pOpts->total
+	      || (ps.pOpts->subdirs && !pJob->depth);
+  int iWant = FileInfoWanted(pC);
+  fileAcc acc;			/* Files selected */
+  int fd;
+  DIR *pDir;
+  struct dirent *pDE;
+#if HAS_INDEX
+  indexRec *pRec = NULL;	/* Cached results, if still valid */
+#endif
+  char **ppNames = NULL;	/* Subdirectory names */
+  int nNames = 0;
+  int nAlloc = 0;
+  dirjob **children = NULL;
+  int i;
+
+  InitFileAcc(&acc, pC, &pT->hist, &pT->topFiles, JobDirName, pJob);
+#if HAS_HARDLINKS
+  acc.bDeferLinks = TRUE;	/* Let the main thread check duplicates */
+  if (iTop && iLinks) {
+    pthread_mutex_lock(&ps.mutex);
+    acc.linksTopMin = ps.topMin;
+    pthread_mutex_unlock(&ps.mutex);
+  }
+#endif
+
+  fd = openat(ps.rootfd, pJob->relpath, O_RDONLY | O_DIRECTORY);
+#if HAS_INDEX
+  if ((fd != -1) && pszIndex) pRec = IndexCheck(pJob, fd, bDescend);
+  if (pRec) { /* The directory has not changed. Use the cached results. */
+    char *pszName = (char *)(pRec + 1) + pRec->pathLen + 1;
+    close(fd);
+    pJob->valid = TRUE;
+    pT->nDirs += 1;
+    if (pJob->bFiles) {
+      acc.size.size = (total_t)pRec->size;
+      acc.size.alloc = (total_t)pRec->alloc;
+      acc.nFiles = (long)pRec->nFiles;
+    }
+    for (i=0; bDescend && (i<(int)pRec->nSubdirs); i++) {
+      AddName(&ppNames, &nNames, &nAlloc, pszName);
+      pszName += strlen(pszName) + 1;
+    }
+    pJob->bCached = TRUE;
+    ADD_SIZES(pT->size, acc.size);
+    pT->nFiles += acc.nFiles;
+  } else
+#endif
+  if (!(pDir = (fd != -1) ? fdopendir(fd) : NULL)) {
+    pJob->iErr = errno;
+    if (fd != -1) close(fd);
+  } else {
+    pJob->valid = TRUE;
+    pT->nDirs += 1;
+    while ((pDE = readdir(pDir))) {
+      int iType = pDE->d_type;
+      fileInfo fi;
+      int bInfoDone = FALSE;
+
+      if (streq(pDE->d_name, ".") || streq(pDE->d_name, "..")) continue;
+      if (!iType) { /* Some filesystems don't set this field */
+	if (GetFileInfo(fd, pDE, iWant | WANT_TYPE, &fi)) continue;
+	bInfoDone = TRUE;
+	if (S_ISREG(fi.mode)) iType = DT_REG;
+	if (S_ISDIR(fi.mode)) iType = DT_DIR;
+      }
+      if (iType == DT_DIR) {
+	if (bDescend) AddName(&ppNames, &nNames, &nAlloc, pDE->d_name);
+	continue;
+      }
+      if ((iType != DT_REG) || !pJob->bFiles) continue; /* We want only files */
+      /* Skip files which don't match the wildcard pattern */
+      if (pC->pattern && (fnmatch(pC->pattern, pDE->d_name, FNM_CASEFOLD) == FNM_NOMATCH)) continue;
+#if HAS_INDEX
+      if (pszIndex && IsIndexFile(pJob, pDE->d_name)) continue; /* Not part of the data measured */
+#endif
+#if HAS_URING
+      if (!bInfoDone && pT->pBatch) { /* Queue the request. AddFile() is called later. */
+	StatBatchAdd(pT->pBatch, &acc, fd, iWant, pDE->d_name);
+	continue;
+      }
+#endif
+      if (!bInfoDone && GetFileInfo(fd, pDE, iWant, &fi)) continue;
+      AddFile(&acc, &fi, pDE->d_name);
+    }
+#if HAS_URING
+    if (pT->pBatch) StatBatchRun(pT->pBatch, &acc);
+#endif
+    closedir(pDir); /* Also closes fd */
+    ADD_SIZES(pT->size, acc.size);
+    pT->nFiles += acc.nFiles;
+  }
+
+  /* Queue jobs for the subdirectories, in the order ScanDirs() visits them */
+  if (nNames) {
+    NEW_PATHNAME_BUF(relpath);
+#if PATHNAME_BUFS_IN_HEAP
+    if (!relpath) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+    qsort(ppNames, nNames, sizeof(char *), CompareNames);
+    children = (dirjob **)malloc(nNames * sizeof(dirjob *));
+    if (!children) finis(RETCODE_NO_MEMORY, "Out of memory for directory jobs");
+    for (i=0; i<nNames; i++) {
+      if (streq(pJob->relpath, ".")) {
+	strncpyz(relpath, ppNames[i], PATHNAME_SIZE);
+      } else {
+	snprintf(relpath, PATHNAME_SIZE, "%s%s%s", pJob->relpath, DIRSEPARATOR_STRING, ppNames[i]);
+      }
+      children[i] = NewJob(relpath, pJob->depth + 1);
+      free(ppNames[i]);
+    }
+    FREE_PATHNAME_BUF(relpath);
+  }
+  free(ppNames);
+  free(acc.pszDir);
+  pJob->size = acc.size;
+  pJob->nFiles = acc.nFiles;
+  pJob->bSubdirs = bDescend;
+#if HAS_HARDLINKS
+  pJob->pLinks = acc.pLinks;
+  pJob->nLinks = acc.nLinks;
+#endif
+  pJob->children = children;
+  pJob->nchildren = nNames;
+  PushJobs((iWorker < ps.nWorkers) ? iWorker : 0, children, nNames);
+
+  pthread_mutex_lock(&ps.mutex);
+  pJob->done = TRUE;
+  ps.nActive -= 1;
+  pthread_cond_broadcast(&ps.doneCond);
+  if (!ps.nActive) pthread_cond_broadcast(&ps.workCond);
+  pthread_mutex_unlock(&ps.mutex);
+}
+
+static void *WorkerThread(void *pParam) {
+  int iWorker = (int)(intptr_t)pParam;
+#if HAS_URING
+  jobtotals *pT = ps.pTotals + iWorker;
+
+  if (iUring) pT->pBatch = StatBatchOpen();
+#endif
+
+  while (1) {
+    dirjob *pJob;
+    pthread_mutex_lock(&ps.mutex);
+    /* Wait for queued jobs, and for the merge to catch up if it's too late */
+    while (ps.nActive && (!ps.nQueued || (ps.nHeld >= ps.nMaxHeld))) {
+      pthread_cond_wait(&ps.workCond, &ps.mutex);
+    }
+    if (!ps.nActive) { /* Everything has been scanned */
+      pthread_mutex_unlock(&ps.mutex);
+      break;
+    }
+    pthread_mutex_unlock(&ps.mutex);
+    pJob = PopJob(iWorker);
+    if (pJob) RunJob(pJob, iWorker);
+  }
+#if HAS_URING
+  StatBatchClose(pT->pBatch);
+  pT->pBatch = NULL;
+#endif
+  return NULL;
+}
+
+/* Wait for a job to be done. Scan it now if no worker started it yet. */
+static void WaitForJob(dirjob *pJob) {
+  int bStarted;
+
+  pthread_mutex_lock(&ps.mutex);
+  bStarted = pJob->started;
+  pthread_mutex_unlock(&ps.mutex);
+  /* If the workers are busy, or waiting for us, scan it ourselves */
+  if (!bStarted && UnqueueJob(pJob)) RunJob(pJob, ps.nWorkers);
+
+  pthread_mutex_lock(&ps.mutex);
+  while (!pJob->done) pthread_cond_wait(&ps.doneCond, &ps.mutex);
+  pthread_mutex_unlock(&ps.mutex);
+}
+
+static sizeTotals ShowJobDirs(dirjob *pJob, scanOpts *pOpts);
+
+#if HAS_HARDLINKS
+/* Remove from a job totals the links to files already counted */
+static void SkipJobLinks(dirjob *pJob, sizeTotals *pSize) {
+  int i;
+
+  for (i=0; i<pJob->nLinks; i++) {
+    linkRec *pLink = pJob->pLinks + i;
+    if (!InodeSetAdd(&linksSeen, pLink->dev, pLink->ino)) {
+      pSize->size -= pLink->sizes.size;
+      pSize->alloc -= pLink->sizes.alloc;
+      ADD_SIZES(ps.dupSize, pLink->sizes);
+      ps.nDupFiles += 1;
+    } else {
+      if (iHist) HistAdd(&hist, pLink->sizes.size);
+      if (pLink->pszPath && TopWants(&topFiles, pLink->sizes.size)) {
+	TopAdd(&topFiles, &pLink->sizes, pLink->pszPath);
+      }
+    }
+    free(pLink->pszPath);
+  }
+  free(pJob->pLinks);
+  pJob->pLinks = NULL;
+  pJob->nLinks = 0;
+  if (iTop && (topFiles.n == topFiles.nMax)) { /* Let workers skip smaller links */
+    pthread_mutex_lock(&ps.mutex);
+    ps.topMin = topFiles.pEntries[0].sizes.size;
+    pthread_mutex_unlock(&ps.mutex);
+  }
+}
+#endif
+
+/* Merge the results of a job, in the same order as ScanFiles() */
+static sizeTotals ShowJobFiles(dirjob *pJob, scanOpts *pOpts) {
+  sizeTotals size;
+  sizeTotals dSize;
+
+  WaitForJob(pJob);
+  size = pJob->size;
+#if HAS_HARDLINKS
+  SkipJobLinks(pJob, &size);
+#endif
+  if (pOpts->recur || pOpts->total) {
+    pOpts->depth += 1;
+    dSize = ShowJobDirs(pJob, pOpts);
+    pOpts->depth -= 1;
+    if (pOpts->total) ADD_SIZES(size, dSize);  /* Totalize sizes */
+    if (pOpts->recur) {
+      NEW_PATHNAME_BUF(szCurDir);
+#if PATHNAME_BUFS_IN_HEAP
+      if (!szCurDir) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+      affiche(JobPath(szCurDir, pJob), &size);
+      FREE_PATHNAME_BUF(szCurDir);
+    }
+  }
+  return size;
+}
+
+/* Merge the results of a job subdirectories, in the same order as ScanDirs() */
+static sizeTotals ShowJobDirs(dirjob *pJob, scanOpts *pOpts) {
+  sizeTotals size = {0};
+  sizeTotals dSize;
+  int i;
+  NEW_PATHNAME_BUF(szCurDir);
+
+#if PATHNAME_BUFS_IN_HEAP
+  if (!szCurDir) finis(RETCODE_NO_MEMORY, "Out of memory");
+#endif
+
+  WaitForJob(pJob);
+  for (i=0; i<pJob->nchildren; i++) {
+    dirjob *pChild = pJob->children[i];
+
+    WaitForJob(pChild);
+#if HAS_INDEX
+    if (pszIndex && pChild->valid) IndexAddJob(pChild);
+#endif
+    if (!pChild->valid) {
+      char *pszSeverity = iContinue ? "Warning" : "dirsize: Error";
+      if (iVerbose || !iContinue) {
+	char *pszName = strrchr(pChild->relpath, DIRSEPARATOR_CHAR);
+	pszName = pszName ? pszName+1 : pChild->relpath;
+	fprintf(stderr, "%s: Cannot access directory %s" DIRSEPARATOR_STRING "%s. %s\n", pszSeverity, JobPath(szCurDir, pJob), pszName, strerror(pChild->iErr));
+      }
+      if (!iContinue) finis(RETCODE_INACCESSIBLE, NULL); /* The error message has already been displayed */
+    } else {
+      dSize = ShowJobFiles(pChild, pOpts);
+      if (!pOpts->depth) affiche(JobPath(szCurDir, pChild), &dSize);
+      ADD_SIZES(size, dSize);  /* Totalize sizes */
+    }
+    FreeJob(pChild);
+    pJob->children[i] = NULL;
+
+    pthread_mutex_lock(&ps.mutex);
+    ps.nHeld -= 1;
+    pthread_cond_broadcast(&ps.workCond); /* Let the workers scan further */
+    pthread_mutex_unlock(&ps.mutex);
+  }
+
+  FREE_PATHNAME_BUF(szCurDir);
+  return size;
+}
+
+int pScanTree(scanOpts *pOpts, selectOpts *pC, sizeTotals *pSize) {
+  pthread_t *pThreads;
+  dirjob *pRoot;
+  int i;
+  int nThreads = 0;
+  jobtotals jt = {0};
+
+  DEBUG_ENTER(("pScanTree(%p, %p);\n", pOpts, pC));
+
+  memset(&ps, 0, sizeof(ps));
+  ps.nWorkers = (iJobs > 1) ? iJobs : 1;
+  ps.nMaxHeld = JOBS_AHEAD * ps.nWorkers;
+  ps.pOpts = pOpts;
+  ps.pC = pC;
+  ps.rootpath = getcwd(NULL, 0);
+  if (!ps.rootpath) finis(RETCODE_INACCESSIBLE, "Cannot get the current directory. %s", strerror(errno));
+  ps.rootfd = open(".", O_RDONLY | O_DIRECTORY);
+  if (ps.rootfd == -1) finis(RETCODE_INACCESSIBLE, "Cannot access directory %s. %s", ps.rootpath, strerror(errno));
+  pthread_mutex_init(&ps.mutex, NULL);
+  pthread_cond_init(&ps.workCond, NULL);
+  pthread_cond_init(&ps.doneCond, NULL);
+
+  pThreads = (pthread_t *)malloc(ps.nWorkers * sizeof(pthread_t));
+  ps.pDeques = (jobdeque *)calloc(ps.nWorkers, sizeof(jobdeque));
+  ps.pTotals = (jobtotals *)calloc(ps.nWorkers + 1, sizeof(jobtotals));
+  if (!pThreads || !ps.pDeques || !ps.pTotals) finis(RETCODE_NO_MEMORY, "Out of memory for threads");
+  for (i=0; i<ps.nWorkers; i++) pthread_mutex_init(&ps.pDeques[i].mutex, NULL);
+  for (i=0; i<=ps.nWorkers; i++) ps.pTotals[i].topFiles.nMax = iTop;
+
+#if HAS_INDEX
+  if (pszIndex) IndexOpen(ps.rootpath, pC);
+#endif
+
+  pRoot = NewJob(".", 0);
+  pRoot->bFiles = !pOpts->subdirs; /* ScanDirs() ignores the root files */
+  PushJobs(0, &pRoot, 1);
+  for (i=0; i<ps.nWorkers; i++) {
+    if (pthread_create(pThreads+nThreads, NULL, WorkerThread, (void *)(intptr_t)i)) break;
+    nThreads += 1;
+  }
+  if (nThreads) {
+#if HAS_INDEX
+    if (pszIndex) {
+      WaitForJob(pRoot);
+      if (pRoot->valid) IndexAddJob(pRoot);
+    }
+#endif
+    if (!pOpts->subdirs) {
+      *pSize = ShowJobFiles(pRoot, pOpts);
+    } else {
+      *pSize = ShowJobDirs(pRoot, pOpts);
+    }
+    for (i=0; i<nThreads; i++) pthread_join(pThreads[i], NULL);
+#if HAS_INDEX
+    if (pszIndex) IndexSave();
+#endif
+    for (i=0; i<=ps.nWorkers; i++) { /* Merge the workers and main accumulators */
+      jobtotals *pT = ps.pTotals + i;
+      int j;
+      ADD_SIZES(jt.size, pT->size);
+      jt.nFiles += pT->nFiles;
+      jt.nDirs += pT->nDirs;
+      for (j=0; j<pT->topFiles.n; j++) {
+	TopAdd(&topFiles, &pT->topFiles.pEntries[j].sizes, pT->topFiles.pEntries[j].path);
+	free(pT->topFiles.pEntries[j].path);
+      }
+      free(pT->topFiles.pEntries);
+      for (j=0; j<HIST_BUCKETS; j++) {
+	hist.nFiles[j] += pT->hist.nFiles[j];
+	hist.size[j] += pT->hist.size[j];
+      }
+    }
+#if HAS_HARDLINKS
+    jt.size.size -= ps.dupSize.size;
+    jt.size.alloc -= ps.dupSize.alloc;
+    jt.nFiles -= ps.nDupFiles;
+#endif
+    if (iVerbose) {
+      char szSize[80];
+      int n = Size2StringWithUnit(szSize, jt.size.size);
+      if (iAlloc) {
+	n += sprintf(szSize+n, " (");
+	n += Size2StringWithUnit(szSize+n, jt.size.alloc);
+	sprintf(szSize+n, " allocated)");
+      }
+      fprintf(stderr, "Scanned %ld directories, and %ld files totaling %s, with %d threads.\n",
+	      jt.nDirs, jt.nFiles, szSize, nThreads);
+    }
+  } else { /* No thread could be started. Use the serial version. */
+    DEBUG_PRINTF(("// Cannot create threads. Falling back to ScanFiles().\n"));
+    PopJob(0);
+#if HAS_INDEX
+    if (pszIndex && di.pOld) munmap(di.pOld, di.oldSize);
+    if (pszIndex) free(di.pszSkipDir);
+#endif
+  }
+  FreeJob(pRoot);
+
+  close(ps.rootfd);
+  free(ps.rootpath);
+  for (i=0; i<ps.nWorkers; i++) {
+    pthread_mutex_destroy(&ps.pDeques[i].mutex);
+    free(ps.pDeques[i].ppJobs);
+  }
+  free(ps.pDeques);
+  free(ps.pTotals);
+  free(pThreads);
+  pthread_cond_destroy(&ps.doneCond);
+  pthread_cond_destroy(&ps.workCond);
+  pthread_mutex_destroy(&ps.mutex);
+  DEBUG_LEAVE(("return %d;\n", nThreads ? TRUE : FALSE));
+  return nThreads ? TRUE : FALSE;
+}
+
+#endif /* HAS_THREADS */
+
+/******************************************************************************
+*                                                                             *
+*   Function:       affiche                                                   *
 *                                                                             *
 *   Description:	Display the directory size found		      *
 *                                                                             *
 *   Arguments:                                                                *
 *                                                                             *
 *      char *path	Name of the directory				      *
-*      total_t size	Size found					      *
+*      sizeTotals *pSizes	Sizes found				      *
 *                                                                             *
 *   Return value:   0=Success; !0=Failure                                     *
 *                                                                             *
@@ -854,6 +2913,8 @@ total_t ScanDirs(scanOpts *pOpts, void *pConstraints) {
 *    2001-04-10 JFL Fixed a bug when displaying sizes with intermediates 0s.  *
 *    2012-01-17 JFL Made the size argument type a macro depending on the      *
 *                   compiler capabilities.                                    *
+*    2026-10-16 JFL Display the allocated size too with option -a.            *
+*    2026-10-16 JFL With --top, just record it in the top directories list.   *
 *                                                                             *
 ******************************************************************************/
 
@@ -911,13 +2972,33 @@ int Size2StringWithUnit(char *pBuf, total_t llSize) {
   return n;
 }
 
-void affiche(char *path, total_t llSize) {
+/* Idem for the apparent size, then optionally the allocated size. */
+int Sizes2String(char *pBuf, sizeTotals *pSizes) {
+  int n = Size2StringWithUnit(pBuf, pSizes->size);
+  if (iAlloc) {
+    n += sprintf(pBuf+n, "  ");
+    n += Size2StringWithUnit(pBuf+n, pSizes->alloc);
+  }
+  return n;
+}
+
+void affiche(char *path, sizeTotals *pSizes) {
   static int group=0;
   char szSize[40];
 
+  if (iTop) { /* Report it later, if it's among the largest */
+    if (TopWants(&topDirs, pSizes->size)) TopAdd(&topDirs, pSizes, path);
+    return;
+  }
+
   /* Display the size and path name */
-  Size2StringWithUnit(szSize, llSize);
-  printf("%15s  %s\n", szSize, path);
+  Size2StringWithUnit(szSize, pSizes->size);
+  printf("%15s  ", szSize);
+  if (iAlloc) {
+    Size2StringWithUnit(szSize, pSizes->alloc);
+    printf("%15s  ", szSize);
+  }
+  printf("%s\n", path);
 
   if (band && (++group == 5)) {
     group = 0;
@@ -1213,110 +3294,3 @@ long GetClusterSize(char drive)	{       /* Get cluster size */
 *                                                                             *
 ******************************************************************************/
 
-
-/*****************************************************************************\
-*                                                                             *
-*   Function:	    scandirX		 				      *
-*									      *
-*   Description:    Select entries in a directory			      *
-*									      *
-*   Arguments:	    const char *name	Directory name            	      *
-*		    dirent ***namelist  where to store the result array       *
-*		    int (*cbSelect)()   Selection callback function           *
-*		    int (CDECL *cbCompare)()  Comparison function for sorting *
-*		    void *pRef		Reference data to pass to cbSelect    *
-*									      *
-*   Return value:   # of entries in the array, or -1 if error.		      *
-*									      *
-*   Notes:	    Extension of the standard scandir routine, allowing to    *
-*		    pass arguments to the selection routine.
-*		    							      *
-*   History:								      *
-*    2012-01-11 JFL Initial implementation				      *
-*                                                                             *
-\*****************************************************************************/
-
-typedef int (CDECL *pCompareProc)(const void *item1, const void *item2);
-
-#ifdef _MSC_VER
-#pragma warning(disable:4706) /* Ignore the "assignment within conditional expression" warning */
-#endif
-
-int scandirX(const char *pszName,
-	     struct dirent ***resultList,
-	     int (*cbSelect) (const struct dirent *, void *pRef),
-	     int (CDECL *cbCompare) (const struct dirent **, const struct dirent **),
-	     void *pRef) {
-  int n = 0;
-  DIR *pDir;
-  struct dirent *pDirent;
-  struct dirent *pDirent2;
-  struct dirent **pList = NULL;
-  struct dirent **pList2;
-
-  DEBUG_ENTER(("scandirX(\"%s\", %p, %p, %p, %p);\n", pszName, resultList, cbSelect, cbCompare, pRef));
-
-  pDir = opendir(pszName);
-  if (!pDir) {
-    DEBUG_LEAVE(("return -1; // errno=%d\n", errno));
-    return -1;
-  }
-
-  while ((pDirent = readdir(pDir))) {
-    if (!pDirent->d_type) { /* Some filesystems don't set this field */
-      struct stat st;
-      NEW_PATHNAME_BUF(szName);
-#if PATHNAME_BUFS_IN_HEAP
-      if (!szName) {
-	finis(RETCODE_NO_MEMORY, "Out of memory");
-      }
-#endif
-      sprintf(szName, "%s/%s", pszName, pDirent->d_name);
-      lstat(szName, &st);
-      if (S_ISREG(st.st_mode)) pDirent->d_type = DT_REG;
-      if (S_ISDIR(st.st_mode)) pDirent->d_type = DT_DIR;
-#if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
-      if (S_ISLNK(st.st_mode)) pDirent->d_type = DT_LNK;
-#endif
-#if defined(S_ISBLK) && S_ISBLK(S_IFBLK) /* In DOS it's defined, but always returns 0 */
-      if (S_ISBLK(st.st_mode)) pDirent->d_type = DT_BLK;
-#endif
-#if defined(S_ISCHR) && S_ISCHR(S_IFCHR) /* In DOS it's defined, but always returns 0 */
-      if (S_ISCHR(st.st_mode)) pDirent->d_type = DT_CHR;
-#endif
-#if defined(S_ISFIFO) && S_ISFIFO(S_IFIFO) /* In DOS it's defined, but always returns 0 */
-      if (S_ISFIFO(st.st_mode)) pDirent->d_type = DT_FIFO;
-#endif
-#if defined(S_ISSOCK) && S_ISSOCK(S_IFSOCK) /* In DOS it's defined, but always returns 0 */
-      if (S_ISSOCK(st.st_mode)) pDirent->d_type = DT_SOCK;
-#endif
-      FREE_PATHNAME_BUF(szName);
-    }
-    if (cbSelect && !cbSelect(pDirent, pRef)) continue; /* We don't want this one. Continue search. */
-    /* OK, we've selected this one. So append a copy of this dirent to the list. */
-    n += 1;
-    pList2 = (struct dirent **)realloc(pList, n * sizeof(struct dirent *));
-    pDirent2 = malloc(sizeof(struct dirent));
-    if (!pList2 || !pDirent2) {
-      if (pDirent2) free(pDirent2);
-      for (n-=1; n>0; ) free(pList[--n]);
-      /* errno = ENOMEM; */ /* Out of memory. Should already be set by malloc failure */
-      DEBUG_LEAVE(("return -1; // errno=%d\n", errno));
-      return -1;
-    }
-    *pDirent2 = *pDirent;
-    pList = pList2;
-    pList[n-1] = pDirent2;
-  }
-
-  closedir(pDir);
-
-  if (cbCompare) qsort(pList, n, sizeof(struct dirent *), (pCompareProc)cbCompare);
-  *resultList = pList;
-  DEBUG_LEAVE(("return %d;\n", n));
-  return n;
-}
-
-#ifdef _MSC_VER
-#pragma warning(default:4706)
-#endif
@@ -146,13 +146,38 @@
 *    2018-12-18 JFL Added option -P to show the file copy progress.           *
 *		    Added option -- to force ending switches.                 *
 *		    Version 3.7.    					      *
+*    2026-10-16 JFL In Linux, copy files in the kernel with FICLONE reflinks, *
+*		    copy_file_range(), or sendfile(), before falling back to  *
+*		    the buffered copy.					      *
+*		    Bug fixes: The Linux build failed; The first source	      *
+*		    argument was taken as a switch; Links targets had garbage.*
+*		    Version 3.8.    					      *
+*    2026-10-16 JFL Added option -j [N] to copy files with N worker threads.  *
+*		    Version 3.9.    					      *
+*    2026-10-16 JFL Read each source and target directory only once, and      *
+*		    process them with a single merge of their sorted lists.   *
+*		    Version 3.10.    					      *
+*    2026-10-16 JFL Get each file metadata once per side, with fstatat()      *
+*		    relative to the directories, and use it for deciding,     *
+*		    copying, and setting the date. Option -v displays the     *
+*		    number of file system calls.			      *
+*		    Version 3.11.    					      *
+*    2026-10-16 JFL Added option --delta to rewrite only the changed blocks   *
+*		    of large files that already exist in the target.	      *
+*		    Version 3.12.    					      *
+*    2026-10-16 JFL Added option --direct to copy large files without going   *
+*		    through the page cache, with two buffers in flight.	      *
+*		    Version 3.13.    					      *
+*    2026-10-16 JFL In Linux, preallocate large target files, and copy only   *
+*		    the data extents of sparse files, keeping their holes.    *
+*		    Version 3.14.    					      *
 *                                                                             *
 *       © Copyright 2016-2018 Hewlett Packard Enterprise Development LP       *
 * Licensed under the Apache 2.0 license - www.apache.org/licenses/LICENSE-2.0 *
 \*****************************************************************************/
 
-#define PROGRAM_VERSION "3.7"
-#define PROGRAM_DATE    "2018-12-18"
+#define PROGRAM_VERSION "3.14"
+#define PROGRAM_DATE    "2026-10-16"
 
 #define _CRT_SECURE_NO_WARNINGS 1 /* Avoid Visual C++ 2005 security warnings */
 
@@ -273,6 +298,30 @@ off_t _filelength(int hFile);
 #define fullpath(absPath, relPath, maxLength) realpath(relPath, absPath)
 #define LocalFileTime localtime
 
+#if defined(__linux__) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 27)	/* copy_file_range() was added in glibc 2.27 */
+#define HAS_KERNEL_COPY 1	/* Copy files without going through user space */
+#include <sys/ioctl.h>		/* For ioctl() */
+#include <sys/sendfile.h>	/* For sendfile() */
+#include <linux/fs.h>		/* For FICLONE */
+#define KERNEL_COPY_CHUNK (16L * 1024L * 1024L) /* Bytes copied per call */
+#endif
+#endif
+
+#define HAS_THREADS 1		/* Copy files in parallel with option -j */
+#include <pthread.h>
+#include <sys/resource.h>	/* For getrlimit() */
+
+#define HAS_FSTATAT 1		/* Get file information relative to a directory fd */
+#include <fcntl.h>		/* For fstatat() and open() */
+
+#define HAS_DELTA 1		/* Rewrite only the changed blocks with option --delta */
+
+#if defined(__linux__)
+#define HAS_DIRECT_IO 1		/* Bypass the page cache with option --direct */
+#define HAS_SPARSE_COPY 1	/* Preallocate targets, and skip holes in sparse files */
+#endif
+
 #endif /* __unix__ */
 
 /********************** End of OS-specific definitions ***********************/
@@ -281,6 +330,36 @@ off_t _filelength(int hFile);
 #error "Unidentified OS. Please define OS-specific settings for it."
 #endif
 
+#ifndef HAS_KERNEL_COPY
+#define HAS_KERNEL_COPY 0
+#endif
+
+#ifndef HAS_THREADS
+#define HAS_THREADS 0
+#endif
+
+#ifndef HAS_FSTATAT
+#define HAS_FSTATAT 0
+#endif
+
+#ifndef HAS_DELTA
+#define HAS_DELTA 0
+#endif
+
+#ifndef HAS_DIRECT_IO
+#define HAS_DIRECT_IO 0
+#endif
+
+#ifndef HAS_SPARSE_COPY
+#define HAS_SPARSE_COPY 0
+#endif
+
+#ifdef __unix__
+#define namecmp strcmp			/* File names are case-sensitive */
+#else
+#define namecmp _stricmp		/* File names are case-insensitive */
+#endif
+
 #define PATHNAME_SIZE PATH_MAX
 #define NODENAME_SIZE (NAME_MAX+1)
 
@@ -316,6 +395,23 @@ static int iVerbose = FALSE;		/* Flag for displaying verbose information */
 static int copyempty = TRUE;		/* Flag for copying empty file */
 static int iPause = 0;			/* Flag for stop before exit */
 static int iProgress = 0;		/* Flag for showing a progress bar */
+#if HAS_DELTA
+static int iDelta = 0;			/* Flag for rewriting only changed blocks */
+#define DELTA_MIN_SIZE BUFFERSIZE	/* Smaller files are copied in full */
+#define DELTA_MAX_DIFF 10		/* Max size difference, in % of the source size */
+#define DELTA_BLOCK 4096		/* Size of the blocks compared and rewritten */
+off_t nDeltaSize = 0;			/* Total size of the files compared */
+off_t nDeltaWritten = 0;		/* Total size of the blocks rewritten */
+#endif
+#if HAS_DIRECT_IO
+static int iDirect = 0;			/* Flag for bypassing the page cache */
+#define DIRECT_BUFFERSIZE (8L * 1024L * 1024L) /* Each of the two buffers */
+#define DIRECT_MIN_SIZE (2 * DIRECT_BUFFERSIZE) /* Smaller files use the cache */
+#define DIRECT_ALIGN 4096		/* O_DIRECT buffer, offset & size alignment */
+#endif
+#if HAS_SPARSE_COPY
+#define PREALLOC_MIN_SIZE BUFFERSIZE	/* Smaller extents are not preallocated */
+#endif
 #ifdef __unix__
 static int iFnmFlag = 0;		/* Case-sensitive pattern matching */
 #else
@@ -327,6 +423,48 @@ static int iRecur = 0;			/* Recursive update */
 #define cp codePage			/* Initial console code page in iconv.c */
 #endif
 static int iErase = 0;			/* Flag indicating Erase mode */
+#if HAS_THREADS
+static int iJobs = 0;			/* If > 1, number of copy threads */
+#define MAX_JOBS 64			/* Each queued copy keeps two files open */
+#define FDS_RESERVED 16			/* Fds left for stdio and the directories scanned */
+#endif
+
+typedef struct _fileMeta {	/* A file metadata, read once */
+  int bExists;			    /* TRUE if the file exists. Else st is invalid. */
+  int bDirExists;		    /* TRUE if its parent directory is known to exist */
+  struct stat st;		    /* Its lstat() information */
+} fileMeta;
+
+typedef struct _copyJob {	/* A file copy, opened but not done yet */
+  char *name1;			    /* Source file pathname */
+  char *name2;			    /* Destination file pathname */
+  FILE *pfs;			    /* Source file */
+  FILE *pfd;			    /* Destination file */
+  off_t filelen;		    /* Number of bytes to copy */
+  struct stat stFrom;		    /* The source metadata, for copydateM() */
+#if HAS_DELTA
+  int bDelta;			    /* TRUE = Rewrite only the changed blocks */
+  off_t targetlen;		    /* The initial target size, if bDelta */
+  off_t nWritten;		    /* The number of bytes rewritten, if bDelta */
+#endif
+#if HAS_DIRECT_IO
+  int bDirect;			    /* TRUE = Bypass the page cache */
+#endif
+#if HAS_SPARSE_COPY
+  int bSparse;			    /* TRUE = Copy only the data extents */
+#endif
+  int iErr;			    /* 0 = Success, 1 = Read error, 2 = Write error */
+  int iErrno;			    /* The errno for that error */
+  int nSetCalls;		    /* Number of mode and time changes done */
+  int bDone;			    /* TRUE when a worker thread finished it */
+} copyJob;
+
+typedef struct _callCounts {	/* File system calls, displayed by option -v */
+  long nStat;			    /* lstat(), fstatat() */
+  long nOpen;			    /* fopen(), open(), opendir() */
+  long nSet;			    /* lchmod(), lutimes() */
+} callCounts;
+callCounts calls = {0};		/* Updated by the main thread only */
 
 /* Forward references */
 
@@ -334,12 +472,76 @@ char *version(int iVerbose);		/* Build the version string. If verbose, append li
 void usage(void);			/* Display usage */
 int IsSwitch(char *pszArg);		/* Is this a command-line switch? */
 int updateall(char *, char *);		/* Copy a set of files if newer */
-int update(char *, char *);		/* Copy a file if newer */
+typedef struct _dirEntryRec {	/* A directory entry in a dirList */
+  char *pszName;		    /* Its name */
+  size_t iName;			    /* Offset of that name while the list grows */
+  int iType;			    /* Its d_type */
+} dirEntryRec;
+typedef struct _dirList {	/* A sorted directory listing */
+  dirEntryRec *pEntries;	    /* The entries, sorted by name */
+  int nEntries;			    /* Their number */
+  int nAlloc;			    /* The size of the pEntries array */
+  char *pNames;			    /* All their names, NUL-terminated */
+  size_t lNames;		    /* The size used in pNames */
+  size_t lAlloc;		    /* The size of the pNames buffer */
+#if HAS_FSTATAT
+  DIR *pDir;			    /* The directory, still open for fstatat() */
+#endif
+} dirList;
+int ReadDirList(const char *pszDir, dirList *pList); /* Read a directory once */
+void FreeDirList(dirList *pList);	/* Free the memory it used */
+int update(char *, char *, fileMeta *, fileMeta *); /* Copy a file if newer */
 #if defined(S_ISLNK) && S_ISLNK(S_IFLNK)/* In DOS it's defined, but always returns 0 */
-int update_link(char *, char *);	/* Copy a link if newer */
+int update_link(char *, char *, fileMeta *, fileMeta *); /* Copy a link if newer */
+#endif
+int GetFileMeta(int hDir, char *pszName, char *pszPath, fileMeta *pMeta); /* Get it once */
+int copyf(char *, char *, struct stat *, struct stat *); /* Copy a file silently */
+int CopyData(copyJob *pJob, char *pBuf, int iShowProgress); /* Finish what copyf started */
+#if HAS_DELTA
+int CopyDelta(int hFrom, int hTo, off_t offset, size_t length, char *pBuf, off_t *pnWritten);
+#endif
+#if HAS_DIRECT_IO
+typedef struct _directCopy {	/* The state of a copy with option --direct */
+  int hFrom;			    /* Source file handle */
+  int hTo;			    /* Destination file handle */
+  int bDirectFrom;		    /* TRUE if reading with O_DIRECT */
+  int bDirectTo;		    /* TRUE if writing with O_DIRECT */
+  char *pBuf;			    /* Two aligned DIRECT_BUFFERSIZE buffers */
+  int iBuf;			    /* Index of the buffer to read into next */
+  pthread_t hThread;		    /* The thread writing the other buffer */
+  int bWriting;			    /* TRUE if that thread is running */
+  char *pWrite;			    /* The data it writes */
+  size_t nWrite;		    /* Its size */
+  off_t offWrite;		    /* Where it writes it */
+  int iErr;			    /* Its result. 0 = Success, 2 = Write error */
+  int iErrno;			    /* The errno for that error */
+} directCopy;
+int DirectStart(directCopy *pDC, int hFrom, int hTo); /* Allocate buffers, set O_DIRECT */
+int CopyDirect(directCopy *pDC, off_t offset, size_t length); /* Copy one buffer */
+int DirectEnd(directCopy *pDC, int iErr); /* Finish the last write, and free buffers */
 #endif
-int copyf(char *, char *);		/* Copy a file silently */
-int copy(char *, char *);		/* Copy a file and display messages */
+#if HAS_SPARSE_COPY
+int Preallocate(int hFile, off_t offset, off_t length); /* Reserve space for data */
+int NextDataExtent(int hFrom, int hTo, off_t *pOffset, off_t *pDataEnd, off_t filelen);
+#endif
+#if HAS_THREADS
+void PipeStart(int nThreads);		/* Start the copy worker threads */
+int PipeAdd(copyJob *pJob);		/* Queue a copy for the worker threads */
+int PipeDrain(void);			/* Wait for all queued copies. Return # of errors */
+void PipeStop(void);			/* Stop the copy worker threads */
+int PipeFreeFd(void);			/* After EMFILE, wait for a copy to close its files */
+#else
+#define PipeFreeFd() FALSE
+#endif
+#if HAS_KERNEL_COPY
+/* Kernel copy methods, in the order they're tried */
+#define KCOPY_CLONE	0		/* ioctl(FICLONE). Btrfs, XFS, etc. */
+#define KCOPY_RANGE	1		/* copy_file_range() */
+#define KCOPY_SENDFILE	2		/* sendfile() */
+#define KCOPY_NONE	3		/* None works. Use the buffered copy. */
+off_t CopyInKernel(int hFrom, int hTo, off_t offset, off_t length, int *piMethod);
+#endif
+int copy(char *, char *, fileMeta *, fileMeta *); /* Copy a file and display messages */
 int mkdirp(const char *path, mode_t mode); /* Same as mkdir -p */
 
 int exists(char *name);			/* Does this pathname exist? (TRUE/FALSE) */
@@ -350,6 +552,7 @@ int is_directory(char *);		/* Is name a directory? -> TRUE/FALSE */
 int older(char *, char *);		/* Is file 1 older than file 2? */
 time_t getmodified(char *);		/* Get time of file modification */
 int copydate(char *to, char *from);	/* Copy the file date & time */
+int copydateM(char *to, struct stat *pstFrom); /* Faster, if we have the source info */
 
 char *strgfn(const char *);		/* Get file name position */
 void stcgfn(char *, const char *);	/* Get file name */
@@ -452,6 +655,20 @@ int main(int argc, char *argv[]) {
 	continue;
       }
       )
+#if HAS_DELTA
+      if (streq(opt, "-delta")) {   /* Rewrite only the changed blocks */
+	iDelta = TRUE;
+	if (iVerbose) printf("Delta mode on.\n");
+	continue;
+      }
+#endif
+#if HAS_DIRECT_IO
+      if (streq(opt, "-direct")) {  /* Bypass the page cache */
+	iDirect = TRUE;
+	if (iVerbose) printf("Direct I/O mode on.\n");
+	continue;
+      }
+#endif
       if (   streq(opt, "e")	    /* Erase mode on */
 	  || streq(opt, "-erase")) {
 	iErase = TRUE;
@@ -483,6 +700,25 @@ int main(int argc, char *argv[]) {
 	if (iVerbose) printf("Case-insensitive pattern matching.\n");
 	continue;
       }
+#if HAS_THREADS
+      if (   streq(opt, "j")	    /* Number of copy threads */
+	  || streq(opt, "-jobs")) {
+	iJobs = 0;		    /* Default: One per processor */
+	if (((iArg+1) < argc) && !IsSwitch(argv[iArg+1])) {
+	  char *pc2;
+	  long l = strtol(argv[iArg+1], &pc2, 10);
+	  if (!*pc2) { /* It's a valid number */
+	    iJobs = (int)l;
+	    iArg += 1;
+	  }
+	}
+	if (iJobs <= 0) iJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (iJobs <= 0) iJobs = 1;
+	if (iJobs > MAX_JOBS) iJobs = MAX_JOBS;
+	if (iVerbose) printf("Copy files with %d threads.\n", iJobs);
+	continue;
+      }
+#endif
       if (   streq(opt, "k")	    /* Case-sensitive pattern matching */
 	  || streq(opt, "-casesensitive")) {
 	iFnmFlag &= ~FNM_CASEFOLD;
@@ -553,7 +789,9 @@ int main(int argc, char *argv[]) {
 	continue;
       }
       fprintf(stderr, "Warning: Unrecognized switch %s ignored.\n", arg);
+      continue;
     }
+    break;			    /* This is the first source file argument */
   }
 
   if ( (argc - iArg) < 1 ) {
@@ -593,9 +831,32 @@ int main(int argc, char *argv[]) {
   }
 #endif
 
+#if HAS_THREADS
+  if ((iJobs > 1) && !test) PipeStart(iJobs);
+#endif
+
   for ( ; iArg < argc; iArg++) { /* For every source file before that */
     arg = argv[iArg];
     nErrors += updateall(arg, target);
+#if HAS_THREADS
+    /* Finish these copies, in case the next argument has files with the same names */
+    nErrors += PipeDrain();
+#endif
+  }
+
+#if HAS_THREADS
+  PipeStop();
+#endif
+
+  if (iVerbose) {
+    printf("File system calls: %ld stat, %ld open, %ld set mode or time.\n",
+	   calls.nStat, calls.nOpen, calls.nSet);
+#if HAS_DELTA
+    if (iDelta) {
+      printf("Delta mode: Rewrote %"PRIdMAX" bytes out of %"PRIdMAX".\n",
+	     (intmax_t)nDeltaWritten, (intmax_t)nDeltaSize);
+    }
+#endif
   }
 
   if (nErrors) { /* Display a final summary, as the errors may have scrolled up beyond view */
@@ -650,6 +911,16 @@ Switches:\n\
 "\
   -d|--debug    Output debug information.\n"
 #endif
+#if HAS_DELTA
+"\
+  --delta       Delta mode. For large files that already exist, and have about\n\
+                the same size, rewrite only the blocks that changed.\n"
+#endif
+#if HAS_DIRECT_IO
+"\
+  --direct      Direct I/O mode. Copy files of 16 MB or more without filling\n\
+                the system file cache. Useful with files larger than RAM.\n"
+#endif
 "\
   -e|--erase    Erase mode. Delete destination files not in the source.\n\
   -E|--noempty  Noempty mode. Don't copy empty file.\n\
@@ -659,7 +930,12 @@ Switches:\n\
   -f|--freshen  Freshen mode. Update only files that exist in both directories.\n\
   -F|--force    Force mode. Overwrite read-only files.\n\
   -h|--help|-?  Display this help screen.\n\
-  -i|--ignorecase    Case-insensitive pattern matching. Default for DOS/Windows.\n\
+  -i|--ignorecase    Case-insensitive pattern matching. Default for DOS/Windows.\n"
+#if HAS_THREADS
+"\
+  -j|--jobs [N] Copy files with N threads. Default: 1 per processor.\n"
+#endif
+"\
   -k|--casesensitive Case-sensitive pattern matching. Default for Unix.\n"
 #ifdef _WIN32
 "\
@@ -719,6 +995,135 @@ int IsSwitch(char *pszArg)
            ); /* It's a switch */
     }
 
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    ReadDirList						      |
+|                                                                             |
+|   Description:    Read a whole directory, and sort its entries by name      |
+|                                                                             |
+|   Parameters:     const char *pszDir	    The directory pathname	      |
+|                   dirList *pList	    Where to store the listing	      |
+|                                                                             |
+|   Return value:   0 = Success, else -1 and errno set			      |
+|                                                                             |
+|   Notes:	    Skips the . and .. entries.				      |
+|		    All names are stored in a single buffer, which grows as   |
+|		    needed. So the name pointers are only set at the end.     |
+|		    The list must be freed with FreeDirList(), even after an  |
+|		    error. If HAS_FSTATAT, the directory remains open until   |
+|		    then, so that the caller can use dirfd(pList->pDir).      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.				      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+static int CompareDirEntries(const void *p1, const void *p2) {
+  return namecmp(((dirEntryRec *)p1)->pszName, ((dirEntryRec *)p2)->pszName);
+}
+
+int ReadDirList(const char *pszDir, dirList *pList) {
+  DIR *pDir;
+  struct dirent *pDE;
+  int i;
+
+  memset(pList, 0, sizeof(dirList));
+  do {
+    calls.nOpen += 1;
+    pDir = opendir(pszDir);
+  } while ((!pDir) && PipeFreeFd());
+  if (!pDir) return -1;
+  while ((pDE = readdir(pDir)) != NULL) {
+    size_t l;
+    if (streq(pDE->d_name, ".") || streq(pDE->d_name, "..")) continue;
+    l = strlen(pDE->d_name) + 1;
+    if (pList->nEntries == pList->nAlloc) {
+      int nAlloc = pList->nAlloc ? 2 * pList->nAlloc : 64;
+      dirEntryRec *pEntries = realloc(pList->pEntries, nAlloc * sizeof(dirEntryRec));
+      if (!pEntries) break;
+      pList->pEntries = pEntries;
+      pList->nAlloc = nAlloc;
+    }
+    if ((pList->lNames + l) > pList->lAlloc) {
+      size_t lAlloc = 2 * (pList->lAlloc + l) + 1024;
+      char *pNames = realloc(pList->pNames, lAlloc);
+      if (!pNames) break;
+      pList->pNames = pNames;
+      pList->lAlloc = lAlloc;
+    }
+    memcpy(pList->pNames + pList->lNames, pDE->d_name, l);
+    pList->pEntries[pList->nEntries].iName = pList->lNames;
+    pList->pEntries[pList->nEntries].iType = pDE->d_type;
+    pList->nEntries += 1;
+    pList->lNames += l;
+  }
+#if HAS_FSTATAT
+  pList->pDir = pDir;
+#else
+  closedir(pDir);
+#endif
+  if (pDE) {		/* We broke out of the loop */
+    errno = ENOMEM;
+    return -1;
+  }
+  for (i = 0; i < pList->nEntries; i++) {
+    pList->pEntries[i].pszName = pList->pNames + pList->pEntries[i].iName;
+  }
+  qsort(pList->pEntries, pList->nEntries, sizeof(dirEntryRec), CompareDirEntries);
+  DEBUG_PRINTF(("// Read %d entries in \"%s\"\n", pList->nEntries, pszDir));
+  return 0;
+}
+
+void FreeDirList(dirList *pList) {
+#if HAS_FSTATAT
+  if (pList->pDir) closedir(pList->pDir);
+#endif
+  free(pList->pEntries);
+  free(pList->pNames);
+  memset(pList, 0, sizeof(dirList));
+}
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    GetFileMeta						      |
+|                                                                             |
+|   Description:    Get a file metadata with a single system call	      |
+|                                                                             |
+|   Parameters:     int hDir	    Its directory fd, or -1 if not available  |
+|                   char *pszName   Its name in that directory		      |
+|                   char *pszPath   Its pathname, used if hDir is -1	      |
+|                   fileMeta *pMeta Where to store the information	      |
+|                                                                             |
+|   Return value:   0 = Success, else -1 and errno set			      |
+|                                                                             |
+|   Notes:	    Does not follow links, like lstat().		      |
+|		    The fstatat() call avoids parsing the whole pathname      |
+|		    again in the kernel.				      |
+|		    A missing file is not an error for the callers, so it     |
+|		    sets pMeta->bExists, and then the callers don't need to   |
+|		    check the return value.				      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.				      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+int GetFileMeta(int hDir, char *pszName, char *pszPath, fileMeta *pMeta) {
+  int err;
+
+  calls.nStat += 1;
+#if HAS_FSTATAT
+  if (hDir != -1) {
+    err = fstatat(hDir, pszName, &pMeta->st, AT_SYMLINK_NOFOLLOW);
+  } else
+#endif
+  err = lstat(pszPath, &pMeta->st);
+  pMeta->bExists = !err;
+  pMeta->bDirExists = !err || (errno == ENOENT && hDir != -1);
+  DEBUG_PRINTF(("// GetFileMeta(%d, \"%s\") = %d\n", hDir, pszName, err));
+  return err;
+}
+
 /*---------------------------------------------------------------------------*\
 *                                                                             *
 |   Function:	    updateall						      |
@@ -731,9 +1136,16 @@ int IsSwitch(char *pszArg)
 |   Return value:   The number of errors encountered. 0=Success               |
 |                                                                             |
 |   Notes:	    Copy files, except if a newer version is already there.   |
+|		    							      |
+|		    Reads the source directory once, and the target directory |
+|		    once in erase mode, into sorted lists. Then a single      |
+|		    merge of the two lists finds the files to copy, the       |
+|		    subdirectories to update, and the target entries to       |
+|		    delete. Everything is done in the names order.	      |
 |                                                                             |
 |   History:								      |
 |    2011-09-06 JFL Added the ability to update to a file with a differ. name.|
+|    2026-10-16 JFL Read each directory once, and merge the sorted lists.     |
 *                                                                             *
 \*---------------------------------------------------------------------------*/
 
@@ -753,8 +1165,14 @@ int updateall(char *p1,             /* Wildcard * and ? are interpreted */
     char *fullpathname, *path3;
 #endif
     char *ppath, *pname;
-    DIR *pDir;
-    struct dirent *pDE;
+    dirList srcList = {0};	/* The source directory entries */
+    dirList dstList = {0};	/* The target directory entries, in erase mode */
+    int iSrc, iDst;		/* Indexes in these two lists */
+    char *pszTargetDir = NULL;	/* Absolute pathname of the target directory */
+    int hSrcDir = -1;		/* The source directory fd, if available */
+    int hDstDir = -1;		/* The target directory fd, if available */
+    int hEraseDir = -1;		/* The erase mode directory fd, if available */
+    fileMeta meta1, meta2;	/* The source and target files metadata */
     char *pattern;
     int err;
     int nErrors = 0;
@@ -828,123 +1246,144 @@ int updateall(char *p1,             /* Wildcard * and ? are interpreted */
       DEBUG_PRINTF(("// The target is directory %s\n", ppath));
     }
     iTargetDirExisted = is_directory(ppath);
+#if HAS_FSTATAT
+    if (iTargetDirExisted) {
+      do {
+	calls.nOpen += 1;
+	hDstDir = open(ppath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      } while ((hDstDir == -1) && PipeFreeFd());
+    }
+#endif
 
     /* Note: Scan the source directory even in the absence of wildcards.
        In Windows, this makes sure that the copy has the same case as
        the source, even if the command-line argument has a different case. */
 
-    /* Scan all files that match the wild cards */
-    pDir = opendir(path0);
-    if (!pDir) {
+    /* Read the source directory once */
+    if (ReadDirList(path0, &srcList)) {
       printError("Error: can't open directory \"%s\": %s", path0, strerror(errno));
       nErrors += 1;
       goto cleanup_and_return;
     }
-    while ((pDE = readdir(pDir))) {
-      DEBUG_PRINTF(("// Dir Entry \"%s\" d_type=%d\n", pDE->d_name, (int)(pDE->d_type)));
-      if (   (pDE->d_type != DT_REG)
-#if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
-      	  && (pDE->d_type != DT_LNK)
+#if HAS_FSTATAT
+    hSrcDir = dirfd(srcList.pDir);
 #endif
-      	 ) continue;	/* We want only files or links */
-      if (fnmatch(pattern, pDE->d_name, iFnmFlag) == FNM_NOMATCH) continue;
-      strmfp(path1, path0, pDE->d_name);  /* Compute source path */
-      DEBUG_PRINTF(("// Found %s\n", path1));
-      strmfp(path2, ppath, pname?pname:pDE->d_name); /* Append it to directory p2 too */
-#if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
-      if (pDE->d_type == DT_LNK) {
-	err = update_link(path1, path2); /* Displays error messages on stderr */
+    /* In erase mode, read the target directory once too */
+    if (iErase) {
+      pszTargetDir = malloc(PATHNAME_SIZE);
+      if (!pszTargetDir) {
+	printError("Error: Not enough memory");
+	nErrors += 1;
+	goto cleanup_and_return;
       }
-      else
+      fullpath(pszTargetDir, p2, PATHNAME_SIZE); /* Build absolute pathname of target */
+      ReadDirList(p2, &dstList); /* If it does not exist, there's nothing to erase */
+#if HAS_FSTATAT
+      if (dstList.pDir) hEraseDir = dirfd(dstList.pDir);
 #endif
-      {
-      	err = update(path1, path2); /* Does not display error messages on stderr */
-	if (err) {
-	  printError("Error: Failed to create \"%s\". %s", path2, strerror(errno));
-	}
-      }
-      if (err) {
-      	nErrors += 1;
-      	/* Continue the directory scan, looking for other files to update */
-      }
     }
-    closedir(pDir);
 
-    /* Scan target files that might be erased */
-    if (iErase) {
-      fullpath(path2, p2, PATHNAME_SIZE); /* Build absolute pathname of source */
-      pDir = opendir(p2);
-      if (pDir) {
-	while ((pDE = readdir(pDir))) {
-	  struct stat sStat;
-	  if (streq(pDE->d_name, ".")) continue;    /* Skip the . directory */
-	  if (streq(pDE->d_name, "..")) continue;   /* Skip the .. directory */
-	  DEBUG_PRINTF(("// Dir Entry \"%s\" d_type=%d\n", pDE->d_name, (int)(pDE->d_type)));
-	  if (fnmatch(pattern, pDE->d_name, iFnmFlag) == FNM_NOMATCH) continue;
-	  strmfp(path3, path2, pDE->d_name);  /* Compute the target file pathname */
-	  DEBUG_PRINTF(("// Found %s\n", path3));
-	  strmfp(path1, path0, pDE->d_name); /* Compute the corresponding source file pathname */
-	  if (access(path1, F_OK) == -1) { /* If that source file does not exist */
-	    char *pszType = "file";
-#if _DIRENT2STAT_DEFINED /* MsvcLibX return DOS/Windows stat info in the dirent structure */
-	    err = dirent2stat(pDE, &sStat);
-#else /* Unix has to query it separately */
-	    err = -lstat(path3, &sStat); /* If error, iErr = 1 = # of errors */
+    /* Merge the two sorted lists */
+    for (iSrc = iDst = 0; (iSrc < srcList.nEntries) || (iDst < dstList.nEntries); ) {
+      dirEntryRec *pSrc = NULL;	/* The source entry, if any */
+      dirEntryRec *pDst = NULL;	/* The target entry with the same name, if any */
+      int iDiff;
+      if (iSrc == srcList.nEntries) {
+	iDiff = 1;
+      } else if (iDst == dstList.nEntries) {
+	iDiff = -1;
+      } else {
+	iDiff = namecmp(srcList.pEntries[iSrc].pszName, dstList.pEntries[iDst].pszName);
+      }
+      if (iDiff <= 0) pSrc = srcList.pEntries + iSrc++;
+      if (iDiff >= 0) pDst = dstList.pEntries + iDst++;
+
+      if (!pSrc) { /* This target entry is not in the source. Erase it. */
+	char *pszType = "file";
+	DEBUG_PRINTF(("// Target Entry \"%s\" d_type=%d\n", pDst->pszName, pDst->iType));
+	if (fnmatch(pattern, pDst->pszName, iFnmFlag) == FNM_NOMATCH) continue;
+	strmfp(path3, pszTargetDir, pDst->pszName);  /* Compute the target file pathname */
+	DEBUG_PRINTF(("// Found %s\n", path3));
+	strmfp(path1, path0, pDst->pszName); /* Compute the corresponding source file pathname */
+	err = -GetFileMeta(hEraseDir, pDst->pszName, path3, &meta2); /* If error, iErr = 1 = # of errors */
+	if (err) {
+	  printError("Error: Can't stat \"%s\"", path1);
+	  nErrors += 1;
+	  continue;
+	}
+	switch (pDst->iType) {
+	  case DT_DIR:
+	    err = zapDirM(path3, meta2.st.st_mode, &zo);
+	    nErrors += err;
+	    break;
+#if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
+	  case (DT_LNK):
+	    pszType = "link";
+	    // Fall through
 #endif
+	  case DT_REG:
+	    err = zapFileM(path3, meta2.st.st_mode, &zo);
 	    if (err) {
-	      printError("Error: Can't stat \"%s\"", path1);
+	      printError("Error: Failed to remove %s \"%s\"", pszType, path3);
 	      nErrors += 1;
-	      continue;
 	    }
-	    switch (pDE->d_type) {
-	      case DT_DIR:
-		err = zapDirM(path3, sStat.st_mode, &zo);
-		nErrors += err;
-		break;
+	    break;
+	  default:
+	    printError("Error: Can't delete \"%s\"", path3);
+	    nErrors += 1;
+	    break;
+	}
+	continue;
+      }
+
+      DEBUG_PRINTF(("// Dir Entry \"%s\" d_type=%d\n", pSrc->pszName, pSrc->iType));
+      if (   (pSrc->iType == DT_REG)
 #if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
-	      case (DT_LNK):
-	      	pszType = "link";
-		// Fall through
+	  || (pSrc->iType == DT_LNK)
 #endif
-	      case DT_REG:
-	      	err = zapFileM(path3, sStat.st_mode, &zo);
-		if (err) {
-		  printError("Error: Failed to remove %s \"%s\"", pszType, path3);
-		  nErrors += 1;
-		}
-		break;
-	      default:
-		printError("Error: Can't delete \"%s\"", path3);
-		nErrors += 1;
-		break;
-	    }
+	 ) {	/* Files or links */
+	if (fnmatch(pattern, pSrc->pszName, iFnmFlag) == FNM_NOMATCH) continue;
+	strmfp(path1, path0, pSrc->pszName);  /* Compute source path */
+	DEBUG_PRINTF(("// Found %s\n", path1));
+	strmfp(path2, ppath, pname?pname:pSrc->pszName); /* Append it to directory p2 too */
+	GetFileMeta(hSrcDir, pSrc->pszName, path1, &meta1);
+	if (iTargetDirExisted) {
+	  GetFileMeta(hDstDir, pname?pname:pSrc->pszName, path2, &meta2);
+	} else { /* Then none of the target files exists */
+	  meta2.bExists = meta2.bDirExists = FALSE;
+	}
+#if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
+	if (pSrc->iType == DT_LNK) {
+	  err = update_link(path1, path2, &meta1, &meta2); /* Displays error messages on stderr */
+	}
+	else
+#endif
+	{
+	  err = update(path1, path2, &meta1, &meta2); /* Does not display error messages on stderr */
+	  if (err) {
+	    printError("Error: Failed to create \"%s\". %s", path2, strerror(errno));
 	  }
 	}
-      }
-    }
-
-    if (iRecur) { /* Parse the directory again, looking for actual directories (not junctions nor symlinkds) */
-      pDir = opendir(path0);
-      if (!pDir) {
-	printError("Error: Can't open directory \"%s\": %s", path0, strerror(errno));
-      	nErrors += 1;
-        goto cleanup_and_return;
-      }
-      while ((pDE = readdir(pDir))) {
+	if (err) {
+	  nErrors += 1;
+	  /* Continue the directory scan, looking for other files to update */
+	}
+      } else if (iRecur && (pSrc->iType == DT_DIR)) { /* Actual directories (not junctions nor symlinkds) */
       	int p2_exists, p2_is_dir;
 
-	DEBUG_PRINTF(("// Dir Entry \"%s\" d_type=%d\n", pDE->d_name, (int)(pDE->d_type)));
-	if (pDE->d_type != DT_DIR) continue;	/* We want only directories */
-	if (streq(pDE->d_name, ".") || streq(pDE->d_name, "..")) continue; /* These are not real subdirs */
-
-	strmfp(path3, path0, pDE->d_name); /* Source subdirectory path: path3 = path0/d_name */
+	strmfp(path3, path0, pSrc->pszName); /* Source subdirectory path: path3 = path0/d_name */
 	fullpath(fullpathname, path3, PATHNAME_SIZE); /* Build absolute pathname of source dir */
 	strmfp(path1, path3, pattern);	   /* Search pattern: path1 = path3/pattern */
-	strmfp(path2, ppath, pDE->d_name); /* Destination subdirectory path: path2 = ppath/dname */
+	strmfp(path2, ppath, pSrc->pszName); /* Destination subdirectory path: path2 = ppath/dname */
 	strcat(path2, DIRSEPARATOR_STRING);/* Make sure the target path gets created if needed */
 
-	p2_exists = exists(path2);
-	p2_is_dir = is_directory(path2);
+	if (iTargetDirExisted) {
+	  GetFileMeta(hDstDir, pSrc->pszName, path2, &meta2);
+	} else { /* Then it does not exist */
+	  meta2.bExists = FALSE;
+	}
+	p2_exists = meta2.bExists;
+	p2_is_dir = p2_exists && S_ISDIR(meta2.st.st_mode);
 	if ((!p2_exists) || (!p2_is_dir)) {
 	  if (test == 1) {
 	    if (iVerbose) {
@@ -987,7 +1426,6 @@ int updateall(char *p1,             /* Wildcard * and ? are interpreted */
 	  copydate(path2, path3); /* Make sure the directory date matches too */
 	}
       }
-      closedir(pDir);
     }
 
     if ((!iTargetDirExisted) && is_directory(ppath)) { /* If we did create the target dir */
@@ -995,6 +1433,12 @@ int updateall(char *p1,             /* Wildcard * and ? are interpreted */
     }
 
 cleanup_and_return:
+#if HAS_FSTATAT
+    if (hDstDir != -1) close(hDstDir);
+#endif
+    FreeDirList(&srcList);
+    FreeDirList(&dstList);
+    free(pszTargetDir);
 #ifndef _MSDOS
     free(path0); free(path1); free(path2); free(path3); free(path); free(name); free(fullpathname);
 #endif
@@ -1012,6 +1456,8 @@ cleanup_and_return:
 |                                                                             |
 |   Parameters:     char *p1	    Source file pathname                      |
 |                   char *p2	    Destination file pathname		      |
+|                   fileMeta *pm1   Source file metadata		      |
+|                   fileMeta *pm2   Destination file metadata		      |
 |                                                                             |
 |   Return value:   0 = Success, else Error				      |
 |                                                                             |
@@ -1020,15 +1466,18 @@ cleanup_and_return:
 |   History:								      |
 |    2016-05-10 JFL Updated the test mode support, and fixed a bug when       |
 |                   using both the test mode and the showdest mode.           |
+|    2026-10-16 JFL Use the metadata from the caller, instead of getting it   |
+|                   again with exist_file(), file_empty(), lstat(), older().  |
 *                                                                             *
 \*---------------------------------------------------------------------------*/
 
 int update(char *p1,	/* Both names must be complete, without wildcards */
-           char *p2)
+           char *p2,
+           fileMeta *pm1,
+           fileMeta *pm2)
     {
     int e;
     char name[PATHNAME_SIZE];
-    struct stat sP2stat;
     char *p;
 
     DEBUG_ENTER(("update(\"%s\", \"%s\");\n", p1, p2));
@@ -1038,26 +1487,26 @@ int update(char *p1,	/* Both names must be complete, without wildcards */
     if (show) p = p2;	/* But in showdest mode, show the destination file name */
 
     /* In freshen mode, don't copy if the destination does not exist. */
-    if (fresh && !exist_file(p2)) RETURN_CONST(0);
+    if (fresh && !pm2->bExists) RETURN_CONST(0);
 
     /* In Noempty mode, don't copy empty file */
-    if ( (copyempty == FALSE) && (file_empty(p1)) ) RETURN_CONST(0);
+    if ( (copyempty == FALSE) && pm1->bExists && !pm1->st.st_size ) RETURN_CONST(0);
 
     /* If the target exists, make sure it's a file */
-    e = lstat(p2, &sP2stat); /* Use lstat to avoid following links */
-    if (e == 0) {
+    if (pm2->bExists) {
       zapOpts zo = {FLAG_VERBOSE | FLAG_RECURSE, "- "};
+      e = 0;
       if (test) zo.iFlags |= FLAG_NOEXEC;
       if (force) zo.iFlags |= FLAG_FORCE;
-      if (S_ISDIR(sP2stat.st_mode)) {	/* If the target is a directory */
+      if (S_ISDIR(pm2->st.st_mode)) {	/* If the target is a directory */
       	zo.iFlags |= FLAG_VERBOSE; /* Show what's deleted, beyond the obvious target itself */
-      	e = zapDirM(p2, sP2stat.st_mode, &zo);	/* Then remove it */
-	if (test) p2 = ""; /* Trick older() to think the target is deleted */
+      	e = zapDirM(p2, pm2->st.st_mode, &zo);	/* Then remove it */
+	pm2->bExists = FALSE;
 #if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
-      } else if (S_ISLNK(sP2stat.st_mode)) { /* Else if it's a link */
+      } else if (S_ISLNK(pm2->st.st_mode)) { /* Else if it's a link */
       	zo.iFlags &= ~FLAG_VERBOSE; /* No need to show that that target is deleted */
-	e = zapFileM(p2, sP2stat.st_mode, &zo);	/* Deletes the link, not its target. */
-	if (test) p2 = ""; /* Trick older() to think the target is deleted */
+	e = zapFileM(p2, pm2->st.st_mode, &zo);	/* Deletes the link, not its target. */
+	pm2->bExists = FALSE;
 #endif /* defined(S_ISLNK) */
       } /* Else the target is a plain file */
       if (e) {
@@ -1067,7 +1516,9 @@ int update(char *p1,	/* Both names must be complete, without wildcards */
     }
 
     /* In any mode, don't copy if the destination is newer than the source. */
-    if (older(p1, p2)) RETURN_CONST(0);
+    if (pm2->bExists && (!pm1->bExists || (pm1->st.st_mtime <= pm2->st.st_mtime))) {
+      RETURN_CONST_COMMENT(0, ("File %s is older than file %s\n", p1, p2));
+    }
 
     fullpath(name, p, PATHNAME_SIZE); /* Build absolute pathname of source */
     if (test == 1)
@@ -1082,7 +1533,7 @@ int update(char *p1,	/* Both names must be complete, without wildcards */
 
     if (!iVerbose) printf("%s\n", name);
 
-    e = copy(p1, p2);
+    e = copy(p1, p2, pm1, pm2);
 
     RETURN_INT_COMMENT(e, (e?"Error\n":"Success\n"));
     }
@@ -1111,6 +1562,7 @@ int exists(char *name) {
 
     DEBUG_ENTER(("exists(\"%s\");\n", name));
 
+    calls.nStat += 1;
     result = !lstat(name, &sstat); // Use lstat, as stat does not detect SYMLINKDs.
 
     RETURN_BOOL(result);
@@ -1125,6 +1577,7 @@ int is_link(char *name) {
 
     DEBUG_ENTER(("is_link(\"%s\");\n", name));
 
+    calls.nStat += 1;
     err = lstat(name, &sstat); // Use lstat, as stat does not set S_IFLNK.
     result = ((err == 0) && (S_ISLNK(sstat.st_mode)));
 
@@ -1133,7 +1586,9 @@ int is_link(char *name) {
 
 /* Copy link p1 onto link p2, if and only if p1 is newer. */
 int update_link(char *p1,	/* Both names must be complete, without wildcards */
-                char *p2)
+                char *p2,
+                fileMeta *pm1,	/* Their metadata */
+                fileMeta *pm2)
     {
     int err;
     char name[PATHNAME_SIZE];
@@ -1142,7 +1597,7 @@ int update_link(char *p1,	/* Both names must be complete, without wildcards */
 #if _MSVCLIBX_STAT_DEFINED
     struct stat sP1stat;
 #endif
-    struct stat sP2stat;
+    struct stat *pP2stat = &pm2->st;
     int bP2Exists;
     int bP2IsLink;
     char path[PATHNAME_SIZE];
@@ -1150,15 +1605,14 @@ int update_link(char *p1,	/* Both names must be complete, without wildcards */
 
     DEBUG_ENTER(("update_link(\"%s\", \"%s\");\n", p1, p2));
 
-    err = lstat(p2, &sP2stat); // Use lstat to avoid following links
-    bP2Exists = (err == 0);
-    bP2IsLink = (bP2Exists && (S_ISLNK(sP2stat.st_mode)));
+    bP2Exists = pm2->bExists;
+    bP2IsLink = (bP2Exists && (S_ISLNK(pP2stat->st_mode)));
 
     /* In freshen mode, don't copy if the destination does not exist. */
     if (fresh && !bP2IsLink) RETURN_CONST(0);
 
     /* In any mode, don't copy if the destination is newer than the source. */
-    if (bP2IsLink && older(p1, p2)) RETURN_CONST(0);
+    if (bP2IsLink && (!pm1->bExists || (pm1->st.st_mtime <= pP2stat->st_mtime))) RETURN_CONST(0);
 
     p = p1;		/* By default, show the source file name */
     if (show) p = p2;	/* But in showdest mode, show the destination file name */
@@ -1180,25 +1634,25 @@ int update_link(char *p1,	/* Both names must be complete, without wildcards */
       if (test) zo.iFlags |= FLAG_NOEXEC;
       if (force) zo.iFlags |= FLAG_FORCE;
       // First, in force mode, prevent failures if the target is read-only
-      if (force && !(sP2stat.st_mode & S_IWRITE)) {
-      	int iMode = sP2stat.st_mode | S_IWRITE;
+      if (force && !(pP2stat->st_mode & S_IWRITE)) {
+      	int iMode = pP2stat->st_mode | S_IWRITE;
       	DEBUG_PRINTF(("chmod(%p, 0x%X);\n", p2, iMode));
       	err = chmod(p2, iMode); /* Try making the target file writable */
       	DEBUG_PRINTF(("  return %d; // errno = %d\n", err, errno));
       }
-      if (S_ISDIR(sP2stat.st_mode)) {
+      if (S_ISDIR(pP2stat->st_mode)) {
       	zo.iFlags |= FLAG_VERBOSE; /* Show what's deleted, beyond the obvious target itself */
-	err = zapDirM(p2, sP2stat.st_mode, &zo);	/* Then remove it */
+	err = zapDirM(p2, pP2stat->st_mode, &zo);	/* Then remove it */
       } else { // It's a file or a link
       	zo.iFlags &= ~FLAG_VERBOSE; /* No need to show that that target is deleted */
-	err = zapFileM(p2, sP2stat.st_mode, &zo);	/* Then remove it */
+	err = zapFileM(p2, pP2stat->st_mode, &zo);	/* Then remove it */
       	if (err) printError("Error: Failed to remove \"%s\"", p2);
       }
       if (err) RETURN_INT(err);
     }
 
     strsfp(p2, path, NULL);
-    if (!exists(path)) {
+    if (!pm2->bDirExists && !exists(path)) {
       err = mkdirp(path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
       if (err) {
       	printError("Error: Failed to create directory \"%s\". %s", path, strerror(errno));
@@ -1206,11 +1660,12 @@ int update_link(char *p1,	/* Both names must be complete, without wildcards */
       }
     }
 
-    iSize = (int)readlink(p1, target1, sizeof(target1));
+    iSize = (int)readlink(p1, target1, sizeof(target1)-1);
     if (iSize < 0) { /* This may fail for Linux Sub-System Symbolic Links */
       printError("Error: Failed to read link \"%s\"", p1);
       RETURN_INT(1);
     }
+    target1[iSize] = '\0'; /* readlink() does not append a NUL */
     DEBUG_PRINTF(("// Target1=\"%s\", iSize=%d\n", target1, iSize));
 
     // e = copy(p1, p2);
@@ -1223,7 +1678,10 @@ int update_link(char *p1,	/* Both names must be complete, without wildcards */
     } else
 #endif
     err = symlink(target1, p2);
-    if (!err) copydate(p2, p1);
+    if (!err) {
+      copydateM(p2, &pm1->st);
+      calls.nSet += 2;
+    }
     if (err) {
       printError("Error: Failed to create link \"%s\". %s", p2, strerror(errno));
     }
@@ -1241,6 +1699,8 @@ int update_link(char *p1,	/* Both names must be complete, without wildcards */
 |                                                                             |
 |   Parameters:     char *name1	    Source file pathname                      |
 |                   char *name2	    Destination file pathname		      |
+|                   struct stat *pst1 Source file metadata		      |
+|                   struct stat *pst2 Target file metadata, or NULL	      |
 |                                                                             |
 |   Return value:   0 = Success						      |
 |                   1 = Read error					      |
@@ -1248,27 +1708,46 @@ int update_link(char *p1,	/* Both names must be complete, without wildcards */
 |                                                                             |
 |   Notes:	    Both names must be correct, and paths must exist.	      |
 |                                                                             |
+|		    With option -j, the files are opened here, then the copy  |
+|		    is queued for a worker thread, and copyf returns 0. Copy  |
+|		    errors are reported later by PipeAdd() or PipeDrain().    |
+|                                                                             |
+|		    With option --delta, if the target is a file with about   |
+|		    the same size, it's opened without truncating it, and     |
+|		    CopyData() rewrites only the blocks that changed.	      |
+|                                                                             |
+|		    With option --direct, large files are copied without      |
+|		    going through the page cache. See DirectStart().	      |
+|                                                                             |
+|		    Sparse files, which use less blocks than their size,      |
+|		    are copied extent by extent. See NextDataExtent().	      |
+|                                                                             |
 |   History:								      |
 |    2013-03-15 JFL Added resiliency:					      |
 |                   When reading fails to start, avoid deleting the target.   |
 |                   In case of error later on, delete incomplete copies.      |
 |    2016-05-10 JFL Added support for the --force option.                     |
+|    2026-10-16 JFL Try copying in the kernel first, with CopyInKernel().     |
+|    2026-10-16 JFL Moved the data copy loop to CopyData().		      |
+|    2026-10-16 JFL Get the file length from the caller's metadata.	      |
+|    2026-10-16 JFL Added support for the --delta option.		      |
+|    2026-10-16 JFL Added support for the --direct option.		      |
+|    2026-10-16 JFL Detect sparse files.				      |
 *                                                                             *
 \*---------------------------------------------------------------------------*/
 
 int copyf(char *name1,		    /* Source file to copy from */
-          char *name2)		    /* Destination file to copy to */
+          char *name2,		    /* Destination file to copy to */
+          struct stat *pst1,	    /* Source file metadata */
+          struct stat *pst2)	    /* Destination file metadata, or NULL */
     {
     FILE *pfs, *pfd;	    /* Source & destination file pointers */
-    int hsource;	    /* Source handle */
     off_t filelen;	    /* File length */
-    size_t tocopy;	    /* Number of bytes to copy in one pass */
+    char *pszMode = "wb";   /* Destination file open mode */
     int iShowCopying = FALSE;
     int nAttempt = 1;	    /* Force mode allows retrying a second time */
-    off_t offset;
-    int iWidth = 0;	    /* Number of characters in the iProgress output */
-    char *pszUnit = "B";    /* Unit used for iProgress output */
-    long lUnit = 1;	    /* Number of bytes for 1 iProgress unit */
+    copyJob job;
+    int e;
 
     DEBUG_ENTER(("copyf(\"%s\", \"%s\");\n", name1, name2));
     if (iVerbose
@@ -1280,14 +1759,16 @@ int copyf(char *name1,		    /* Source file to copy from */
 	  printf("\tCopying %s", name1);
 	}
 
-    pfs = fopen(name1, "rb");
+    do {
+      calls.nOpen += 1;
+      pfs = fopen(name1, "rb");
+    } while ((!pfs) && PipeFreeFd());
     if (!pfs) {
       if (iShowCopying) printf("\n");
       RETURN_INT_COMMENT(1, ("Can't open input file\n"));
     }
-    hsource = fileno(pfs);
 
-    filelen = _filelength(hsource);
+    filelen = pst1->st_size;
     /* Read 1 byte to test access rights. This avoids destroying the target
        if we don't have the right to read the source. */
     if (filelen && !fread(buffer, 1, 1, pfs)) {
@@ -1295,8 +1776,33 @@ int copyf(char *name1,		    /* Source file to copy from */
       RETURN_INT_COMMENT(1, ("Can't read the input file\n"));
     }
     fseek(pfs, 0, SEEK_SET);
+#if HAS_DELTA
+    job.bDelta = FALSE;
+    if (iDelta && pst2 && S_ISREG(pst2->st_mode) && (filelen >= DELTA_MIN_SIZE)) {
+      off_t diff = (pst2->st_size > filelen) ? (pst2->st_size - filelen) : (filelen - pst2->st_size);
+      if (diff <= ((filelen / 100) * DELTA_MAX_DIFF)) { /* Sizes are close enough */
+	job.bDelta = TRUE;
+	job.targetlen = pst2->st_size;
+	pszMode = "r+b";  /* Update the existing data in place */
+      }
+    }
+#endif
+#if HAS_DIRECT_IO
+    job.bDirect = iDirect && (filelen >= DIRECT_MIN_SIZE);
+#if HAS_DELTA
+    if (job.bDelta) job.bDirect = FALSE;
+#endif
+#endif
+#if HAS_SPARSE_COPY
+    job.bSparse = (((off_t)pst1->st_blocks * 512) < filelen); /* Some blocks are holes */
+#if HAS_DELTA
+    if (job.bDelta) job.bSparse = FALSE;
+#endif
+#endif
 retry_open_targetfile:
-    pfd = fopen(name2, "wb");
+    calls.nOpen += 1;
+    pfd = fopen(name2, pszMode);
+    if ((!pfd) && PipeFreeFd()) goto retry_open_targetfile;
     if (!pfd) {
       if ((errno == EACCES) && (nAttempt == 1) && force) {
       	struct stat sStat = {0};
@@ -1318,53 +1824,849 @@ retry_open_targetfile:
 
     if (iShowCopying) printf(" : %"PRIdPTR" bytes\n", filelen);
 
-    if (iProgress) {
-      if (filelen > (100*1024L*1024L)) {
-      	lUnit = 1024L*1024L;
-      	pszUnit = "MB";
-      } else if (filelen > (100*1024L)) {
-      	lUnit = 1024L;
-      	pszUnit = "KB";
-      }
+    job.name1 = name1;
+    job.name2 = name2;
+    job.pfs = pfs;
+    job.pfd = pfd;
+    job.filelen = filelen;
+    job.stFrom = *pst1;
+#if HAS_THREADS
+    if (iJobs > 1) {	/* Let a worker thread do the rest */
+      e = PipeAdd(&job);
+      RETURN_INT_COMMENT(e, (e?"Error\n":"Copy queued.\n"));
+    }
+#endif
+    e = CopyData(&job, buffer, iProgress);
+    calls.nSet += job.nSetCalls;
+#if HAS_DELTA
+    if (job.bDelta) {
+      nDeltaSize += filelen;
+      nDeltaWritten += job.nWritten;
     }
+#endif
 
-    for (offset = 0; offset < filelen; offset += tocopy) {
-      off_t remainder = filelen - offset;
-      tocopy = (size_t)min(BUFFERSIZE, remainder);
-      
-      if (iProgress) {
-      	int pc = (int)((offset * 100) / filelen);
-      	iWidth = printf("%3d%% (%"PRIdPTR"%s/%"PRIdPTR"%s)\r", pc, (offset/lUnit), pszUnit, (filelen/lUnit), pszUnit);
-      }
-      
-      XDEBUG_PRINTF(("fread(%p, %"PRIuPTR", 1, %p);\n", buffer, tocopy, pfs));
-      if (!fread(buffer, tocopy, 1, pfs)) {
-	if (iProgress && iWidth) printf("\n");
-	fclose(pfs);
-	fclose(pfd);
-	unlink(name2); /* Avoid leaving an incomplete file on the target */
-        RETURN_INT_COMMENT(1, ("Can't read the input file. Deleted the partial copy.\n"));
+    RETURN_INT_COMMENT(e, (e?"Error\n":"File copy complete.\n"));
+    }
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    CopyData						      |
+|                                                                             |
+|   Description:    Copy the data of a file opened by copyf		      |
+|                                                                             |
+|   Parameters:     copyJob *pJob	    The open files		      |
+|                   char *pBuf		    A BUFFERSIZE bytes buffer	      |
+|                   int iShowProgress	    TRUE = Display the progress	      |
+|                                                                             |
+|   Return value:   0 = Success						      |
+|                   1 = Read error					      |
+|                   2 = Write error					      |
+|                                                                             |
+|   Notes:	    Closes both files. Copies the source date and mode to the |
+|		    target if successful, else deletes the partial copy.      |
+|		    Also stores the result in pJob->iErr and pJob->iErrno,    |
+|		    and the number of system calls in pJob->nSetCalls.	      |
+|		    							      |
+|		    Worker threads call it too, so it must not use globals    |
+|		    that the main thread updates, nor the debug indentation.  |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Split off copyf().					      |
+|    2026-10-16 JFL Added the delta mode, using CopyDelta().		      |
+|    2026-10-16 JFL Added the direct I/O mode, using CopyDirect().	      |
+|    2026-10-16 JFL Preallocate the target. Skip the holes in sparse files.   |
+|    2026-10-16 JFL Try FICLONE before preallocating the target.	      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+int CopyData(copyJob *pJob, char *pBuf, int iShowProgress) {
+  FILE *pfs = pJob->pfs;    /* Source file */
+  FILE *pfd = pJob->pfd;    /* Destination file */
+  off_t filelen = pJob->filelen;
+  size_t tocopy;	    /* Number of bytes to copy in one pass */
+  off_t offset;
+  int iWidth = 0;	    /* Number of characters in the iProgress output */
+  char *pszUnit = "B";	    /* Unit used for iProgress output */
+  long lUnit = 1;	    /* Number of bytes for 1 iProgress unit */
+  int iErr = 0;
+#if HAS_KERNEL_COPY
+  int iMethod = KCOPY_CLONE; /* The first kernel copy method to try */
+#endif
+#if HAS_DIRECT_IO
+  directCopy dc;	    /* The direct I/O state, if pJob->bDirect */
+#endif
+#if HAS_SPARSE_COPY
+  off_t dataEnd = filelen;  /* End of the data extent being copied */
+#endif
+#if HAS_DELTA
+  pJob->nWritten = 0;
+#endif
+#if HAS_DIRECT_IO
+  if (pJob->bDirect && DirectStart(&dc, fileno(pfs), fileno(pfd))) {
+    pJob->bDirect = FALSE; /* Not enough memory. Use the normal copy. */
+  }
+#endif
+
+  if (iShowProgress) {
+    if (filelen > (100*1024L*1024L)) {
+      lUnit = 1024L*1024L;
+      pszUnit = "MB";
+    } else if (filelen > (100*1024L)) {
+      lUnit = 1024L;
+      pszUnit = "KB";
+    }
+  }
+
+  offset = 0;
+#if HAS_SPARSE_COPY
+#if HAS_KERNEL_COPY
+#ifdef FICLONE
+  /* Share the data blocks first. This needs no new space, and keeps the holes. */
+  if (   filelen
+#if HAS_DELTA
+      && !pJob->bDelta
+#endif
+      && !ioctl(fileno(pfd), FICLONE, fileno(pfs))) {
+    offset = filelen;
+  }
+#endif
+  iMethod = KCOPY_RANGE; /* Don't let CopyInKernel() clone the first extent only */
+#endif
+  if (offset < filelen) { /* Not cloned. Copy the data. */
+    if (pJob->bSparse) {
+      dataEnd = 0; /* Look for the first data extent */
+    } else {
+#if HAS_DELTA
+      if (!pJob->bDelta) /* Delta mode updates in place, needing little new space */
+#endif
+      iErr = Preallocate(fileno(pfd), 0, filelen);
+    }
+  }
+#endif
+
+  for ( ; !iErr && (offset < filelen); offset += tocopy) {
+    off_t remainder = filelen - offset;
+#if HAS_SPARSE_COPY
+    if (offset >= dataEnd) { /* Skip the hole, if any, up to the next data extent */
+      iErr = NextDataExtent(fileno(pfs), fileno(pfd), &offset, &dataEnd, filelen);
+      if (iErr || (offset >= filelen)) break; /* The file may end with a hole */
+      fseek(pfs, offset, SEEK_SET); /* In case the buffered copy is used */
+      fseek(pfd, offset, SEEK_SET);
+    }
+    remainder = dataEnd - offset;
+#endif
+    tocopy = (size_t)min(BUFFERSIZE, remainder);
+
+    if (iShowProgress) {
+      int pc = (int)((offset * 100) / filelen);
+      iWidth = printf("%3d%% (%"PRIdPTR"%s/%"PRIdPTR"%s)\r", pc, (offset/lUnit), pszUnit, (filelen/lUnit), pszUnit);
+    }
+
+#if HAS_DELTA
+    if (pJob->bDelta) { /* Compare with the target, using both halves of the buffer */
+      tocopy = (size_t)min(BUFFERSIZE / 2, remainder);
+      iErr = CopyDelta(fileno(pfs), fileno(pfd), offset, tocopy, pBuf, &pJob->nWritten);
+      if (iErr) break;
+      continue;
+    }
+#endif
+
+#if HAS_DIRECT_IO
+    if (pJob->bDirect) { /* Read the next buffer while the previous one is written */
+      tocopy = (size_t)min(DIRECT_BUFFERSIZE, remainder);
+      iErr = CopyDirect(&dc, offset, tocopy);
+      if (iErr) break;
+      continue;
+    }
+#endif
+
+#if HAS_KERNEL_COPY
+    if (iMethod != KCOPY_NONE) {
+      off_t copied = CopyInKernel(fileno(pfs), fileno(pfd), offset, remainder, &iMethod);
+      if (copied > 0) {
+	tocopy = (size_t)copied;
+	continue;
       }
-      if (!fwrite(buffer, tocopy, 1, pfd)) {
-	if (iProgress && iWidth) printf("\n");
-	fclose(pfs);
-	fclose(pfd);
-	unlink(name2); /* Avoid leaving an incomplete file on the target */
-        RETURN_INT_COMMENT(2, ("Can't write the output file. Deleted the partial copy.\n"));
+      /* None works. Continue with the buffered copy from the same offset. */
+      fseek(pfs, offset, SEEK_SET);
+      fseek(pfd, offset, SEEK_SET);
+    }
+#endif
+
+    XDEBUG_PRINTF(("fread(%p, %"PRIuPTR", 1, %p);\n", pBuf, tocopy, pfs));
+    if (!fread(pBuf, tocopy, 1, pfs)) {
+      iErr = 1;
+      DEBUG_PRINTF(("// Can't read the input file. Deleting the partial copy.\n"));
+      break;
+    }
+    if (!fwrite(pBuf, tocopy, 1, pfd)) {
+      iErr = 2;
+      DEBUG_PRINTF(("// Can't write the output file. Deleting the partial copy.\n"));
+      break;
+    }
+  }
+#if HAS_DIRECT_IO
+  if (pJob->bDirect) iErr = DirectEnd(&dc, iErr);
+#endif
+  if (iShowProgress && iWidth) {
+    if (iErr) printf("\n");
+    else printf("%*s\r", iWidth, "");
+  }
+#if HAS_DELTA
+  if (pJob->bDelta && !iErr && (pJob->targetlen > filelen)) {
+    if (ftruncate(fileno(pfd), filelen)) iErr = 2; /* Remove the extra data at the end */
+  }
+#endif
+#if HAS_SPARSE_COPY
+  if (pJob->bSparse && !iErr) {
+    fflush(pfd);
+    if (ftruncate(fileno(pfd), filelen)) iErr = 2; /* In case it ends with a hole */
+  }
+#endif
+
+  fclose(pfs);
+  fclose(pfd);
+
+  pJob->nSetCalls = 0;
+  if (iErr) {
+    pJob->iErrno = errno;
+    unlink(pJob->name2); /* Avoid leaving an incomplete file on the target */
+  } else {
+    copydateM(pJob->name2, &pJob->stFrom); /* & give the same date than the source file */
+    pJob->nSetCalls = 2;
+    DEBUG_PRINTF(("// File %s mode is read%s\n", pJob->name2,
+			access(pJob->name2, 6) ? "-only" : "/write"));
+    pJob->iErrno = 0;
+  }
+  errno = pJob->iErrno;
+  pJob->iErr = iErr;
+  return iErr;
+}
+
+#if HAS_DELTA || HAS_DIRECT_IO
+
+/* Read up to length bytes at offset. Return the number read, or -1 if error. */
+static ssize_t ReadAt(int hFile, char *pBuf, size_t length, off_t offset) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = pread(hFile, pBuf + done, length - done, offset + (off_t)done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (!n) break; /* End of file */
+    done += (size_t)n;
+  }
+  return (ssize_t)done;
+}
+
+#endif
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    CopyDelta						      |
+|                                                                             |
+|   Description:    Rewrite the blocks of a file part that changed	      |
+|                                                                             |
+|   Parameters:     int hFrom	    Source file handle			      |
+|                   int hTo	    Destination file handle		      |
+|                   off_t offset    Where the part begins, in both files      |
+|                   size_t length   Its size. At most BUFFERSIZE/2 bytes.     |
+|                   char *pBuf	    A BUFFERSIZE bytes buffer		      |
+|                   off_t *pnWritten Incremented by the # of bytes rewritten  |
+|                                                                             |
+|   Return value:   0 = Success						      |
+|                   1 = Read error					      |
+|                   2 = Write error					      |
+|                                                                             |
+|   Notes:	    Reads the source part in the first half of the buffer,    |
+|		    and the target part in the second half. Then compares     |
+|		    them in DELTA_BLOCK blocks, and writes each run of	      |
+|		    consecutive changed blocks with a single pwrite().	      |
+|		    Blocks beyond the end of the target are all changed.      |
+|		    							      |
+|		    Both files are local, so comparing the data directly is   |
+|		    faster than comparing checksums, which would require      |
+|		    reading both files anyway.				      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.				      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+#if HAS_DELTA
+
+int CopyDelta(int hFrom, int hTo, off_t offset, size_t length, char *pBuf, off_t *pnWritten) {
+  char *pFrom = pBuf;
+  char *pTo = pBuf + (BUFFERSIZE / 2);
+  ssize_t nTo;
+  size_t i, iRun;
+
+  if (ReadAt(hFrom, pFrom, length, offset) != (ssize_t)length) return 1;
+  nTo = ReadAt(hTo, pTo, length, offset);
+  if (nTo < 0) return 1;
+
+  for (i = 0; i < length; ) {
+    size_t l = (size_t)min(DELTA_BLOCK, length - i);
+    if (((ssize_t)(i + l) <= nTo) && !memcmp(pFrom + i, pTo + i, l)) {
+      i += l;
+      continue;
+    }
+    for (iRun = i; i < length; i += l) { /* Find the end of this run of changed blocks */
+      l = (size_t)min(DELTA_BLOCK, length - i);
+      if (((ssize_t)(i + l) <= nTo) && !memcmp(pFrom + i, pTo + i, l)) break;
+    }
+    XDEBUG_PRINTF(("pwrite(%d, %"PRIuPTR", %"PRIdMAX");\n", hTo, i - iRun, (intmax_t)(offset + iRun)));
+    while (iRun < i) {
+      ssize_t n = pwrite(hTo, pFrom + iRun, i - iRun, offset + (off_t)iRun);
+      if ((n < 0) && (errno == EINTR)) continue;
+      if (n <= 0) {
+	if (!n) errno = ENOSPC;
+	return 2;
       }
+      iRun += (size_t)n;
+      *pnWritten += n;
     }
-    if (iProgress && iWidth) printf("%*s\r", iWidth, "");
+  }
+  return 0;
+}
+
+#endif /* HAS_DELTA */
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    DirectStart						      |
+|                                                                             |
+|   Description:    Copy a file without going through the page cache	      |
+|                                                                             |
+|   Notes:	    The normal copy leaves the whole file in the page cache,  |
+|		    twice. For files larger than RAM, this evicts everything  |
+|		    else the system had cached, to no avail.		      |
+|		    							      |
+|		    DirectStart() sets O_DIRECT on both files, and allocates  |
+|		    two aligned DIRECT_BUFFERSIZE buffers. Then CopyDirect()  |
+|		    reads the next part into one buffer, while a helper	      |
+|		    thread writes the previous part from the other one. So    |
+|		    the disks are kept busy, without using the page cache.    |
+|		    DirectEnd() waits for the last write.		      |
+|		    							      |
+|		    If a file system does not support O_DIRECT, the copy goes |
+|		    through the page cache for that file, but then each part  |
+|		    is dropped from the cache with posix_fadvise(DONTNEED)    |
+|		    once it has been read, or written to disk.		      |
+|		    							      |
+|		    Only the file tail, if not aligned on DIRECT_ALIGN bytes, |
+|		    is written through the cache.			      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created these routines.				      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
 
-    fclose(pfs);
-    fclose(pfd);
+#if HAS_DIRECT_IO
 
-    copydate(name2, name1);	/* & give the same date than the source file */
+/* Set or clear O_DIRECT on a file. Return TRUE if done. */
+static int SetDirectIO(int hFile, int bDirect) {
+  int iFlags = fcntl(hFile, F_GETFL);
+  if (iFlags == -1) return FALSE;
+  iFlags = bDirect ? (iFlags | O_DIRECT) : (iFlags & ~O_DIRECT);
+  return !fcntl(hFile, F_SETFL, iFlags);
+}
 
-    DEBUG_PRINTF(("// File %s mode is read%s\n", name2,
-			access(name2, 6) ? "-only" : "/write"));
+/* The helper thread writing one buffer */
+static void *DirectWriteThread(void *pParam) {
+  directCopy *pDC = pParam;
+  size_t done = 0;
 
-    RETURN_INT_COMMENT(0, ("File copy complete.\n"));
+  if (pDC->bDirectTo && (pDC->nWrite % DIRECT_ALIGN)) { /* The unaligned tail */
+    SetDirectIO(pDC->hTo, FALSE);
+    pDC->bDirectTo = FALSE;
+  }
+  while (done < pDC->nWrite) {
+    ssize_t n = pwrite(pDC->hTo, pDC->pWrite + done, pDC->nWrite - done, pDC->offWrite + (off_t)done);
+    if ((n < 0) && (errno == EINTR)) continue;
+    if ((n < 0) && (errno == EINVAL) && pDC->bDirectTo) { /* Alignment not supported */
+      SetDirectIO(pDC->hTo, FALSE);
+      pDC->bDirectTo = FALSE;
+      continue;
+    }
+    if (n <= 0) {
+      pDC->iErr = 2;
+      pDC->iErrno = n ? errno : ENOSPC;
+      return pParam;
+    }
+    done += (size_t)n;
+  }
+  if (!pDC->bDirectTo) { /* Write it to disk now, so that the cache can drop it */
+    if (   sync_file_range(pDC->hTo, pDC->offWrite, (off_t)done, SYNC_FILE_RANGE_WAIT_BEFORE
+			   | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)
+	&& ((errno == EIO) || (errno == ENOSPC))) {
+      pDC->iErr = 2;
+      pDC->iErrno = errno;
+      return pParam;
     }
+    posix_fadvise(pDC->hTo, pDC->offWrite, (off_t)done, POSIX_FADV_DONTNEED);
+  }
+  return pParam;
+}
+
+/* Wait for the write in progress, if any. Return its result. */
+static int DirectWait(directCopy *pDC) {
+  if (pDC->bWriting) {
+    pthread_join(pDC->hThread, NULL);
+    pDC->bWriting = FALSE;
+  }
+  if (pDC->iErr) errno = pDC->iErrno;
+  return pDC->iErr;
+}
+
+int DirectStart(directCopy *pDC, int hFrom, int hTo) {
+  void *pBuf;
+
+  if (posix_memalign(&pBuf, DIRECT_ALIGN, 2 * DIRECT_BUFFERSIZE)) return 1;
+  memset(pDC, 0, sizeof(directCopy));
+  pDC->pBuf = pBuf;
+  pDC->hFrom = hFrom;
+  pDC->hTo = hTo;
+  pDC->bDirectFrom = SetDirectIO(hFrom, TRUE);
+  pDC->bDirectTo = SetDirectIO(hTo, TRUE);
+  DEBUG_PRINTF(("// O_DIRECT: Source %s, target %s\n", pDC->bDirectFrom ? "on" : "off",
+		pDC->bDirectTo ? "on" : "off"));
+  return 0;
+}
+
+int CopyDirect(directCopy *pDC, off_t offset, size_t length) {
+  char *pBuf = pDC->pBuf + (pDC->iBuf * DIRECT_BUFFERSIZE);
+  size_t toread = (length + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+  ssize_t n;
+
+  /* O_DIRECT reads whole blocks, so read the tail rounded up */
+  n = ReadAt(pDC->hFrom, pBuf, toread, offset);
+  if ((n < 0) && (errno == EINVAL) && pDC->bDirectFrom) { /* Alignment not supported */
+    SetDirectIO(pDC->hFrom, FALSE);
+    pDC->bDirectFrom = FALSE;
+    n = ReadAt(pDC->hFrom, pBuf, toread, offset);
+  }
+  if (n < (ssize_t)length) return 1;
+  if (!pDC->bDirectFrom) posix_fadvise(pDC->hFrom, offset, (off_t)length, POSIX_FADV_DONTNEED);
+
+  if (DirectWait(pDC)) return 2; /* The previous write failed */
+  pDC->pWrite = pBuf;
+  pDC->nWrite = length;
+  pDC->offWrite = offset;
+  XDEBUG_PRINTF(("pwrite(%d, %"PRIuPTR", %"PRIdMAX");\n", pDC->hTo, length, (intmax_t)offset));
+  if (pthread_create(&pDC->hThread, NULL, DirectWriteThread, pDC)) {
+    DirectWriteThread(pDC); /* Could not start a thread. Write it now. */
+    if (DirectWait(pDC)) return 2;
+  } else {
+    pDC->bWriting = TRUE;
+  }
+  pDC->iBuf ^= 1;
+  return 0;
+}
+
+int DirectEnd(directCopy *pDC, int iErr) {
+  int iErrno = errno;
+
+  if (DirectWait(pDC) && !iErr) {
+    iErr = 2;
+    iErrno = errno;
+  }
+  free(pDC->pBuf);
+  errno = iErrno;
+  return iErr;
+}
+
+#endif /* HAS_DIRECT_IO */
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    Preallocate						      |
+|                                                                             |
+|   Description:    Reserve the disk space for data about to be written       |
+|                                                                             |
+|   Parameters:     int hFile	    Destination file handle		      |
+|                   off_t offset    Where the data will be written	      |
+|                   off_t length    Its size				      |
+|                                                                             |
+|   Return value:   0 = Success, or not supported			      |
+|                   2 = Not enough space				      |
+|                                                                             |
+|   Notes:	    Telling the file system the final size lets it allocate   |
+|		    contiguous blocks, even when several files are written    |
+|		    in parallel with option -j. It also detects a full disk   |
+|		    before copying anything.				      |
+|		    							      |
+|		    CopyData() calls it only after FICLONE failed, as a	      |
+|		    reflink copy needs no new space.			      |
+|		    							      |
+|		    FALLOC_FL_KEEP_SIZE leaves the file size unchanged, so    |
+|		    that it grows as the data is written, as before.	      |
+|		    Does nothing for data smaller than PREALLOC_MIN_SIZE.     |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.				      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+#if HAS_SPARSE_COPY
+
+int Preallocate(int hFile, off_t offset, off_t length) {
+  if (length < PREALLOC_MIN_SIZE) return 0;
+  XDEBUG_PRINTF(("fallocate(%d, KEEP_SIZE, %"PRIdMAX", %"PRIdMAX");\n", hFile, (intmax_t)offset, (intmax_t)length));
+  if (fallocate(hFile, FALLOC_FL_KEEP_SIZE, offset, length)) {
+    if ((errno == ENOSPC) || (errno == EDQUOT)) return 2;
+    DEBUG_PRINTF(("// Can't preallocate. %s\n", strerror(errno))); /* Not supported */
+  }
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    NextDataExtent					      |
+|                                                                             |
+|   Description:    Find the next data extent in a sparse file		      |
+|                                                                             |
+|   Parameters:     int hFrom	    Source file handle			      |
+|                   int hTo	    Destination file handle		      |
+|                   off_t *pOffset  In: Where to search from. Out: Its start  |
+|                   off_t *pDataEnd Out: Its end			      |
+|                   off_t filelen   The source size			      |
+|                                                                             |
+|   Return value:   0 = Success. *pOffset = filelen if no more data.	      |
+|                   1 = Read error					      |
+|                   2 = Not enough space				      |
+|                                                                             |
+|   Notes:	    Uses lseek(SEEK_DATA) and lseek(SEEK_HOLE), so that the   |
+|		    holes are not copied as zeros. The target keeps the same  |
+|		    holes, and the copy time depends only on the data size.   |
+|		    File systems that don't support it report a single data   |
+|		    extent for the whole file.				      |
+|		    							      |
+|		    Then preallocates that extent in the target.	      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.				      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+int NextDataExtent(int hFrom, int hTo, off_t *pOffset, off_t *pDataEnd, off_t filelen) {
+  off_t data = lseek(hFrom, *pOffset, SEEK_DATA);
+  off_t hole;
+
+  if (data < 0) {
+    if (errno != ENXIO) return 1;
+    data = filelen; /* No more data beyond that offset */
+  }
+  if (data >= filelen) {
+    *pOffset = filelen;
+    return 0;
+  }
+  hole = lseek(hFrom, data, SEEK_HOLE);
+  if (hole < 0) return 1;
+  if ((hole <= data) || (hole > filelen)) hole = filelen; /* The file changed */
+  XDEBUG_PRINTF(("// Data extent %"PRIdMAX" to %"PRIdMAX"\n", (intmax_t)data, (intmax_t)hole));
+  *pOffset = data;
+  *pDataEnd = hole;
+  return Preallocate(hTo, data, hole - data);
+}
+
+#endif /* HAS_SPARSE_COPY */
+
+#if HAS_THREADS
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    PipeStart						      |
+|                                                                             |
+|   Description:    Copy files in parallel with worker threads		      |
+|                                                                             |
+|   Notes:	    The main thread scans the directories, decides what to    |
+|		    copy, creates the target directories, opens both files,   |
+|		    and displays the file names. So the target directories    |
+|		    always exist before the files in them are created, and    |
+|		    the output is the same as without option -j.	      |
+|		    							      |
+|		    Then PipeAdd() queues the open files in a ring of	      |
+|		    4*nThreads jobs, and the worker threads run CopyData()    |
+|		    on them. When the ring is full, the main thread waits for |
+|		    the oldest job to be done. Jobs are retired in the order  |
+|		    they were queued, so errors are reported in a stable      |
+|		    order too.						      |
+|		    							      |
+|		    Each queued job keeps two files open, so the ring is      |
+|		    made smaller if RLIMIT_NOFILE does not allow that many.   |
+|		    The directory scan also keeps up to three fds open per    |
+|		    recursion level. So if an open() still fails with EMFILE  |
+|		    in the main thread, PipeFreeFd() waits for the oldest     |
+|		    job to close its files, and the open() is retried.	      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created these routines.				      |
+|    2026-10-16 JFL Size the ring from RLIMIT_NOFILE. Added PipeFreeFd().     |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+typedef struct _copyPipe {	/* The copy pipeline state */
+  pthread_mutex_t mutex;	    /* Protects all fields below */
+  pthread_cond_t cvWork;	    /* Signaled when a job is queued, or at the end */
+  pthread_cond_t cvDone;	    /* Signaled when a job is done */
+  copyJob *pJobs;		    /* The ring of jobs */
+  int nJobs;			    /* Its size */
+  long nAdded;			    /* Number of jobs queued so far */
+  long nStarted;		    /* Number of jobs taken by worker threads */
+  long nRetired;		    /* Number of jobs done and reported */
+  int nErrors;			    /* Number of failed copies not returned yet */
+  int bExit;			    /* TRUE = Worker threads must exit */
+  int nThreads;			    /* Number of worker threads */
+  pthread_t *pThreads;		    /* The worker threads */
+} copyPipe;
+
+static copyPipe *pPipe = NULL;	/* The pipeline, or NULL if not started */
+
+static void *CopyThread(void *pParam) {
+  char *pBuf = malloc(BUFFERSIZE); /* This thread's copy buffer */
+  copyJob *pJob;
+
+  if (!pBuf) {
+    fprintf(stderr, "Error: Not enough memory.\n");
+    exit(1);
+  }
+  pthread_mutex_lock(&pPipe->mutex);
+  while (1) {
+    if (pPipe->nStarted == pPipe->nAdded) {
+      if (pPipe->bExit) break;
+      pthread_cond_wait(&pPipe->cvWork, &pPipe->mutex);
+      continue;
+    }
+    pJob = pPipe->pJobs + (pPipe->nStarted++ % pPipe->nJobs);
+    pthread_mutex_unlock(&pPipe->mutex);
+    CopyData(pJob, pBuf, FALSE);
+    pthread_mutex_lock(&pPipe->mutex);
+    pJob->bDone = TRUE;
+    pthread_cond_broadcast(&pPipe->cvDone);
+  }
+  pthread_mutex_unlock(&pPipe->mutex);
+  free(pBuf);
+  return pParam;
+}
+
+void PipeStart(int nThreads) {
+  int i;
+  int nJobs = 4 * nThreads;
+  struct rlimit rl;
+
+  if ((!getrlimit(RLIMIT_NOFILE, &rl)) && (rl.rlim_cur != RLIM_INFINITY)) {
+    rlim_t nMax = (rl.rlim_cur > FDS_RESERVED) ? (rl.rlim_cur - FDS_RESERVED) / 2 : 0;
+    if ((rlim_t)nJobs > nMax) nJobs = (nMax > 0) ? (int)nMax : 1;
+    if (nThreads > nJobs) nThreads = nJobs; /* More threads would have nothing to do */
+    DEBUG_PRINTF(("// Up to %d copies queued, for %ld fds\n", nJobs, (long)rl.rlim_cur));
+  }
+  pPipe = calloc(1, sizeof(copyPipe));
+  if (pPipe) {
+    pPipe->nJobs = nJobs;
+    pPipe->pJobs = calloc(pPipe->nJobs, sizeof(copyJob));
+    pPipe->pThreads = calloc(nThreads, sizeof(pthread_t));
+  }
+  if ((!pPipe) || (!pPipe->pJobs) || (!pPipe->pThreads)) {
+    fprintf(stderr, "Error: Not enough memory.\n");
+    do_exit(1);
+  }
+  pthread_mutex_init(&pPipe->mutex, NULL);
+  pthread_cond_init(&pPipe->cvWork, NULL);
+  pthread_cond_init(&pPipe->cvDone, NULL);
+  for (i = 0; i < nThreads; i++) {
+    if (pthread_create(pPipe->pThreads + i, NULL, CopyThread, NULL)) break;
+  }
+  pPipe->nThreads = i;
+  DEBUG_PRINTF(("// Started %d copy threads\n", i));
+  if (!i) { /* Could not start any thread. Copy files in the main thread. */
+    free(pPipe->pThreads);
+    free(pPipe->pJobs);
+    free(pPipe);
+    pPipe = NULL;
+    iJobs = 1;
+  }
+}
+
+/* Wait for the oldest job to be done, and report its error if any. Called with the mutex locked. */
+static void PipeRetire(void) {
+  copyJob *pJob = pPipe->pJobs + (pPipe->nRetired % pPipe->nJobs);
+
+  while (!pJob->bDone) pthread_cond_wait(&pPipe->cvDone, &pPipe->mutex);
+  if (pJob->iErr) {
+    printError("Error: Failed to create \"%s\". %s", pJob->name2, strerror(pJob->iErrno));
+    pPipe->nErrors += 1;
+  }
+  calls.nSet += pJob->nSetCalls;
+#if HAS_DELTA
+  if (pJob->bDelta) {
+    nDeltaSize += pJob->filelen;
+    nDeltaWritten += pJob->nWritten;
+  }
+#endif
+  free(pJob->name1);
+  free(pJob->name2);
+  pPipe->nRetired += 1;
+}
+
+int PipeAdd(copyJob *pJob) {
+  copyJob *pSlot;
+  char *name1 = strdup(pJob->name1);
+  char *name2 = strdup(pJob->name2);
+
+  if ((!name1) || (!name2)) { /* Then copy it now */
+    free(name1);
+    free(name2);
+    return CopyData(pJob, buffer, FALSE);
+  }
+  pthread_mutex_lock(&pPipe->mutex);
+  /* Report the errors as early as possible, but without waiting if possible */
+  while (   (pPipe->nRetired < pPipe->nStarted)
+	 && pPipe->pJobs[pPipe->nRetired % pPipe->nJobs].bDone) {
+    PipeRetire();
+  }
+  if ((pPipe->nAdded - pPipe->nRetired) == pPipe->nJobs) PipeRetire(); /* The ring is full */
+  pSlot = pPipe->pJobs + (pPipe->nAdded % pPipe->nJobs);
+  *pSlot = *pJob;
+  pSlot->name1 = name1;
+  pSlot->name2 = name2;
+  pSlot->bDone = FALSE;
+  pPipe->nAdded += 1;
+  pthread_cond_signal(&pPipe->cvWork);
+  pthread_mutex_unlock(&pPipe->mutex);
+  return 0;
+}
+
+/* After open() failed with EMFILE or ENFILE, wait for the oldest queued copy to close its files.
+   Return TRUE if it did, so that the open() can be retried, else FALSE with errno unchanged. */
+int PipeFreeFd(void) {
+  int iErrno = errno;
+  int bFreed = FALSE;
+
+  if (pPipe && ((iErrno == EMFILE) || (iErrno == ENFILE))) {
+    pthread_mutex_lock(&pPipe->mutex);
+    if (pPipe->nRetired < pPipe->nAdded) {
+      PipeRetire();
+      bFreed = TRUE;
+    }
+    pthread_mutex_unlock(&pPipe->mutex);
+  }
+  errno = iErrno;
+  return bFreed;
+}
+
+int PipeDrain(void) {
+  int nErrors;
+
+  if (!pPipe) return 0;
+  pthread_mutex_lock(&pPipe->mutex);
+  while (pPipe->nRetired < pPipe->nAdded) PipeRetire();
+  nErrors = pPipe->nErrors;
+  pPipe->nErrors = 0;
+  pthread_mutex_unlock(&pPipe->mutex);
+  return nErrors;
+}
+
+void PipeStop(void) {
+  int i;
+
+  if (!pPipe) return;
+  pthread_mutex_lock(&pPipe->mutex);
+  pPipe->bExit = TRUE;
+  pthread_cond_broadcast(&pPipe->cvWork);
+  pthread_mutex_unlock(&pPipe->mutex);
+  for (i = 0; i < pPipe->nThreads; i++) pthread_join(pPipe->pThreads[i], NULL);
+  pthread_mutex_destroy(&pPipe->mutex);
+  pthread_cond_destroy(&pPipe->cvWork);
+  pthread_cond_destroy(&pPipe->cvDone);
+  free(pPipe->pThreads);
+  free(pPipe->pJobs);
+  free(pPipe);
+  pPipe = NULL;
+}
+
+#endif /* HAS_THREADS */
+
+/*---------------------------------------------------------------------------*\
+*                                                                             *
+|   Function:	    CopyInKernel					      |
+|                                                                             |
+|   Description:    Copy part of a file without a user space buffer	      |
+|                                                                             |
+|   Parameters:     int hFrom	    Source file handle			      |
+|                   int hTo	    Destination file handle		      |
+|                   off_t offset    Where to start copying, in both files     |
+|                   off_t length    Number of bytes left to copy	      |
+|                   int *piMethod   In/out: The method to try first	      |
+|                                                                             |
+|   Return value:   The number of bytes copied. 0 = Use the buffered copy.    |
+|                                                                             |
+|   Notes:	    Tries in order:					      |
+|		    - ioctl(FICLONE) shares the data blocks on file systems   |
+|		      that support reflinks, like Btrfs or XFS. Whole files.  |
+|		    - copy_file_range() copies in the kernel, or lets the     |
+|		      file system or NFS server do it.			      |
+|		    - sendfile() copies from the page cache, for kernels or   |
+|		      file systems pairs where copy_file_range() fails.       |
+|		    When a method fails, for whatever reason, the next one is |
+|		    tried from the same offset, and *piMethod is updated so   |
+|		    that the next calls for this file start with it. If all   |
+|		    fail, the caller uses its buffered copy loop. That loop   |
+|		    then reports actual read or write errors, and deletes     |
+|		    the partial copy as usual.				      |
+|		    							      |
+|		    Copies at most KERNEL_COPY_CHUNK bytes per call, so that  |
+|		    the caller can update its progress display.		      |
+|                                                                             |
+|   History:								      |
+|    2026-10-16 JFL Created this routine.				      |
+*                                                                             *
+\*---------------------------------------------------------------------------*/
+
+#if HAS_KERNEL_COPY
+
+off_t CopyInKernel(int hFrom, int hTo, off_t offset, off_t length, int *piMethod) {
+  size_t tocopy = (size_t)min(KERNEL_COPY_CHUNK, length);
+  ssize_t done;
+
+  while (*piMethod != KCOPY_NONE) {
+    done = -1;
+    switch (*piMethod) {
+#ifdef FICLONE
+      case KCOPY_CLONE:
+	if (!offset) {
+	  XDEBUG_PRINTF(("ioctl(%d, FICLONE, %d);\n", hTo, hFrom));
+	  if (!ioctl(hTo, FICLONE, hFrom)) return length; /* The whole file is done */
+	}
+	break;
+#endif
+      case KCOPY_RANGE: {
+	off_t offFrom = offset;
+	off_t offTo = offset;
+	XDEBUG_PRINTF(("copy_file_range(%d, %"PRIdMAX", %d, %"PRIuPTR");\n", hFrom, (intmax_t)offset, hTo, tocopy));
+	done = copy_file_range(hFrom, &offFrom, hTo, &offTo, tocopy, 0);
+	break;
+      }
+      case KCOPY_SENDFILE: {
+	off_t offFrom = offset;
+	XDEBUG_PRINTF(("sendfile(%d, %d, %"PRIdMAX", %"PRIuPTR");\n", hTo, hFrom, (intmax_t)offset, tocopy));
+	if (lseek(hTo, offset, SEEK_SET) == offset) done = sendfile(hTo, hFrom, &offFrom, tocopy);
+	break;
+      }
+      default:
+	break;
+    }
+    if (done > 0) return (off_t)done;
+    if (!done) break; /* Unexpected end of file. Let the buffered copy report it. */
+    DEBUG_PRINTF(("// Kernel copy method %d failed. %s\n", *piMethod, strerror(errno)));
+    *piMethod += 1;	/* Try the next method */
+  }
+  *piMethod = KCOPY_NONE;
+  return 0;
+}
+
+#endif /* HAS_KERNEL_COPY */
 
 /*---------------------------------------------------------------------------*\
 *                                                                             *
@@ -1374,6 +2676,8 @@ retry_open_targetfile:
 |                                                                             |
 |   Parameters:     char *name1	    Source file pathname                      |
 |                   char *name2	    Destination file pathname		      |
+|                   fileMeta *pm1   Source file metadata		      |
+|                   fileMeta *pm2   Destination file metadata		      |
 |                                                                             |
 |   Return value:   0 = Success, else error and errno set		      |
 |                                                                             |
@@ -1384,16 +2688,18 @@ retry_open_targetfile:
 |                   message is displayed by the caller, and having both is    |
 |                   confusing. To do: Build an error message string, and      |
 |                   pass it back to the caller.                               |
+|    2026-10-16 JFL Don't check the target directory if the caller knows it   |
+|                   exists.                                                   |
 *                                                                             *
 \*---------------------------------------------------------------------------*/
 
-int copy(char *name1, char *name2)
+int copy(char *name1, char *name2, fileMeta *pm1, fileMeta *pm2)
     {
     int e;
     char path[PATHNAME_SIZE];
 
     strsfp(name2, path, NULL);
-    if (!exists(path)) {
+    if (!pm2->bDirExists && !exists(path)) {
       e = mkdirp(path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
       if (e) {
       	printError("Error: Failed to create directory \"%s\". %s", path, strerror(errno));
@@ -1401,7 +2707,7 @@ int copy(char *name1, char *name2)
       }
     }
 
-    e = copyf(name1, name2);
+    e = copyf(name1, name2, &pm1->st, pm2->bExists ? &pm2->st : NULL);
 #if NEEDED
     switch (e)
         {
@@ -1432,6 +2738,7 @@ int exist_file(char *name)	/* Does this file exist? (TRUE/FALSE) */
 
     DEBUG_ENTER(("exist_file(\"%s\");\n", name));
 
+    calls.nOpen += 1;
     pf = fopen(name, "r");
     if (pf)
 	{
@@ -1450,6 +2757,7 @@ int file_empty(char *name)	/* Is this file empty? (TRUE/FALSE) */
 
     DEBUG_ENTER(("file_empty(\"%s\");\n", name));
 
+    calls.nOpen += 1;
     pf = fopen(name, "r");
     if (pf)
 	{
@@ -1476,6 +2784,7 @@ int is_directory(char *name)	/* Is name a directory? -> TRUE/FALSE */
 	RETURN_CONST_COMMENT(FALSE, ("Directory %s does not exist\n", name));
 	}
 
+    calls.nStat += 1;
     err = lstat(name, &sstat); // Use lstat, as stat does not detect SYMLINKDs.
 
     result = ((err == 0) && (sstat.st_mode & S_IFDIR));
@@ -1512,6 +2821,7 @@ time_t getmodified(char *name) {
   time_t result = 0L; /* Return 0 = invalid time for missing file */
 
   if (name && *name) {
+    calls.nStat += 1;
     err = lstat(name, &sstat);
     if (!err) result = sstat.st_mtime;
   }
@@ -1549,7 +2859,9 @@ time_t getmodified(char *name) {
 
 int isdir(const char *pszPath) {
   struct stat sstat;
-  int iErr = lstat(pszPath, &sstat); /* Use lstat, as stat does not detect SYMLINKDs. */
+  int iErr;
+  calls.nStat += 1;
+  iErr = lstat(pszPath, &sstat); /* Use lstat, as stat does not detect SYMLINKDs. */
   if (iErr) return 0;
 #if defined(S_ISLNK) && S_ISLNK(S_IFLNK) /* In DOS it's defined, but always returns 0 */
   if (S_ISLNK(sstat.st_mode)) {
@@ -1726,6 +3038,7 @@ void strsfp(const char *pathname, char *path, char *name)   /* Split file pathna
 |    2015-01-08 JFL Fallback to using chmod and utimes if lchmod and lutimes  |
 |                   are not implemented. This will cause minor problems if the|
 |                   target is a link, but will work well in all other cases.  |
+|    2026-10-16 JFL Added copydateM(), for callers that have the source info. |
 *									      *
 \*---------------------------------------------------------------------------*/
 
@@ -1750,19 +3063,17 @@ int lchmod1(const char *path, mode_t mode) {
 }
 #endif
 
-#ifndef _STRUCT_TIMEVAL
+#if !defined(_STRUCT_TIMEVAL) && !defined(__timeval_defined) /* glibc >= 2.26 defines the latter */
 /* No support for micro-second file time resolution. Use utime(). */
-int copydate(char *pszToFile, char *pszFromFile) { /* Copy the file dates */
+int copydateM(char *pszToFile, struct stat *pstFrom) { /* Copy the file dates */
   /* Note: "struct _stat" and "struct _utimbuf" don't compile under Linux */
-  struct stat stFrom = {0};
   struct utimbuf utbTo = {0};
   int err;
-  err = lstat(pszFromFile, &stFrom);
   /* Copy file permissions too */
-  err = lchmod(pszToFile, stFrom.st_mode);
+  err = lchmod(pszToFile, pstFrom->st_mode);
   /* And copy file times */
-  utbTo.actime = stFrom.st_atime;
-  utbTo.modtime = stFrom.st_mtime;
+  utbTo.actime = pstFrom->st_atime;
+  utbTo.modtime = pstFrom->st_mtime;
   err = lutime(pszToFile, &utbTo);
   DEBUG_CODE({
     struct tm *pTime;
@@ -1799,27 +3110,24 @@ int lutimes1(const char *path, const struct timeval times[2]) {
 #endif
 
 /* Micro-second file time resolution supported. Use utimes(). */
-int copydate(char *pszToFile, char *pszFromFile) { /* Copy the file dates */
-  /* Note: "struct _stat" and "struct _utimbuf" don't compile under Linux */
-  struct stat stFrom = {0};
+int copydateM(char *pszToFile, struct stat *pstFrom) { /* Copy the file dates */
   struct timeval tvTo[2] = {{0}, {0}};
   int err;
-  DEBUG_PRINTF(("copydate(\"%s\", \"%s\")\n", pszToFile, pszFromFile));
-  lstat(pszFromFile, &stFrom);
+  DEBUG_PRINTF(("copydateM(\"%s\", %p)\n", pszToFile, pstFrom));
   /* Copy file permissions too */
-  err = lchmod(pszToFile, stFrom.st_mode);
+  err = lchmod(pszToFile, pstFrom->st_mode);
   /* And copy file times */
-  TIMESPEC_TO_TIMEVAL(&tvTo[0], &stFrom.st_atim);
-  TIMESPEC_TO_TIMEVAL(&tvTo[1], &stFrom.st_mtim);
+  TIMESPEC_TO_TIMEVAL(&tvTo[0], &pstFrom->st_atim);
+  TIMESPEC_TO_TIMEVAL(&tvTo[1], &pstFrom->st_mtim);
   err = lutimes(pszToFile, tvTo);
 #ifndef _MSVCLIBX_H_ /* Trace lutimes() call and return in Linux too */
   DEBUG_CODE({
     struct tm *pTime;
-    char buf[40];
-    pTime = LocalFileTime(&(stFrom.st_mtime)); // Time of last data modification
+    char buf[64];
+    pTime = LocalFileTime(&(pstFrom->st_mtime)); // Time of last data modification
     sprintf(buf, "%4d-%02d-%02d %02d:%02d:%02d.%06ld",
 	    pTime->tm_year + 1900, pTime->tm_mon + 1, pTime->tm_mday,
-	    pTime->tm_hour, pTime->tm_min, pTime->tm_sec, (long)stFrom.st_mtim.tv_nsec / 1000);
+	    pTime->tm_hour, pTime->tm_min, pTime->tm_sec, (long)pstFrom->st_mtim.tv_nsec / 1000);
     DEBUG_PRINTF((VALUEIZE(lutimes) "(\"%s\", %s) = %d\n", pszToFile, buf, err));
   });
 #endif
@@ -1827,6 +3135,16 @@ int copydate(char *pszToFile, char *pszFromFile) { /* Copy the file dates */
 }
 #endif /* !defined(_STRUCT_TIMEVAL) */
 
+int copydate(char *pszToFile, char *pszFromFile) { /* Copy the file dates */
+  /* Note: "struct _stat" and "struct _utimbuf" don't compile under Linux */
+  struct stat stFrom = {0};
+  DEBUG_PRINTF(("copydate(\"%s\", \"%s\")\n", pszToFile, pszFromFile));
+  calls.nStat += 1;
+  lstat(pszFromFile, &stFrom);
+  calls.nSet += 2;
+  return copydateM(pszToFile, &stFrom);
+}
+
 /*---------------------------------------------------------------------------*\
 *                                                                             *
 |   Function:	    _filelength						      |
@@ -2088,6 +3406,7 @@ int zapFile(const char *path, zapOpts *pzo) {
 
   DEBUG_ENTER(("zapFile(\"%s\");\n", path));
 
+  calls.nStat += 1;
   iErr = lstat(path, &sStat); /* Use lstat, as stat does not detect SYMLINKDs. */
   if (iErr && (errno == ENOENT)) RETURN_INT(0); /* Already deleted. Not an error. */
   if (iErr) RETURN_INT(1);
@@ -2115,7 +3434,10 @@ int zapDirM(const char *path, int iMode, zapOpts *pzo) {
     RETURN_INT(1);
   }
 
-  pDir = opendir(path);
+  do {
+    calls.nOpen += 1;
+    pDir = opendir(path);
+  } while ((!pDir) && PipeFreeFd());
   if (!pDir) RETURN_INT(1);
   while ((pDE = readdir(pDir))) {
     DEBUG_PRINTF(("// Dir Entry \"%s\" d_type=%d\n", pDE->d_name, (int)(pDE->d_type)));
@@ -2124,6 +3446,7 @@ int zapDirM(const char *path, int iMode, zapOpts *pzo) {
 #if _DIRENT2STAT_DEFINED /* MsvcLibX return DOS/Windows stat info in the dirent structure */
     iErr = dirent2stat(pDE, &sStat);
 #else /* Unix has to query it separately */
+    calls.nStat += 1;
     iErr = -lstat(pPath, &sStat); /* If error, iErr = 1 = # of errors */
 #endif
     if (!iErr) switch (pDE->d_type) {
@@ -2179,6 +3502,7 @@ int zapDir(const char *path, zapOpts *pzo) {
 
   DEBUG_ENTER(("zapDir(\"%s\");\n", path));
 
+  calls.nStat += 1;
   iErr = lstat(path, &sStat); /* Use lstat, as stat does not detect SYMLINKDs. */
   if (iErr && (errno == ENOENT)) RETURN_INT(0); /* Already deleted. Not an error. */
   if (iErr) {